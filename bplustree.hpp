@@ -0,0 +1,958 @@
+#ifndef BPLUSTREE_HPP
+#define BPLUSTREE_HPP
+
+#include <btree.hpp>
+#include <iterator>
+
+#define keys node_keys()
+#define values node_values()
+
+namespace btree {
+
+    template<typename K, typename V, unsigned Search = BINARY_SEARCH, size_t B = DEFAULT_BTREE_FACTOR, typename Compare = std::less<K>,
+            typename Alloc = std::allocator<std::pair<const K, V>>>
+    class BPlusTree;
+
+    namespace __bplus_impl {
+
+        template<typename K, typename V, unsigned Search, size_t B, typename Compare>
+        struct Leaf;
+
+        template<typename K, typename V, unsigned Search, size_t B, typename Compare>
+        struct Internal;
+
+        /*
+         * Header shared by both node kinds. Only leaves carry values; internal nodes hold separator keys and child
+         * pointers. Separator i is greater than every key below children[i] and not greater than any key below
+         * children[i + 1]; it need not be present in a leaf anymore.
+         */
+        template<typename K, typename V, unsigned Search, size_t B, typename Compare>
+        struct NodeBase {
+            static_assert(B > 2, "B is too small");
+            using Internal = __bplus_impl::Internal<K, V, Search, B, Compare>;
+            using Leaf = __bplus_impl::Leaf<K, V, Search, B, Compare>;
+            using KeyBlock = std::aligned_storage_t<sizeof(K), alignof(K)>;
+            using ValueBlock = std::aligned_storage_t<sizeof(V), alignof(V)>;
+            static constexpr bool USE_SIMD = Search == SIMD_SEARCH && __btree_impl::simd_searchable<K, Compare>;
+
+            Internal *parent = nullptr;
+            uint16_t usage = 0;
+            uint16_t parent_idx = 0;
+
+            inline Internal *as_internal() {
+                return static_cast<Internal *>(this);
+            }
+
+            inline Leaf *as_leaf() {
+                return static_cast<Leaf *>(this);
+            }
+
+            /* key slots of a node holding up to `n` keys, padded for `simd_lower_bound` */
+            static constexpr size_t key_slots(size_t n) {
+                if constexpr (USE_SIMD) {
+                    return (n + __btree_impl::SIMD_LANES<K> - 1) / __btree_impl::SIMD_LANES<K> * __btree_impl::SIMD_LANES<K>;
+                } else {
+                    return n;
+                }
+            }
+
+            /* number of keys in [first, first + usage) that are less than `key` */
+            template<size_t Slots>
+            static inline uint16_t lower_bound(const K *first, uint16_t usage, const K &key, Compare &comp) {
+                if constexpr (USE_SIMD) {
+                    return __btree_impl::simd_lower_bound<Slots>(first, usage, key);
+                } else if constexpr (Search != LINEAR_SEARCH) {
+                    return std::lower_bound(first, first + usage, key, comp) - first;
+                } else {
+                    uint16_t i = 0;
+                    for (; i < usage && comp(first[i], key); ++i);
+                    return i;
+                }
+            }
+
+            /* hands the new right sibling `r` and its separator to the parent, growing a new root if needed */
+            template<typename Tree>
+            void promote(NodeBase *r, K key, Tree &tree) {
+                if (parent) {
+                    parent->adopt(r, std::move(key), parent_idx, tree);
+                    return;
+                }
+                auto node = tree.template allocate_node<Internal>();
+                node->usage = 1;
+                new(node->keys) K(std::move(key));
+                node->children[0] = this;
+                node->children[1] = r;
+                parent = r->parent = node;
+                parent_idx = 0;
+                r->parent_idx = 1;
+                ASSERT(tree.root == this);
+                tree.root = node;
+                tree.height++;
+            }
+        };
+
+        template<typename K, typename V, unsigned Search, size_t B, typename Compare>
+        struct alignas(64) Leaf : NodeBase<K, V, Search, B, Compare> {
+            using Node = NodeBase<K, V, Search, B, Compare>;
+            using Node::parent;
+            using Node::usage;
+            using Node::parent_idx;
+            static constexpr size_t KEY_SLOTS = Node::key_slots(2 * B - 1);
+
+            struct iterator {
+                uint16_t idx;
+                Leaf *node;
+
+                inline bool operator!=(const iterator &that) noexcept {
+                    return idx != that.idx || node != that.node;
+                }
+
+#ifndef __cpp_lib_three_way_comparison
+                inline bool operator==(const iterator &that) noexcept {
+                    return idx == that.idx && node == that.node;
+                }
+#endif
+
+                /* leaves are chained, so stepping never climbs; entering a leaf requests the one after it */
+                iterator &operator++() {
+                    if (++idx == node->usage) {
+                        node = node->next;
+                        idx = 0;
+                        if (node && node->next) prefetch(node->next);
+                    }
+                    return *this;
+                }
+
+                iterator operator++(int) {
+                    auto old = *this;
+                    ++*this;
+                    return old;
+                }
+
+                iterator &operator--() {
+                    if (idx) {
+                        idx--;
+                    } else {
+                        node = node->prev;
+                        idx = node ? node->usage - 1 : 0; // stepping back from the first entry gives `end()`
+                    }
+                    return *this;
+                }
+
+                std::pair<const K &, V &> operator*() {
+                    return {node->key_at(idx), node->value_at(idx)};
+                }
+            };
+
+            typename Node::KeyBlock __keys[KEY_SLOTS];
+            typename Node::ValueBlock __values[2 * B - 1];
+            Leaf *prev = nullptr;
+            Leaf *next = nullptr;
+
+            [[gnu::always_inline]] inline static void prefetch(Leaf *leaf) {
+                for (size_t line = 0; line < sizeof(Leaf); line += 64) {
+                    __builtin_prefetch(reinterpret_cast<char *>(leaf) + line);
+                }
+            }
+
+            inline K *node_keys() {
+                return reinterpret_cast<K *>(__keys);
+            }
+
+            inline V *node_values() {
+                return reinterpret_cast<V *>(__values);
+            }
+
+            inline K &key_at(size_t i) {
+                return keys[i];
+            }
+
+            inline V &value_at(size_t i) {
+                return values[i];
+            }
+
+            inline uint16_t search(const K &key, Compare &comp) {
+                return Node::template lower_bound<KEY_SLOTS>(keys, usage, key, comp);
+            }
+
+            void link_after(Leaf *left) {
+                prev = left;
+                next = left->next;
+                if (next) next->prev = this;
+                left->next = this;
+            }
+
+            void unlink() {
+                if (prev) prev->next = next;
+                if (next) next->prev = prev;
+                prev = next = nullptr;
+            }
+
+            template<typename Value>
+            std::optional<V> replace(uint16_t idx, Value &&value) {
+                std::optional<V> original(std::move(values[idx]));
+                std::destroy_at(values + idx);
+                new(values + idx) V(std::forward<Value>(value));
+                return original;
+            }
+
+            /* moves the upper half into a new right sibling, whose first key is copied up as the separator */
+            template<typename Tree>
+            iterator overflow(size_t position, Tree &tree) {
+                ASSERT(usage == 2 * B - 1);
+                auto r = tree.template allocate_node<Leaf>();
+                r->usage = B - 1;
+                r->link_after(this);
+                std::uninitialized_move(keys + B, keys + usage, r->keys);
+                std::uninitialized_move(values + B, values + usage, r->values);
+                std::destroy(keys + B, keys + usage);
+                std::destroy(values + B, values + usage);
+                usage = B;
+                this->promote(r, r->keys[0], tree);
+                if (position < B) return {uint16_t(position), this};
+                return {uint16_t(position - B), r};
+            }
+
+            /* constructs a new entry at `position` in place; returns where it is after any split */
+            template<typename Tree, typename Key, typename... Args>
+            iterator emplace_at(size_t position, Tree &tree, Key &&key, Args &&... args) {
+                __btree_impl::uninitialized_move_back(values + position, values + usage);
+                __btree_impl::uninitialized_move_back(keys + position, keys + usage);
+                new(values + position) V(std::forward<Args>(args)...);
+                new(keys + position) K(std::forward<Key>(key));
+                usage++;
+                if (usage == 2 * B - 1) {
+                    return overflow(position, tree);
+                }
+                return {uint16_t(position), this};
+            }
+
+            void borrow_left(Leaf *from) {
+                ASSERT(parent && parent_idx && from->usage > B - 1);
+                __btree_impl::uninitialized_move_back(keys, keys + usage);
+                __btree_impl::uninitialized_move_back(values, values + usage);
+                new(values) V(std::move(from->values[from->usage - 1]));
+                new(keys) K(std::move(from->keys[from->usage - 1]));
+                std::destroy_at(from->values + from->usage - 1);
+                std::destroy_at(from->keys + from->usage - 1);
+                from->usage--;
+                usage++;
+                parent->key_at(parent_idx - 1) = keys[0];
+            }
+
+            void borrow_right(Leaf *from) {
+                ASSERT(parent && parent_idx < parent->usage && from->usage > B - 1);
+                new(values + usage) V(std::move(from->values[0]));
+                new(keys + usage) K(std::move(from->keys[0]));
+                std::destroy_at(from->values);
+                std::destroy_at(from->keys);
+                __btree_impl::uninitialized_move_forward(from->values + 1, from->values + from->usage);
+                __btree_impl::uninitialized_move_forward(from->keys + 1, from->keys + from->usage);
+                from->usage--;
+                usage++;
+                parent->key_at(parent_idx) = from->keys[0];
+            }
+
+            template<typename Tree>
+            static void merge(Leaf *left, Leaf *right, Tree &tree) {
+                auto parent = left->parent;
+                ASSERT(parent && parent == right->parent && left->parent_idx + 1 == right->parent_idx);
+                std::uninitialized_move(right->values, right->values + right->usage, left->values + left->usage);
+                std::uninitialized_move(right->keys, right->keys + right->usage, left->keys + left->usage);
+                left->usage += right->usage;
+                right->unlink();
+                parent->remove(right->parent_idx);
+                tree.free_node(right);
+                parent->fix_underflow(tree);
+            }
+
+            template<typename Tree>
+            void fix_underflow(Tree &tree) {
+                if (usage >= B - 1 || !parent) return;
+                if (parent_idx) {
+                    auto target = parent->children[parent_idx - 1]->as_leaf();
+                    if (target->usage > B - 1) {
+                        borrow_left(target);
+                    } else {
+                        merge(target, this, tree);
+                    }
+                } else {
+                    auto target = parent->children[1]->as_leaf();
+                    if (target->usage > B - 1) {
+                        borrow_right(target);
+                    } else {
+                        merge(this, target, tree);
+                    }
+                }
+            }
+
+            template<typename Tree>
+            std::pair<K, V> erase(uint16_t index, Tree &tree) {
+                std::pair<K, V> result(std::move(keys[index]), std::move(values[index]));
+                std::destroy_at(keys + index);
+                std::destroy_at(values + index);
+                __btree_impl::uninitialized_move_forward(keys + index + 1, keys + usage);
+                __btree_impl::uninitialized_move_forward(values + index + 1, values + usage);
+                usage--;
+                fix_underflow(tree);
+                return result;
+            }
+
+            ~Leaf() {
+#ifdef DEBUG_MODE
+                alive_node--;
+#endif
+                std::destroy(keys, keys + usage);
+                std::destroy(values, values + usage);
+            }
+
+            Leaf() {
+#ifdef DEBUG_MODE
+                alive_node++;
+#endif
+            }
+        };
+
+        template<typename K, typename V, unsigned Search, size_t B, typename Compare>
+        struct alignas(64) Internal : NodeBase<K, V, Search, B, Compare> {
+            using Node = NodeBase<K, V, Search, B, Compare>;
+            using Node::parent;
+            using Node::usage;
+            using Node::parent_idx;
+
+            /*
+             * Branching factor of internal nodes: as many keys and children as fit in the bytes a `BTree` internal
+             * node of factor B spends on keys, values and children, but never less than B.
+             */
+            static constexpr size_t BUDGET = sizeof(__btree_impl::BTreeNode<K, V, true, Search, Compare, B>) - sizeof(Node);
+            static constexpr size_t FACTOR = std::max(B, (BUDGET + sizeof(K)) / (2 * (sizeof(K) + sizeof(Node *))));
+            static constexpr size_t KEY_SLOTS = Node::key_slots(2 * FACTOR - 1);
+            static_assert(2 * FACTOR < (1u << 16u), "B is too large");
+
+            typename Node::KeyBlock __keys[KEY_SLOTS];
+            Node *children[2 * FACTOR];
+
+            inline K *node_keys() {
+                return reinterpret_cast<K *>(__keys);
+            }
+
+            inline K &key_at(size_t i) {
+                return keys[i];
+            }
+
+            /* index of the child whose range holds `key` */
+            inline uint16_t route(const K &key, Compare &comp) {
+                auto position = Node::template lower_bound<KEY_SLOTS>(keys, usage, key, comp);
+                if (position < usage && !comp(key, keys[position])) position++;
+                return position;
+            }
+
+            /* takes the new right sibling of children[position] together with their separator */
+            template<typename Tree>
+            void adopt(Node *r, K key, size_t position, Tree &tree) {
+                __btree_impl::uninitialized_move_back(keys + position, keys + usage);
+                std::memmove(children + position + 2, children + position + 1, (usage - position) * sizeof(Node *));
+                children[position + 1] = r;
+                r->parent = this;
+                for (size_t i = position + 1; i < usage + 2u; ++i) {
+                    children[i]->parent_idx = i;
+                }
+                new(keys + position) K(std::move(key));
+                usage++;
+                if (usage == 2 * FACTOR - 1) {
+                    split(tree);
+                }
+            }
+
+            /* keeps the left half, moves the right half into a new sibling and pushes the middle key up */
+            template<typename Tree>
+            void split(Tree &tree) {
+                auto r = tree.template allocate_node<Internal>();
+                r->usage = FACTOR - 1;
+                std::uninitialized_move(keys + FACTOR, keys + usage, r->keys);
+                std::memcpy(r->children, children + FACTOR, FACTOR * sizeof(Node *));
+                for (size_t i = 0; i < FACTOR; ++i) {
+                    r->children[i]->parent = r;
+                    r->children[i]->parent_idx = i;
+                }
+                K separator = std::move(keys[FACTOR - 1]);
+                std::destroy(keys + FACTOR - 1, keys + usage);
+                usage = FACTOR - 1;
+                this->promote(r, std::move(separator), tree);
+            }
+
+            /* forgets children[idx], which was merged into its left sibling, and the separator in front of it */
+            void remove(size_t idx) {
+                ASSERT(idx);
+                std::destroy_at(keys + idx - 1);
+                __btree_impl::uninitialized_move_forward(keys + idx, keys + usage);
+                std::memmove(children + idx, children + idx + 1, (usage - idx) * sizeof(Node *));
+                usage--;
+                for (size_t i = idx; i <= usage; ++i) {
+                    children[i]->parent_idx = i;
+                }
+            }
+
+            void borrow_left(Internal *from) {
+                ASSERT(parent && parent_idx && from->usage > FACTOR - 1);
+                __btree_impl::uninitialized_move_back(keys, keys + usage);
+                std::memmove(children + 1, children, (usage + 1) * sizeof(Node *));
+                new(keys) K(std::move(parent->keys[parent_idx - 1]));
+                children[0] = from->children[from->usage];
+                parent->keys[parent_idx - 1] = std::move(from->keys[from->usage - 1]);
+                std::destroy_at(from->keys + from->usage - 1);
+                from->usage--;
+                usage++;
+                for (size_t i = 0; i <= usage; ++i) {
+                    children[i]->parent = this;
+                    children[i]->parent_idx = i;
+                }
+            }
+
+            void borrow_right(Internal *from) {
+                ASSERT(parent && parent_idx < parent->usage && from->usage > FACTOR - 1);
+                new(keys + usage) K(std::move(parent->keys[parent_idx]));
+                children[usage + 1] = from->children[0];
+                children[usage + 1]->parent = this;
+                children[usage + 1]->parent_idx = usage + 1;
+                usage++;
+                parent->keys[parent_idx] = std::move(from->keys[0]);
+                std::destroy_at(from->keys);
+                __btree_impl::uninitialized_move_forward(from->keys + 1, from->keys + from->usage);
+                std::memmove(from->children, from->children + 1, from->usage * sizeof(Node *));
+                from->usage--;
+                for (size_t i = 0; i <= from->usage; ++i) {
+                    from->children[i]->parent_idx = i;
+                }
+            }
+
+            /* pulls the separator down between the two halves */
+            template<typename Tree>
+            static void merge(Internal *left, Internal *right, Tree &tree) {
+                auto parent = left->parent;
+                ASSERT(parent && parent == right->parent && left->parent_idx + 1 == right->parent_idx);
+                new(left->keys + left->usage) K(std::move(parent->keys[left->parent_idx]));
+                std::uninitialized_move(right->keys, right->keys + right->usage, left->keys + left->usage + 1);
+                std::memcpy(left->children + left->usage + 1, right->children, (right->usage + 1) * sizeof(Node *));
+                left->usage += right->usage + 1;
+                for (size_t i = left->usage - right->usage; i <= left->usage; ++i) {
+                    left->children[i]->parent = left;
+                    left->children[i]->parent_idx = i;
+                }
+                parent->remove(right->parent_idx);
+                tree.free_node(right);
+                parent->fix_underflow(tree);
+            }
+
+            /* rebalances after losing a child; a root left with a single child hands it the tree */
+            template<typename Tree>
+            void fix_underflow(Tree &tree) {
+                if (!parent) {
+                    if (usage) return;
+                    ASSERT(tree.root == this);
+                    tree.root = children[0];
+                    tree.root->parent = nullptr;
+                    tree.root->parent_idx = 0;
+                    tree.height--;
+                    tree.free_node(this);
+                    return;
+                }
+                if (usage >= FACTOR - 1) return;
+                if (parent_idx) {
+                    auto target = parent->children[parent_idx - 1]->as_internal();
+                    if (target->usage > FACTOR - 1) {
+                        borrow_left(target);
+                    } else {
+                        merge(target, this, tree);
+                    }
+                } else {
+                    auto target = parent->children[1]->as_internal();
+                    if (target->usage > FACTOR - 1) {
+                        borrow_right(target);
+                    } else {
+                        merge(this, target, tree);
+                    }
+                }
+            }
+
+            ~Internal() {
+#ifdef DEBUG_MODE
+                alive_node--;
+#endif
+                std::destroy(keys, keys + usage);
+            }
+
+            Internal() {
+#ifdef DEBUG_MODE
+                alive_node++;
+#endif
+            }
+        };
+    }
+
+    /*
+     * B+tree counterpart of `BTree`: all entries live in chained leaves and internal nodes only route, so descents
+     * never touch values, internal nodes fan out wider for the same size, and every erase happens at a leaf.
+     * Separators are copies of leaf keys, hence K must be copy constructible.
+     */
+    template<typename K, typename V, unsigned Search, size_t B, typename Compare, typename Alloc>
+    class BPlusTree {
+
+        using Node = __bplus_impl::NodeBase<K, V, Search, B, Compare>;
+        using Leaf = typename Node::Leaf;
+        using Internal = typename Node::Internal;
+        using CacheLine = __btree_impl::CacheLine;
+        using NodeAlloc = typename std::allocator_traits<Alloc>::template rebind_alloc<CacheLine>;
+        using NodeAllocTraits = std::allocator_traits<NodeAlloc>;
+        size_t _size = 0;
+        size_t height = 0; // number of internal levels above the leaves
+        Node *root = nullptr;
+
+        [[no_unique_address]] NodeAlloc alloc;
+        [[no_unique_address]] Compare comp;
+
+        template<typename, typename, unsigned, size_t, typename>
+        friend struct __bplus_impl::NodeBase;
+        template<typename, typename, unsigned, size_t, typename>
+        friend struct __bplus_impl::Leaf;
+        template<typename, typename, unsigned, size_t, typename>
+        friend struct __bplus_impl::Internal;
+
+        template<typename T>
+        T *allocate_node() {
+            static_assert(sizeof(T) % sizeof(CacheLine) == 0);
+            auto memory = NodeAllocTraits::allocate(alloc, sizeof(T) / sizeof(CacheLine));
+            return new(memory) T();
+        }
+
+        template<typename T>
+        void free_node(T *node) {
+            std::destroy_at(node);
+            NodeAllocTraits::deallocate(alloc, reinterpret_cast<CacheLine *>(node), sizeof(T) / sizeof(CacheLine));
+        }
+
+        void release(Node *node, size_t h) {
+            if (h) {
+                auto internal = node->as_internal();
+                for (size_t i = 0; i <= internal->usage; ++i) {
+                    release(internal->children[i], h - 1);
+                }
+                free_node(internal);
+            } else {
+                free_node(node->as_leaf());
+            }
+        }
+
+        /* copies a subtree, threading its leaves after `last` */
+        Node *copy(Node *node, size_t h, Internal *parent, Leaf *&last) {
+            Node *now;
+            if (h) {
+                auto from = node->as_internal();
+                auto internal = allocate_node<Internal>();
+                std::uninitialized_copy(from->keys, from->keys + from->usage, internal->keys);
+                internal->usage = from->usage;
+                for (size_t i = 0; i <= from->usage; ++i) {
+                    internal->children[i] = copy(from->children[i], h - 1, internal, last);
+                }
+                now = internal;
+            } else {
+                auto from = node->as_leaf();
+                auto leaf = allocate_node<Leaf>();
+                std::uninitialized_copy(from->keys, from->keys + from->usage, leaf->keys);
+                std::uninitialized_copy(from->values, from->values + from->usage, leaf->values);
+                leaf->usage = from->usage;
+                if (last) leaf->link_after(last);
+                last = leaf;
+                now = leaf;
+            }
+            now->parent = parent;
+            now->parent_idx = node->parent_idx;
+            return now;
+        }
+
+        /* number of nodes to spread `n` items over so that each holds at least `least` and about `target` */
+        static size_t node_count(size_t n, size_t target, size_t least) {
+            auto count = (n + target - 1) / target;
+            if (count > 1 && n / count < least) {
+                count = n / least;
+            }
+            return count;
+        }
+
+        Leaf *descend(const K &key) {
+            auto node = root;
+            for (auto h = height; h; --h) {
+                node = node->as_internal()->children[node->as_internal()->route(key, comp)];
+            }
+            return node->as_leaf();
+        }
+
+        Leaf *leftmost() {
+            auto node = root;
+            for (auto h = height; h; --h) {
+                node = node->as_internal()->children[0];
+            }
+            return node->as_leaf();
+        }
+
+        Leaf *rightmost() {
+            auto node = root;
+            for (auto h = height; h; --h) {
+                node = node->as_internal()->children[node->usage];
+            }
+            return node->as_leaf();
+        }
+
+        /* `position` in `leaf`, or the first entry of the next leaf if it is past the end */
+        static typename Leaf::iterator settle(Leaf *leaf, uint16_t position) {
+            if (position < leaf->usage) return {position, leaf};
+            return {0, leaf->next};
+        }
+
+        /* descends to `key`: an exact hit, or the leaf position where it belongs */
+        std::pair<typename Leaf::iterator, bool> locate(const K &key) {
+            if (root == nullptr) {
+                root = allocate_node<Leaf>();
+            }
+            auto leaf = descend(key);
+            auto position = leaf->search(key, comp);
+            return {{position, leaf}, position < leaf->usage && !comp(key, leaf->keys[position])};
+        }
+
+        template<typename Key, typename Value>
+        std::optional<V> insert_entry(Key &&key, Value &&value) {
+            auto [iter, found] = locate(key);
+            if (found) {
+                return iter.node->replace(iter.idx, std::forward<Value>(value));
+            }
+            iter.node->emplace_at(iter.idx, *this, std::forward<Key>(key), std::forward<Value>(value));
+            _size++;
+            return std::nullopt;
+        }
+
+        template<typename Key, typename... Args>
+        std::pair<typename Leaf::iterator, bool> try_emplace_entry(Key &&key, Args &&... args) {
+            auto [iter, found] = locate(key);
+            if (found) {
+                return {iter, false};
+            }
+            _size++;
+            return {iter.node->emplace_at(iter.idx, *this, std::forward<Key>(key), std::forward<Args>(args)...), true};
+        }
+
+        template<typename Key, typename Value>
+        std::pair<typename Leaf::iterator, bool> insert_or_assign_entry(Key &&key, Value &&value) {
+            auto [iter, found] = locate(key);
+            if (found) {
+                iter.node->value_at(iter.idx) = std::forward<Value>(value);
+                return {iter, false};
+            }
+            _size++;
+            return {iter.node->emplace_at(iter.idx, *this, std::forward<Key>(key), std::forward<Value>(value)), true};
+        }
+
+#ifdef DEBUG_MODE
+
+        /* every key below `node` must lie in [lo, hi) */
+        void validate(Node *node, size_t h, const K *lo, const K *hi, size_t &count, Leaf *&last) {
+            ASSERT(node == root || node->usage >= (h ? Internal::FACTOR - 1 : B - 1));
+            if (!h) {
+                auto leaf = node->as_leaf();
+                ASSERT(leaf->usage < 2 * B - 1);
+                ASSERT(leaf->prev == last);
+                ASSERT(!last || last->next == leaf);
+                last = leaf;
+                for (size_t i = 0; i < leaf->usage; ++i) {
+                    ASSERT(!lo || !comp(leaf->keys[i], *lo));
+                    ASSERT(!hi || comp(leaf->keys[i], *hi));
+                    ASSERT(!i || comp(leaf->keys[i - 1], leaf->keys[i]));
+                }
+                count += leaf->usage;
+                return;
+            }
+            auto internal = node->as_internal();
+            ASSERT(internal->usage < 2 * Internal::FACTOR - 1);
+            for (size_t i = 0; i <= internal->usage; ++i) {
+                auto child = internal->children[i];
+                ASSERT(child->parent == internal && child->parent_idx == i);
+                ASSERT(!i || i == internal->usage || comp(internal->keys[i - 1], internal->keys[i]));
+                validate(child, h - 1, i ? &internal->keys[i - 1] : lo, i < internal->usage ? &internal->keys[i] : hi,
+                         count, last);
+            }
+        }
+
+#endif
+    public:
+        using iterator = typename Leaf::iterator;
+
+        BPlusTree(Compare comp = Compare(), const Alloc &alloc = Alloc()) : alloc(alloc), comp(comp) {}
+
+        BPlusTree(BPlusTree &&that) noexcept(std::is_nothrow_move_constructible_v<Compare>)
+                : _size(std::exchange(that._size, 0)), height(std::exchange(that.height, 0)),
+                  root(std::exchange(that.root, nullptr)), alloc(std::move(that.alloc)), comp(std::move(that.comp)) {}
+
+        BPlusTree &operator=(BPlusTree &&that) noexcept(std::is_nothrow_move_assignable_v<Compare>) {
+            if (this == &that) return *this;
+            clear();
+            if constexpr (NodeAllocTraits::propagate_on_container_move_assignment::value) {
+                alloc = that.alloc;
+            } else {
+                ASSERT(alloc == that.alloc);
+            }
+            comp = std::move(that.comp);
+            root = std::exchange(that.root, nullptr);
+            height = std::exchange(that.height, 0);
+            _size = std::exchange(that._size, 0);
+            return *this;
+        }
+
+        void swap(BPlusTree &that) noexcept(std::is_nothrow_swappable_v<Compare>) {
+            using std::swap;
+            if constexpr (NodeAllocTraits::propagate_on_container_swap::value) {
+                swap(alloc, that.alloc);
+            } else {
+                ASSERT(alloc == that.alloc);
+            }
+            swap(comp, that.comp);
+            swap(root, that.root);
+            swap(height, that.height);
+            swap(_size, that._size);
+        }
+
+        BPlusTree(const BPlusTree &that) : alloc(NodeAllocTraits::select_on_container_copy_construction(that.alloc)) {
+            comp = that.comp;
+            _size = that._size;
+            height = that.height;
+            if (that.root) {
+                Leaf *last = nullptr;
+                root = copy(that.root, height, nullptr, last);
+            }
+        }
+
+        /*
+         * Builds a tree from a forward range sorted by strictly increasing key in O(n), level by level: entries
+         * are spread evenly over the leaves, and each level over the one above. `fill` is the fraction of each
+         * node's capacity to use, clamped to the minimum occupancy.
+         */
+        template<typename Iter>
+        static BPlusTree from_sorted(Iter first, Iter last, double fill = 1.0, Compare comp = Compare(),
+                                     const Alloc &alloc = Alloc()) {
+            BPlusTree tree(comp, alloc);
+            tree.assign_sorted(first, last, fill);
+            return tree;
+        }
+
+        template<typename Iter>
+        void assign_sorted(Iter first, Iter last, double fill = 1.0) {
+            clear();
+            size_t n = std::distance(first, last);
+            if (!n) return;
+            constexpr size_t F = Internal::FACTOR;
+            std::vector<Node *> level;
+            std::vector<K> lows; // first key below each node of `level`
+            auto count = node_count(n, std::clamp(size_t(fill * double(2 * B - 2) + 0.5), B - 1, 2 * B - 2), B - 1);
+            Leaf *prev = nullptr;
+            for (size_t i = 0; i < count; ++i) {
+                auto leaf = allocate_node<Leaf>();
+                if (prev) leaf->link_after(prev);
+                for (auto m = n / count + (i < n % count); m; --m, ++first, ++leaf->usage) {
+                    auto &&entry = *first;
+                    new(leaf->values + leaf->usage) V(std::forward<decltype(entry)>(entry).second);
+                    new(leaf->keys + leaf->usage) K(std::forward<decltype(entry)>(entry).first);
+                }
+                lows.push_back(leaf->keys[0]);
+                level.push_back(leaf);
+                prev = leaf;
+            }
+            auto target = std::clamp(size_t(fill * double(2 * F - 1) + 0.5), F, 2 * F - 1);
+            while (level.size() > 1) {
+                std::vector<Node *> upper;
+                std::vector<K> upper_lows;
+                auto parents = node_count(level.size(), target, F);
+                for (size_t i = 0, next = 0; i < parents; ++i) {
+                    auto node = allocate_node<Internal>();
+                    auto children = level.size() / parents + (i < level.size() % parents);
+                    upper_lows.push_back(std::move(lows[next]));
+                    for (size_t j = 0; j < children; ++j, ++next) {
+                        node->children[j] = level[next];
+                        level[next]->parent = node;
+                        level[next]->parent_idx = j;
+                        if (j) new(node->keys + j - 1) K(std::move(lows[next]));
+                    }
+                    node->usage = children - 1;
+                    upper.push_back(node);
+                }
+                level = std::move(upper);
+                lows = std::move(upper_lows);
+                height++;
+            }
+            root = level[0];
+            _size = n;
+        }
+
+#ifdef DEBUG_MODE
+
+        /* checks occupancy, separator bounds, parent links, the leaf chain and that all leaves sit at `height` */
+        void validate() {
+            if (!root) {
+                ASSERT(_size == 0);
+                return;
+            }
+            ASSERT(root->parent == nullptr);
+            size_t count = 0;
+            Leaf *last = nullptr;
+            validate(root, height, nullptr, nullptr, count, last);
+            ASSERT(count == _size);
+            ASSERT(last->next == nullptr);
+        }
+
+#endif
+
+        /* returns the replaced value on a hit; rvalue keys and values are moved into the tree */
+        template<typename Value = V>
+        std::optional<V> insert(const K &key, Value &&value) {
+            return insert_entry(key, std::forward<Value>(value));
+        }
+
+        template<typename Value = V>
+        std::optional<V> insert(K &&key, Value &&value) {
+            return insert_entry(std::move(key), std::forward<Value>(value));
+        }
+
+        template<typename... Args>
+        std::pair<iterator, bool> try_emplace(const K &key, Args &&... args) {
+            return try_emplace_entry(key, std::forward<Args>(args)...);
+        }
+
+        template<typename... Args>
+        std::pair<iterator, bool> try_emplace(K &&key, Args &&... args) {
+            return try_emplace_entry(std::move(key), std::forward<Args>(args)...);
+        }
+
+        template<typename... Args>
+        std::pair<iterator, bool> emplace(Args &&... args) {
+            std::pair<K, V> entry(std::forward<Args>(args)...);
+            return try_emplace_entry(std::move(entry.first), std::move(entry.second));
+        }
+
+        template<typename Value>
+        std::pair<iterator, bool> insert_or_assign(const K &key, Value &&value) {
+            return insert_or_assign_entry(key, std::forward<Value>(value));
+        }
+
+        template<typename Value>
+        std::pair<iterator, bool> insert_or_assign(K &&key, Value &&value) {
+            return insert_or_assign_entry(std::move(key), std::forward<Value>(value));
+        }
+
+        bool empty() {
+            return _size == 0;
+        }
+
+        bool member(const K &key) {
+            if (!root) return false;
+            auto leaf = descend(key);
+            auto position = leaf->search(key, comp);
+            return position < leaf->usage && !comp(key, leaf->keys[position]);
+        }
+
+        iterator find(const K &key) {
+            if (!root) return end();
+            auto leaf = descend(key);
+            auto position = leaf->search(key, comp);
+            if (position < leaf->usage && !comp(key, leaf->keys[position])) {
+                return {position, leaf};
+            }
+            return end();
+        }
+
+        iterator lower_bound(const K &key) {
+            if (!_size) return end();
+            auto leaf = descend(key);
+            return settle(leaf, leaf->search(key, comp));
+        }
+
+        iterator upper_bound(const K &key) {
+            if (!_size) return end();
+            auto leaf = descend(key);
+            auto position = leaf->search(key, comp);
+            if (position < leaf->usage && !comp(key, leaf->keys[position])) position++;
+            return settle(leaf, position);
+        }
+
+        std::pair<iterator, iterator> equal_range(const K &key) {
+            return {lower_bound(key), upper_bound(key)};
+        }
+
+        const K &min_key() {
+            return leftmost()->keys[0];
+        }
+
+        const K &max_key() {
+            auto leaf = rightmost();
+            return leaf->keys[leaf->usage - 1];
+        }
+
+        iterator begin() {
+            if (_size) return {0, leftmost()};
+            return end();
+        }
+
+        iterator end() {
+            return {0, nullptr};
+        }
+
+        void clear() {
+            if (!root) return;
+            if constexpr (std::is_trivially_destructible_v<K> && std::is_trivially_destructible_v<V> &&
+                          requires(NodeAlloc &a) { a.exclusive(); a.release(); }) {
+                if (alloc.exclusive()) {
+                    [[maybe_unused]] auto dropped = alloc.release();
+#ifdef DEBUG_MODE
+                    alive_node -= dropped;
+#endif
+                } else {
+                    release(root, height);
+                }
+            } else {
+                release(root, height);
+            }
+            root = nullptr;
+            height = 0;
+            _size = 0;
+        }
+
+        ~BPlusTree() {
+            clear();
+        }
+
+        std::pair<K, V> erase(iterator iter) {
+            _size--;
+            return iter.node->erase(iter.idx, *this);
+        }
+
+        size_t erase(const K &key) {
+            auto iter = find(key);
+            if (!(iter != end())) return 0;
+            erase(iter);
+            return 1;
+        }
+
+        std::pair<K, V> pop_min() {
+            return erase(begin());
+        }
+
+        std::pair<K, V> pop_max() {
+            auto leaf = rightmost();
+            return erase(iterator{uint16_t(leaf->usage - 1), leaf});
+        }
+
+        size_t size() {
+            return _size;
+        }
+    };
+}
+
+#undef keys
+#undef values
+#endif // BPLUSTREE_HPP
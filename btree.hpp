@@ -2,7 +2,24 @@
 #define BTREE_HPP
 
 #include <algorithm>
+#include <array>
+#include <atomic>
+#include <condition_variable>
 #include <cstring>
+#include <cstdint>
+#include <functional>
+#include <istream>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <optional>
+#include <ostream>
+#include <span>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
 
 #define keys node_keys()
 #define values node_values()
@@ -65,21 +82,414 @@ void backtrace() {
 #endif
 
 #ifdef DEBUG_MODE
-static size_t alive_node = 0;
+static std::atomic<size_t> alive_node = 0; // atomic: nodes may be created and freed on several threads
 #endif
 
 namespace btree {
 
-    template<typename K, typename V, bool UseBinary = true, size_t B = DEFAULT_BTREE_FACTOR, typename Compare = std::less<K>>
+    /* intra-node search policy, `false` and `true` still select linear and binary search */
+    enum SearchPolicy : unsigned {
+        LINEAR_SEARCH = 0,
+        BINARY_SEARCH = 1,
+        SIMD_SEARCH = 2, // vector compare over the whole node; other key types fall back to binary search
+    };
+
+    /* optional tree features, combined as flags in the last template parameter */
+    enum TreeOption : unsigned {
+        NO_OPTIONS = 0,
+        LEAF_LINKS = 1u << 0u, // leaves keep prev/next pointers, iterators prefetch the leaves ahead of them
+        ORDER_STATISTICS = 1u << 1u, // internal nodes count the entries below each child: nth, rank, advance
+    };
+
+    template<typename K, typename V, unsigned Search = BINARY_SEARCH, size_t B = DEFAULT_BTREE_FACTOR, typename Compare = std::less<K>,
+            typename Alloc = std::allocator<std::pair<const K, V>>, unsigned Options = NO_OPTIONS>
     class BTree;
 
+    /* default conflict resolution of the set operations: the value from the left operand wins */
+    struct KeepFirst {
+        template<typename K, typename L, typename R>
+        std::decay_t<L> operator()(const K &, L &&left, R &&) const {
+            return std::forward<L>(left);
+        }
+    };
+
+    /*
+     * Size-class slab pool behind `SlabAllocator`. Blocks are carved out of large cache-line aligned slabs,
+     * freed blocks are recycled through a free list per block size, and `release()` returns every slab at once.
+     */
+    class SlabPool {
+    public:
+        static constexpr size_t ALIGN = 64;
+        static constexpr size_t SLAB_BYTES = 1u << 16u;
+
+    private:
+        struct FreeBlock {
+            FreeBlock *next;
+        };
+
+        struct Slab {
+            Slab *next;
+            size_t bytes;
+        };
+
+        struct SizeClass {
+            size_t size;
+            FreeBlock *free;
+            char *cursor;
+            char *limit;
+        };
+
+        Slab *slabs = nullptr;
+        std::vector<SizeClass> classes;
+        size_t live = 0;
+
+        SizeClass &size_class(size_t size) {
+            for (auto &i : classes) {
+                if (i.size == size) return i;
+            }
+            return classes.emplace_back(SizeClass{size, nullptr, nullptr, nullptr});
+        }
+
+        void refill(SizeClass &sc) {
+            auto count = std::max<size_t>(SLAB_BYTES / sc.size, 16);
+            auto bytes = ALIGN + count * sc.size; // the first line holds the slab header
+            auto memory = static_cast<char *>(::operator new(bytes, std::align_val_t(ALIGN)));
+            slabs = new(memory) Slab{slabs, bytes};
+            sc.cursor = memory + ALIGN;
+            sc.limit = sc.cursor + count * sc.size;
+        }
+
+        static size_t round_up(size_t size) {
+            return (size + ALIGN - 1) / ALIGN * ALIGN;
+        }
+
+    public:
+        SlabPool() = default;
+
+        SlabPool(const SlabPool &) = delete;
+
+        SlabPool &operator=(const SlabPool &) = delete;
+
+        void *allocate(size_t size) {
+            auto &sc = size_class(round_up(size));
+            live++;
+            if (sc.free) {
+                auto block = sc.free;
+                sc.free = block->next;
+                return block;
+            }
+            if (sc.cursor == sc.limit) refill(sc);
+            auto block = sc.cursor;
+            sc.cursor += sc.size;
+            return block;
+        }
+
+        void deallocate(void *block, size_t size) noexcept {
+            auto &sc = size_class(round_up(size));
+            live--;
+            sc.free = new(block) FreeBlock{sc.free};
+        }
+
+        /* drops every slab without visiting the blocks in it; returns how many blocks were still in use */
+        size_t release() noexcept {
+            while (slabs) {
+                auto next = slabs->next;
+                ::operator delete(slabs, slabs->bytes, std::align_val_t(ALIGN));
+                slabs = next;
+            }
+            for (auto &i : classes) {
+                i.free = nullptr;
+                i.cursor = i.limit = nullptr;
+            }
+            auto dropped = live;
+            live = 0;
+            return dropped;
+        }
+
+        ~SlabPool() {
+            release();
+        }
+    };
+
+    /*
+     * Node allocator backed by a shared `SlabPool`. Rebound copies share the pool, copying a tree starts a fresh one.
+     * A tree whose keys and values are trivially destructible frees all of its nodes with a single `release()`
+     * when no one else holds the pool.
+     */
+    template<typename T>
+    class SlabAllocator {
+        std::shared_ptr<SlabPool> pool;
+
+        template<typename>
+        friend class SlabAllocator;
+
+    public:
+        using value_type = T;
+        using propagate_on_container_move_assignment = std::true_type;
+        using propagate_on_container_swap = std::true_type;
+        using is_always_equal = std::false_type;
+
+        SlabAllocator() : pool(std::make_shared<SlabPool>()) {}
+
+        SlabAllocator(const SlabAllocator &) = default; // no move: a moved-from tree must still own a valid pool
+
+        template<typename U>
+        SlabAllocator(const SlabAllocator<U> &that) noexcept : pool(that.pool) {}
+
+        T *allocate(size_t n) {
+            static_assert(alignof(T) <= SlabPool::ALIGN, "over-aligned type");
+            return static_cast<T *>(pool->allocate(n * sizeof(T)));
+        }
+
+        void deallocate(T *p, size_t n) noexcept {
+            pool->deallocate(p, n * sizeof(T));
+        }
+
+        SlabAllocator select_on_container_copy_construction() const {
+            return SlabAllocator();
+        }
+
+        bool exclusive() const noexcept {
+            return pool.use_count() == 1;
+        }
+
+        size_t release() noexcept {
+            return pool->release();
+        }
+
+        template<typename U>
+        bool operator==(const SlabAllocator<U> &that) const noexcept {
+            return pool == that.pool;
+        }
+    };
+
+    /*
+     * Background thread that frees whatever trees hand over to it, so that dropping a large tree does not stall
+     * the caller. Jobs run in order; the destructor finishes all of them before joining.
+     */
+    class Reclaimer {
+        std::mutex lock;
+        std::condition_variable wake;
+        std::condition_variable idle;
+        std::vector<std::function<void()>> jobs;
+        size_t pending = 0;
+        bool stopping = false;
+        std::thread worker; // last, so that everything above exists before it starts
+
+        void run() {
+            std::unique_lock guard(lock);
+            for (;;) {
+                wake.wait(guard, [this] { return stopping || !jobs.empty(); });
+                if (jobs.empty()) return;
+                auto batch = std::move(jobs);
+                jobs.clear();
+                guard.unlock();
+                for (auto &job : batch) job();
+                guard.lock();
+                pending -= batch.size();
+                idle.notify_all();
+            }
+        }
+
+    public:
+        Reclaimer() : worker([this] { run(); }) {}
+
+        Reclaimer(const Reclaimer &) = delete;
+
+        Reclaimer &operator=(const Reclaimer &) = delete;
+
+        void defer(std::function<void()> job) {
+            {
+                std::lock_guard guard(lock);
+                jobs.push_back(std::move(job));
+                pending++;
+            }
+            wake.notify_one();
+        }
+
+        /* blocks until everything handed over so far has been freed */
+        void drain() {
+            std::unique_lock guard(lock);
+            idle.wait(guard, [this] { return pending == 0; });
+        }
+
+        ~Reclaimer() {
+            {
+                std::lock_guard guard(lock);
+                stopping = true;
+            }
+            wake.notify_one();
+            worker.join();
+        }
+    };
+
     namespace __btree_impl {
 
-        template<typename K, typename V, bool UseBinary = true, size_t B = DEFAULT_BTREE_FACTOR, typename Compare = std::less<K>>
-        struct AbstractBTNode;
+        template<typename K, typename V, unsigned Search = BINARY_SEARCH, size_t B = DEFAULT_BTREE_FACTOR, typename Compare = std::less<K>,
+                unsigned Options = NO_OPTIONS>
+        struct NodeBase;
+
+        template<typename K, typename V, bool IsInternal, unsigned Search = BINARY_SEARCH, typename Compare = std::less<K>, size_t B = DEFAULT_BTREE_FACTOR,
+                unsigned Options = NO_OPTIONS>
+        struct BTreeNode;
+
+        template<typename K, typename Compare>
+        constexpr bool simd_searchable = std::is_arithmetic_v<K> && (sizeof(K) == 4 || sizeof(K) == 8) &&
+                                         (std::is_same_v<Compare, std::less<K>> || std::is_same_v<Compare, std::less<>>);
+
+        /* what lookups take besides K itself: anything, when `Compare` is transparent as `std::less<>` is */
+        template<typename Q, typename K, typename Compare>
+        concept lookup_key = std::is_same_v<Q, K> || requires { typename Compare::is_transparent; };
+
+#ifdef __AVX2__
+        constexpr size_t SIMD_BYTES = 32;
+#else
+        constexpr size_t SIMD_BYTES = 16;
+#endif
+
+        /* lanes per vector in `simd_lower_bound`; key arrays are padded to a multiple of this */
+        template<typename K>
+        constexpr size_t SIMD_LANES = SIMD_BYTES / sizeof(K);
+
+        /*
+         * Number of keys in [first, first + usage) that are less than `key`, i.e. the lower bound position.
+         * All `Slots` keys of the node are compared against the broadcast key with a fixed trip count and the
+         * lane masks are summed; lanes past `usage` are masked out. `Slots` must be a multiple of the lane count.
+         */
+        template<size_t Slots, typename K>
+        inline uint16_t simd_lower_bound(const K *first, uint16_t usage, const K &key) {
+            using Lane = std::conditional_t<sizeof(K) == 4, int32_t, int64_t>;
+            constexpr size_t LANES = SIMD_LANES<K>;
+            typedef K Vec __attribute__((vector_size(SIMD_BYTES)));
+            typedef Lane Mask __attribute__((vector_size(SIMD_BYTES)));
+            Vec probe = {};
+            Mask index = {}, limit = {}, count = {};
+            for (size_t i = 0; i < LANES; ++i) {
+                probe[i] = key;
+                index[i] = Lane(i);
+                limit[i] = Lane(usage);
+            }
+            static_assert(Slots % LANES == 0);
+            for (size_t base = 0; base < Slots; base += LANES) {
+                Vec chunk;
+                std::memcpy(&chunk, first + base, sizeof(Vec));
+                count += (chunk < probe) & (index < limit);
+                index += Lane(LANES);
+            }
+            Lane total = 0;
+            for (size_t i = 0; i < LANES; ++i) {
+                total -= count[i];
+            }
+            return uint16_t(total);
+        }
+
+        /* allocation unit of nodes: every node is a whole number of cache lines */
+        struct alignas(64) CacheLine {
+            unsigned char bytes[64];
+        };
+
+        /*
+         * Iterator for trees whose nodes do not point upwards, such as shared or mapped ones: it keeps the path
+         * from the root as a stack of (node, index) frames, so it holds no pointer into a node that could change.
+         * `Tree` befriends it and provides `root`, and `child(node, i)`. An internal frame's index is the key it
+         * is on when on top, and the child being walked otherwise. `--end()` gives the last entry.
+         */
+        template<typename Tree, typename Node, typename K, typename V, size_t MaxHeight>
+        class PathIterator {
+            struct Frame {
+                Node *node;
+                uint16_t idx;
+            };
+
+            const Tree *tree = nullptr;
+            std::array<Frame, MaxHeight> path;
+            size_t depth = 0; // 0 is `end()`
+
+            friend Tree;
+
+            explicit PathIterator(const Tree *tree) : tree(tree) {}
+
+            void push(Node *node, uint16_t idx) {
+                ASSERT(depth < MaxHeight);
+                path[depth++] = {node, idx};
+            }
+
+            /* pops finished frames until one has an entry at its index; this also skips empty last nodes */
+            void settle() {
+                while (depth && path[depth - 1].idx == path[depth - 1].node->usage) depth--;
+            }
+
+            /* pops frames at their first entry, then steps back one entry in the frame left on top */
+            void retreat() {
+                while (depth && path[depth - 1].idx == 0) depth--;
+                if (depth) path[depth - 1].idx--;
+            }
+
+            void descend_first(Node *node) {
+                for (; !node->leaf; node = tree->child(node, 0)) push(node, 0);
+                push(node, 0);
+                settle();
+            }
+
+            void descend_last(Node *node) {
+                for (; !node->leaf; node = tree->child(node, node->usage)) push(node, node->usage);
+                push(node, node->usage);
+                retreat();
+            }
+
+        public:
+            PathIterator() = default;
+
+            inline bool operator!=(const PathIterator &that) const noexcept {
+                if (depth != that.depth) return true;
+                return depth && (path[depth - 1].node != that.path[depth - 1].node ||
+                                 path[depth - 1].idx != that.path[depth - 1].idx);
+            }
+
+            inline bool operator==(const PathIterator &that) const noexcept {
+                return !(*this != that);
+            }
+
+            PathIterator &operator++() {
+                auto &top = path[depth - 1];
+                if (top.node->leaf) {
+                    top.idx++;
+                    settle();
+                } else {
+                    descend_first(tree->child(top.node, ++top.idx));
+                }
+                return *this;
+            }
+
+            PathIterator operator++(int) {
+                auto old = *this;
+                ++*this;
+                return old;
+            }
+
+            /* stepping back from the first entry gives `end()`, and from `end()` the last entry */
+            PathIterator &operator--() {
+                if (!depth) {
+                    if (tree && tree->root) descend_last(tree->root);
+                } else if (!path[depth - 1].node->leaf) {
+                    descend_last(tree->child(path[depth - 1].node, path[depth - 1].idx));
+                } else {
+                    retreat();
+                }
+                return *this;
+            }
 
-        template<typename K, typename V, bool IsInternal, bool UseBinary = true, typename Compare = std::less<K>, size_t B = DEFAULT_BTREE_FACTOR>
-        struct alignas(64) BTreeNode;
+            PathIterator operator--(int) {
+                auto old = *this;
+                --*this;
+                return old;
+            }
+
+            std::pair<const K &, const V &> operator*() const {
+                auto &top = path[depth - 1];
+                return {top.node->key_at(top.idx), top.node->value_at(top.idx)};
+            }
+        };
 
         template<typename T>
         inline void uninitialized_move_back(T *start, T *end) {
@@ -107,20 +517,118 @@ namespace btree {
             }
         }
 
-        template<typename K, typename V, bool UseBinary, size_t B, typename Compare>
-        struct AbstractBTNode {
+        /* runs `job(i)` for every i < n on up to `threads` threads, the caller being one of them */
+        template<typename Job>
+        void fan_out(size_t n, unsigned threads, Job &&job) {
+            std::atomic<size_t> next{0};
+            auto work = [&] {
+                for (size_t i; (i = next.fetch_add(1, std::memory_order_relaxed)) < n;) job(i);
+            };
+            std::vector<std::thread> workers;
+            for (size_t t = 1; t < std::min<size_t>(threads, n); ++t) {
+                workers.emplace_back(work);
+            }
+            work();
+            for (auto &i : workers) {
+                i.join();
+            }
+        }
+
+        /* first bytes of a `dump` stream */
+        static constexpr char DUMP_MAGIC[8] = {'B', 'T', 'D', 'U', 'M', 'P', '0', '1'};
 
-            Compare &comp;
+        /* `dump` hands a block to the stream once it holds this many bytes; no single entry may be longer */
+        static constexpr size_t DUMP_BLOCK = 1u << 16u;
 
-            struct SplitResult {
-                AbstractBTNode *l, *r;
-                K key;
-                V value;
-            };
+        /* longest block `dump` writes: one byte short of a full block, then one entry of at most DUMP_BLOCK bytes */
+        static constexpr size_t DUMP_BLOCK_LIMIT = DUMP_BLOCK - 1 + 4 + DUMP_BLOCK;
+
+        /* lengths in a `dump` stream are 32-bit little-endian whatever the host */
+        inline void put_u32(std::string &out, uint32_t x) {
+            for (size_t i = 0; i < 4; ++i) out.push_back(char(x >> (8 * i)));
+        }
+
+        inline uint32_t get_u32(const char *in) {
+            uint32_t x = 0;
+            for (size_t i = 0; i < 4; ++i) x |= uint32_t(uint8_t(in[i])) << (8 * i);
+            return x;
+        }
+
+        /* default `dump` serializer: the raw bytes of trivially copyable keys and values */
+        struct RawEncoder {
+            template<typename K, typename V>
+            void operator()(std::string &out, const K &key, const V &value) const {
+                static_assert(std::is_trivially_copyable_v<K> && std::is_trivially_copyable_v<V>,
+                              "pass a serializer for keys or values that are not trivially copyable");
+                out.append(reinterpret_cast<const char *>(&key), sizeof(K));
+                out.append(reinterpret_cast<const char *>(&value), sizeof(V));
+            }
+        };
+
+        /* default `load` deserializer, the inverse of `RawEncoder`; empty if the entry has the wrong size */
+        template<typename K, typename V>
+        struct RawDecoder {
+            std::optional<std::pair<K, V>> operator()(std::string_view entry) const {
+                if (entry.size() != sizeof(K) + sizeof(V)) return std::nullopt;
+                std::pair<K, V> result;
+                std::memcpy(&result.first, entry.data(), sizeof(K));
+                std::memcpy(&result.second, entry.data() + sizeof(K), sizeof(V));
+                return result;
+            }
+        };
+
+        /* prev/next pointers of a leaf in LEAF_LINKS mode, nothing otherwise */
+        template<typename Node, bool Linked>
+        struct LeafLinks {
+        };
+
+        template<typename Node>
+        struct LeafLinks<Node, true> {
+            Node *prev = nullptr;
+            Node *next = nullptr;
+        };
+
+        /* entries below each child of an internal node in ORDER_STATISTICS mode, nothing otherwise */
+        template<size_t N, bool Counted>
+        struct SubtreeCounts {
+        };
+
+        template<size_t N>
+        struct SubtreeCounts<N, true> {
+            size_t slots[N];
+
+            inline size_t &operator[](size_t i) {
+                return slots[i];
+            }
+        };
+
+        /*
+         * Common header and payload of both node kinds. Leaves and internal nodes share the same key/value
+         * layout, so everything that only touches keys and values lives here and needs no dispatch at all.
+         * The `leaf` tag is only consulted when walking without knowing the height (iterators, teardown);
+         * the descent loops in `BTree` count levels instead. Nodes hold no comparator: the tree passes its
+         * own to every operation that compares keys, so nodes never point back into the tree object.
+         */
+        template<typename K, typename V, unsigned Search, size_t B, typename Compare, unsigned Options>
+        struct alignas(64) NodeBase {
+            static_assert(2 * B < FOUND, "B is too large");
+            static_assert(B > 2, "B is too small");
+            using Internal = BTreeNode<K, V, true, Search, Compare, B, Options>;
+            using Leaf = BTreeNode<K, V, false, Search, Compare, B, Options>;
+            using KeyBlock = std::aligned_storage_t<sizeof(K), alignof(K)>;
+            using ValueBlock = std::aligned_storage_t<sizeof(V), alignof(V)>;
+            using LocFlag = uint;
+            static constexpr bool LINKED = Options & LEAF_LINKS;
+            static constexpr bool COUNTED = Options & ORDER_STATISTICS;
+            static constexpr size_t PREFETCH_DISTANCE = 8;
+            static constexpr bool USE_SIMD = Search == SIMD_SEARCH && simd_searchable<K, Compare>;
+            static constexpr size_t KEY_SLOTS = USE_SIMD ?
+                                                (2 * B - 1 + SIMD_LANES<K> - 1) / SIMD_LANES<K> * SIMD_LANES<K> :
+                                                2 * B - 1;
 
             struct iterator {
                 uint16_t idx;
-                AbstractBTNode *node;
+                NodeBase *node;
 
                 inline bool operator!=(const iterator &that) noexcept {
                     return idx != that.idx || node != that.node;
@@ -143,297 +651,549 @@ namespace btree {
                     return *this;
                 }
 
+                iterator &operator--() {
+                    auto res = node->predecessor(idx);
+                    this->node = res.node;
+                    this->idx = res.idx;
+                    return *this;
+                }
+
                 std::pair<const K &, V &> operator*() {
                     return {node->key_at(idx), node->value_at(idx)};
                 }
-            };
-
-            AbstractBTNode(Compare &comp) : comp(comp) {}
-
-            virtual bool member(const K &key) = 0;
-
-            virtual std::optional<V> insert(const K &key, const V &value, AbstractBTNode **root) = 0;
-
-            virtual void
-            adopt(AbstractBTNode *l, AbstractBTNode *r, K key, V value, size_t position, AbstractBTNode **root) = 0;
-
-            virtual void fix_underflow(AbstractBTNode **root) = 0;
-
-            virtual AbstractBTNode *&node_parent() = 0;
-
-            virtual uint16_t &node_idx() = 0;
-
-            virtual uint16_t &node_usage() = 0;
-
-            virtual iterator successor(uint16_t idx) = 0;
-
-            virtual iterator predecessor(uint16_t idx) = 0;
 
-            virtual iterator min() = 0;
-
-            virtual iterator max() = 0;
-
-            virtual K &key_at(size_t) = 0;
-
-            virtual V &value_at(size_t) = 0;
-
-            virtual K *node_keys() = 0;
-
-            virtual V *node_values() = 0;
-
-            virtual std::pair<K, V> erase(uint16_t index, AbstractBTNode **root) = 0;
-
-            virtual AbstractBTNode *&child_at(size_t) = 0;
+            };
 
-            virtual void traversal_copy(AbstractBTNode *now, Compare &new_comp) = 0;
+            Internal *parent = nullptr;
+            uint16_t usage = 0;
+            uint16_t parent_idx = 0;
+            bool leaf;
 
-            virtual AbstractBTNode *same_type(Compare &new_comp) = 0;
+            KeyBlock __keys[KEY_SLOTS];
+            ValueBlock __values[2 * B - 1];
 
-            virtual ~AbstractBTNode() = default;
+            explicit NodeBase(bool leaf) : leaf(leaf) {}
 
-#ifdef DEBUG_MODE
+            inline Internal *as_internal() {
+                ASSERT(!leaf);
+                return static_cast<Internal *>(this);
+            }
 
-            virtual void display(size_t indent) = 0;
+            inline Leaf *as_leaf() {
+                ASSERT(leaf);
+                return static_cast<Leaf *>(this);
+            }
 
-#endif
+            inline K *node_keys() {
+                return reinterpret_cast<K *>(__keys);
+            };
 
-            friend BTree<K, V, UseBinary, B, Compare>;
-        };
+            inline V *node_values() {
+                return reinterpret_cast<V *>(__values);
+            };
 
-        template<typename K, typename V, bool IsInternal, bool UseBinary, typename Compare, size_t B>
-        struct alignas(64) BTreeNode : AbstractBTNode<K, V, UseBinary, B, Compare> {
-            static_assert(2 * B < FOUND, "B is too large");
-            static_assert(B > 2, "B is too small");
-            using Node = AbstractBTNode<K, V, UseBinary, B, Compare>;
-            using NodePtr = Node *;
-            using SplitResult = typename Node::SplitResult;
-            using KeyBlock = std::aligned_storage_t<sizeof(K), alignof(K)>;
-            using ValueBlock = std::aligned_storage_t<sizeof(V), alignof(V)>;
+            inline K &key_at(size_t i) {
+                return keys[i];
+            }
 
-            KeyBlock __keys[2 * B - 1];
-            ValueBlock __values[2 * B - 1];
+            inline V &value_at(size_t i) {
+                return values[i];
+            }
 
-            NodePtr children[IsInternal ? (2 * B) : 0];
-            NodePtr parent = nullptr;
-            uint16_t usage = 0;
-            uint16_t parent_idx = 0;
+            /* number of entries in this subtree */
+            size_t subtree_size() {
+                if (leaf) return usage;
+                return as_internal()->subtree_size();
+            }
 
-            using LocFlag = uint;
+            /* adds `delta` to the counts on the way to the root after this node gained or lost entries */
+            void bump(ptrdiff_t delta) {
+                if constexpr (COUNTED) {
+                    for (auto node = this; node->parent; node = node->parent) {
+                        node->parent->counts[node->parent_idx] += delta;
+                    }
+                }
+            }
 
-            BTreeNode(Compare &comp) : Node(comp) {
-#ifdef DEBUG_MODE
-                alive_node++;
-#endif
-                std::memset(__keys, 0, sizeof(__keys));
-                std::memset(__values, 0, sizeof(__values));
+            /* recomputes the counts on the way to the root, for subtrees grafted or cut below this node */
+            void recount_path() {
+                if constexpr (COUNTED) {
+                    for (auto node = this; node->parent; node = node->parent) {
+                        node->parent->counts[node->parent_idx] = node->subtree_size();
+                    }
+                }
             }
 
-            inline NodePtr &node_parent() override {
-                return parent;
+            /* the `k`-th entry of the subtree rooted here */
+            static iterator select(NodeBase *node, size_t k) {
+                while (!node->leaf) {
+                    auto internal = node->as_internal();
+                    size_t i = 0;
+                    for (; k >= internal->counts[i]; ++i) {
+                        k -= internal->counts[i];
+                        if (k == 0) return {uint16_t(i), node};
+                        k--;
+                    }
+                    node = internal->children[i];
+                }
+                return {uint16_t(k), node};
             }
 
-            inline uint16_t &node_usage() override {
-                return usage;
+            /* position of entry `idx` of this node in the whole tree */
+            size_t index(uint16_t idx) {
+                size_t result = idx;
+                if (!leaf) {
+                    for (size_t i = 0; i <= idx; ++i) result += as_internal()->counts[i];
+                }
+                for (auto node = this; node->parent; node = node->parent) {
+                    result += node->parent_idx;
+                    for (size_t i = 0; i < node->parent_idx; ++i) result += node->parent->counts[i];
+                }
+                return result;
             }
 
-            inline uint16_t &node_idx() override {
-                return parent_idx;
+            inline LocFlag local_search(const K &key, Compare &comp) {
+                return local_search<K>(key, comp);
             }
 
-            inline LocFlag local_search(const K &key) {
+            /* a probe of another type is compared to the keys as it is; vectors are only used for K itself */
+            template<typename Q> requires lookup_key<Q, K, Compare>
+            inline LocFlag local_search(const Q &key, Compare &comp) {
                 ASSERT(usage < 2 * B);
-                if constexpr (UseBinary) {
-                    uint16_t position = std::lower_bound(keys, keys + usage, key, this->comp) - keys;
-                    if (position != usage && !Node::comp(key, keys[position])) {
+                if constexpr (USE_SIMD && std::is_same_v<Q, K>) {
+                    uint16_t position = simd_lower_bound<KEY_SLOTS>(keys, usage, key);
+                    if (position != usage && !comp(key, keys[position])) {
+                        return FOUND | position;
+                    }
+                    return GO_DOWN | position;
+                } else if constexpr (Search != LINEAR_SEARCH) {
+                    uint16_t position = std::lower_bound(keys, keys + usage, key, comp) - keys;
+                    if (position != usage && !comp(key, keys[position])) {
                         return FOUND | position;
                     }
                     return GO_DOWN | position;
                 } else {
                     uint i = 0;
-                    for (; i < usage && this->comp(keys[i], key); ++i);
+                    for (; i < usage && comp(keys[i], key); ++i);
                     if (i == usage) return GO_DOWN | usage;
-                    if (this->comp(key, keys[i])) {
+                    if (comp(key, keys[i])) {
                         return GO_DOWN | i;
                     }
                     return FOUND | i;
                 }
             }
 
-            bool member(const K &key) override {
-                ASSERT(usage < 2 * B);
-                auto flag = local_search(key);
-                if (flag & FOUND) {
-                    return true;
+            template<typename Value>
+            std::optional<V> replace(uint16_t idx, Value &&value) {
+                std::optional<V> original(std::move(values[idx]));
+                std::destroy_at(values + idx);
+                new(values + idx) V(std::forward<Value>(value));
+                return original;
+            }
+
+            iterator min() {
+                NodeBase *node = this;
+                while (!node->leaf) {
+                    node = node->as_internal()->children[0];
                 }
-                if constexpr (IsInternal) {
-                    return children[flag & GO_DOWN_MASK]->member(key);
-                } else return false;
+                return iterator{
+                        .idx = 0,
+                        .node = node
+                };
             }
 
-            typename Node::SplitResult split() {
-                ASSERT(usage == 2 * B - 1);
-                auto l = new BTreeNode(this->comp);
-                auto r = new BTreeNode(this->comp);
-                l->usage = r->usage = B - 1;
-                l->parent = r->parent = this->parent;
-                std::uninitialized_move(keys, keys + B - 1, l->keys);
-                std::uninitialized_move(keys + B, keys + usage, r->keys);
-                std::uninitialized_move(values, values + B - 1, l->values);
-                std::uninitialized_move(values + B, values + usage, r->values);
-                auto result = SplitResult{
-                        .l = l,
-                        .r = r,
-                        .key = std::move(keys[B - 1]),
-                        .value = std::move(values[B - 1]),
+            iterator max() {
+                NodeBase *node = this;
+                while (!node->leaf) {
+                    node = node->as_internal()->children[node->usage];
+                }
+                return iterator{
+                        .idx = uint16_t(node->usage - 1u),
+                        .node = node
                 };
-                std::destroy(keys, keys + usage);
-                std::destroy(values, values + usage);
-                this->usage = 0;
-                if constexpr (IsInternal) {
-                    std::memcpy(l->children, children, B * sizeof(NodePtr));
-                    std::memcpy(r->children, children + B, B * sizeof(NodePtr));
-                    for (size_t i = 0; i < B; ++i) {
-                        l->children[i]->node_parent() = l;
-                        l->children[i]->node_idx() = i;
-                        r->children[i]->node_parent() = r;
-                        r->children[i]->node_idx() = i;
+            }
+
+            /*
+             * Called when an iteration enters a leaf. With LEAF_LINKS, the leaf PREFETCH_DISTANCE siblings ahead
+             * is requested from the parent, whose child pointers are already in cache, so the fetches overlap
+             * instead of chasing one link after another; entering a parent requests the whole window, and past
+             * its last child the link to the next leaf is followed.
+             */
+            template<bool Forward>
+            [[gnu::always_inline]] inline void prefetch_leaves() {
+                if constexpr (LINKED) {
+                    if (!parent) return;
+                    size_t travelled = Forward ? parent_idx : parent->usage - parent_idx;
+                    size_t remaining = Forward ? parent->usage - parent_idx : parent_idx;
+                    for (auto d = travelled ? PREFETCH_DISTANCE : 1; d <= std::min(PREFETCH_DISTANCE, remaining); ++d) {
+                        prefetch_node(parent->children[Forward ? parent_idx + d : parent_idx - d]);
+                    }
+                    if (!remaining) {
+                        auto next = Forward ? as_leaf()->links.next : as_leaf()->links.prev;
+                        if (next) prefetch_node(next);
                     }
                 }
-                return result;
             }
 
-            inline K *node_keys() override {
-                return reinterpret_cast<K *>(__keys);
-            };
-
-            inline V *node_values() override {
-                return reinterpret_cast<V *>(__values);
-            };
+            /* requests `bytes` of `node`; pass `sizeof(Internal)` for internal nodes, whose children follow the values */
+            [[gnu::always_inline]] inline static void prefetch_node(NodeBase *node, size_t bytes = sizeof(Leaf)) {
+                for (size_t line = 0; line < bytes; line += 64) {
+                    __builtin_prefetch(reinterpret_cast<char *>(node) + line);
+                }
+            }
 
-            inline NodePtr same_type(Compare &new_comp) override {
-                return new BTreeNode(new_comp);
+            iterator predecessor(uint16_t idx) {
+                if (!leaf) {
+                    auto prev = as_internal()->children[idx]->max();
+                    prev.node->template prefetch_leaves<false>();
+                    return prev;
+                }
+                if (idx)
+                    return iterator{
+                            .idx = uint16_t(idx - 1u),
+                            .node = this
+                    };
+                NodeBase *node = this;
+                while (node->parent && node->parent_idx == 0) {
+                    node = node->parent;
+                }
+                if (node->parent) {
+                    return iterator{
+                            .idx = uint16_t(node->parent_idx - 1u),
+                            .node = node->parent
+                    };
+                }
+                return iterator{
+                        .idx = 0,
+                        .node = nullptr
+                };
+            }
+
+            iterator successor(uint16_t idx) {
+                if (!leaf) {
+                    auto next = as_internal()->children[idx + 1]->min();
+                    next.node->template prefetch_leaves<true>();
+                    return next;
+                }
+                if (idx < usage - 1)
+                    return iterator{
+                            .idx = uint16_t(idx + 1u),
+                            .node = this
+                    };
+                NodeBase *node = this;
+                while (node->parent && node->parent_idx == node->parent->usage) {
+                    node = node->parent;
+                }
+                if (node->parent) {
+                    return iterator{
+                            .idx = node->parent_idx,
+                            .node = node->parent
+                    };
+                }
+                return iterator{
+                        .idx = 0,
+                        .node = nullptr
+                };
+            }
+
+            template<typename Tree>
+            static NodeBase *traversal_copy(NodeBase *node, size_t height, Internal *parent, Tree &tree) {
+                if (height) {
+                    return node->as_internal()->traversal_copy(height, parent, tree);
+                }
+                return node->as_leaf()->traversal_copy(height, parent, tree);
+            }
+
+#ifdef DEBUG_MODE
+
+            void display(size_t ident) {
+                if (leaf) {
+                    as_leaf()->display(ident);
+                } else {
+                    as_internal()->display(ident);
+                }
+            }
+
+#endif
+        };
+
+        template<typename K, typename V, bool IsInternal, unsigned Search, typename Compare, size_t B, unsigned Options>
+        struct BTreeNode : NodeBase<K, V, Search, B, Compare, Options> {
+            using Node = NodeBase<K, V, Search, B, Compare, Options>;
+            using NodePtr = Node *;
+            using Internal = typename Node::Internal;
+            using iterator = typename Node::iterator;
+            using Node::parent;
+            using Node::usage;
+            using Node::parent_idx;
+            using Node::node_keys;
+            using Node::node_values;
+
+            struct SplitResult {
+                BTreeNode *r;
+                K key;
+                V value;
             };
 
-            inline void traversal_moveup(NodePtr now, Compare &new_comp) {
+            NodePtr children[IsInternal ? (2 * B) : 0];
+            [[no_unique_address]] LeafLinks<BTreeNode, !IsInternal && Node::LINKED> links;
+            [[no_unique_address]] SubtreeCounts<2 * B, IsInternal && Node::COUNTED> counts;
+
+            BTreeNode() : Node(!IsInternal) {
+#ifdef DEBUG_MODE
+                alive_node++;
+#endif
+            }
+
+            size_t subtree_size() {
+                size_t result = usage;
+                if constexpr (IsInternal) {
+                    static_assert(Node::COUNTED, "only counted nodes know their subtree size without a walk");
+                    for (size_t i = 0; i <= usage; ++i) result += counts[i];
+                }
+                return result;
+            }
+
+            /* refreshes the count of children[from, to] from the children themselves */
+            void recount(size_t from, size_t to) {
+                if constexpr (IsInternal && Node::COUNTED) {
+                    for (auto i = from; i <= to; ++i) counts[i] = children[i]->subtree_size();
+                }
+            }
+
+            /* puts this fresh leaf right after `left` in the leaf chain; a no-op without LEAF_LINKS */
+            void link_after(BTreeNode *left) {
+                if constexpr (!IsInternal && Node::LINKED) {
+                    links.prev = left;
+                    links.next = left->links.next;
+                    if (links.next) links.next->links.prev = this;
+                    left->links.next = this;
+                }
+            }
+
+            void unlink() {
+                if constexpr (!IsInternal && Node::LINKED) {
+                    if (links.prev) links.prev->links.next = links.next;
+                    if (links.next) links.next->links.prev = links.prev;
+                    links.prev = links.next = nullptr;
+                }
+            }
+
+            /* keeps the left half in place and moves the right half into a new sibling */
+            template<typename Tree>
+            SplitResult split(Tree &tree) {
+                ASSERT(usage == 2 * B - 1);
+                auto r = tree.template allocate_node<BTreeNode>();
+                r->usage = B - 1;
+                r->parent = parent;
+                r->link_after(this);
+                std::uninitialized_move(keys + B, keys + usage, r->keys);
+                std::uninitialized_move(values + B, values + usage, r->values);
+                auto result = SplitResult{
+                        .r = r,
+                        .key = std::move(keys[B - 1]),
+                        .value = std::move(values[B - 1]),
+                };
+                std::destroy(keys + B - 1, keys + usage);
+                std::destroy(values + B - 1, values + usage);
+                usage = B - 1;
+                if constexpr (IsInternal) {
+                    std::memcpy(r->children, children + B, B * sizeof(NodePtr));
+                    for (size_t i = 0; i < B; ++i) {
+                        r->children[i]->parent = r;
+                        r->children[i]->parent_idx = i;
+                    }
+                    if constexpr (Node::COUNTED) {
+                        std::memcpy(r->counts.slots, counts.slots + B, B * sizeof(size_t));
+                    }
+                }
+                return result;
+            }
+
+            template<typename Tree>
+            NodePtr traversal_copy(size_t height, Internal *new_parent, Tree &tree) {
+                auto now = tree.template allocate_node<BTreeNode>();
                 std::uninitialized_copy(keys, keys + usage, now->keys);
                 std::uninitialized_copy(values, values + usage, now->values);
-                now->node_usage() = usage;
-                now->node_idx() = parent_idx;
-                if (parent == nullptr) { return; }
-                auto new_parent = now->node_parent();
-                if (new_parent == nullptr) {
-                    ASSERT(parent_idx == 0);
-                    new_parent = new BTreeNode<K, V, true, UseBinary, Compare, B>(new_comp);
-                    new_parent->child_at(0) = now;
-                    now->node_parent() = new_parent;
-                }
-                new_parent->child_at(new_parent->node_usage()) = now;
-                new_parent->node_usage() += 1;
-                return parent->traversal_copy(new_parent, new_comp);
-            }
-
-            void traversal_copy(NodePtr now, Compare &new_comp) override {
-                ASSERT(dynamic_cast<BTreeNode *>(now)); // must of the same type
+                now->usage = usage;
+                now->parent_idx = parent_idx;
+                now->parent = new_parent;
                 if constexpr (IsInternal) {
-                    if (usage + 1 == now->node_usage()) {
-                        return traversal_moveup(now, new_comp);
+                    for (size_t i = 0; i <= usage; ++i) {
+                        now->children[i] = Node::traversal_copy(children[i], height - 1, now, tree);
                     }
-                    auto child = children[now->node_usage()]->same_type(new_comp);
-                    child->node_parent() = now;
-                    return children[now->node_usage()]->traversal_copy(child, new_comp);
-                } else {
-                    return traversal_moveup(now, new_comp);
+                    now->counts = counts;
                 }
-            };
+                return now;
+            }
 
-            static NodePtr singleton(NodePtr l, NodePtr r, K key, V value, Compare &_comp) {
-                auto node = new BTreeNode<K, V, true, UseBinary, Compare, B>(_comp);
+            template<typename Tree>
+            static Internal *singleton(NodePtr l, NodePtr r, K key, V value, Tree &tree) {
+                auto node = tree.template allocate_node<Internal>();
                 node->usage = 1;
                 new(node->__values) V(std::move(value));  // no need for destroy, directly move
                 new(node->__keys) K(std::move(key));
                 node->children[0] = l;
-                l->node_idx() = 0;
-                l->node_parent() = node;
+                l->parent_idx = 0;
+                l->parent = node;
                 node->children[1] = r;
-                r->node_idx() = 1;
-                r->node_parent() = node;
+                r->parent_idx = 1;
+                r->parent = node;
+                node->recount(0, 1);
                 return node;
             }
 
-            std::optional<V> insert(const K &key, const V &value, NodePtr *root) override {
-                auto res = local_search(key);
+            /* returns where the separator of `result` ends up */
+            template<typename Tree>
+            iterator promote(SplitResult &&result, Tree &tree) {
+                if (parent) {
+                    return parent->adopt(result.r, std::move(result.key), std::move(result.value), parent_idx, tree);
+                }
+                auto node = singleton(this, result.r, std::move(result.key), std::move(result.value), tree);
+                ASSERT(tree.root == this);
+                tree.root = node;
+                tree.height++;
+                return {0, node};
+            }
+
+            /* splits a node that just overflowed and follows the entry inserted at `position` */
+            template<typename Tree>
+            iterator overflow(size_t position, Tree &tree) {
+                auto result = split(tree);
+                auto r = result.r;
+                auto separator = promote(std::move(result), tree);
+                if (position < B - 1) return {uint16_t(position), this};
+                if (position >= B) return {uint16_t(position - B), r};
+                return separator;
+            }
+
+            /*
+             * Merges `batch[order[0, count)]`, sorted by key, into this leaf in one pass; `results` receives the
+             * replaced value of every batch entry. A leaf that overflows is cut into as many legal leaves as needed,
+             * which are handed to the parent one after another. Returns the number of new keys.
+             */
+            template<typename Tree>
+            size_t absorb(const std::pair<K, V> *batch, const size_t *order, size_t count, std::optional<V> *results,
+                          std::vector<std::pair<K, V>> &buffer, Tree &tree) {
+                static_assert(!IsInternal, "batches are merged at the leaves");
+                auto &comp = tree.comp;
+                size_t i = 0, j = 0, fresh = 0;
+                buffer.clear();
+                while (i < usage || j < count) {
+                    if (j < count && !buffer.empty() && !comp(buffer.back().first, batch[order[j]].first)) {
+                        results[order[j]] = std::exchange(buffer.back().second, batch[order[j]].second);
+                        j++;
+                    } else if (i < usage && (j == count || comp(keys[i], batch[order[j]].first))) {
+                        buffer.emplace_back(std::move(keys[i]), std::move(values[i]));
+                        i++;
+                    } else if (i < usage && !comp(batch[order[j]].first, keys[i])) {
+                        results[order[j]] = std::move(values[i]);
+                        buffer.emplace_back(std::move(keys[i]), batch[order[j]].second);
+                        i++, j++;
+                    } else {
+                        buffer.push_back(batch[order[j]]);
+                        fresh++, j++;
+                    }
+                }
+                std::destroy(keys, keys + usage);
+                std::destroy(values, values + usage);
+                usage = 0;
+
+                // fewest pieces of at most 2B - 2 entries, separated by one entry each
+                auto total = buffer.size();
+                auto pieces = (total + 1 + 2 * B - 2) / (2 * B - 1);
+                auto base = (total - (pieces - 1)) / pieces, extra = (total - (pieces - 1)) % pieces;
+                auto cursor = buffer.begin();
+                BTreeNode *last = this;
+                for (size_t k = 0; k < pieces; ++k) {
+                    auto piece = last;
+                    auto separator = cursor;
+                    if (k) {
+                        piece = tree.template allocate_node<BTreeNode>();
+                        piece->parent = last->parent;
+                        piece->link_after(last);
+                        ++cursor;
+                    }
+                    for (auto n = base + (k < extra); n; --n, ++cursor, ++piece->usage) {
+                        new(piece->values + piece->usage) V(std::move(cursor->second));
+                        new(piece->keys + piece->usage) K(std::move(cursor->first));
+                    }
+                    if (k) {
+                        // filled first, so that the parent counts the piece as it is
+                        last->promote(SplitResult{
+                                .r = piece,
+                                .key = std::move(separator->first),
+                                .value = std::move(separator->second)
+                        }, tree);
+                    }
+                    last = piece;
+                }
+                // every piece was counted by its parent when adopted; only the path above the last one is stale
+                last->recount_path();
+                return fresh;
+            }
+
+            /* constructs a new entry at `position` in place; returns where it is after any split */
+            template<typename Tree, typename Key, typename... Args>
+            iterator emplace_at(size_t position, Tree &tree, Key &&key, Args &&... args) {
+                static_assert(!IsInternal, "descent to the leaf is done by the tree");
+                uninitialized_move_back(values + position, values + usage);
+                uninitialized_move_back(keys + position, keys + usage);
+                new(values + position) V(std::forward<Args>(args)...);
+                new(keys + position) K(std::forward<Key>(key));
+                usage++;
+                this->bump(1);
+                if (usage == 2 * B - 1) /* leaf if full */ {
+                    return overflow(position, tree);
+                }
+                return {uint16_t(position), this};
+            }
+
+            template<typename Tree, typename Key, typename Value>
+            std::optional<V> insert(Key &&key, Value &&value, Tree &tree) {
+                static_assert(!IsInternal, "descent to the leaf is done by the tree");
+                auto res = this->local_search(key, tree.comp);
                 if (res & FOUND) {
-                    V original = std::move(values[res & FOUND_MASK]);
-                    std::destroy_at(values + (res & FOUND_MASK));
-                    new(values + (res & FOUND_MASK)) V(value);
-                    return {original};
+                    return this->replace(res & FOUND_MASK, std::forward<Value>(value));
                 }
-                auto position = res & GO_DOWN_MASK;
-                if constexpr (IsInternal) {
-                    return children[position]->insert(key, value, root);
-                } else {
-                    uninitialized_move_back(values + position, values + usage);
-                    uninitialized_move_back(keys + position, keys + usage);
-                    new(values + position) V(value);
-                    new(keys + position) K(key);
-                    usage++;
-                    if (usage == 2 * B - 1) /* leaf if full */ {
-                        auto result = split();
-                        if (parent)
-                            parent->adopt(result.l, result.r, std::move(result.key), std::move(result.value),
-                                          parent_idx, root);
-                        else {
-                            auto node = singleton(result.l, result.r, std::move(result.key), std::move(result.value),
-                                                  this->comp);
-                            delete *root;
-                            *root = node;
-                        }
-                    }
-                    return std::nullopt;
-                }
-            }
-
-            void adopt(NodePtr l, NodePtr r, K key, V value, size_t position, NodePtr *root) override {
+                emplace_at(res & GO_DOWN_MASK, tree, std::forward<Key>(key), std::forward<Value>(value));
+                return std::nullopt;
+            }
+
+            /* takes the new right sibling of children[position] together with their separator */
+            template<typename Tree>
+            iterator adopt(NodePtr r, K key, V value, size_t position, Tree &tree) {
+                static_assert(IsInternal, "only internal nodes adopt children");
                 uninitialized_move_back(values + position, values + usage);
                 uninitialized_move_back(keys + position, keys + usage);
-                if constexpr (IsInternal) {
-                    std::memmove(children + position + 1, children + position,
-                                 (usage + 1 - position) * sizeof(NodePtr));
-                    delete (children[position]);
-                    children[position] = l;
-                    l->node_parent() = this;
-                    children[position + 1] = r;
-                    r->node_parent() = this;
-                    for (int i = position; i < usage + 2; ++i) {
-                        children[i]->node_idx() = i;
-                    }
+                std::memmove(children + position + 2, children + position + 1,
+                             (usage - position) * sizeof(NodePtr));
+                children[position + 1] = r;
+                r->parent = this;
+                for (size_t i = position + 1; i < usage + 2u; ++i) {
+                    children[i]->parent_idx = i;
+                }
+                if constexpr (Node::COUNTED) {
+                    std::memmove(counts.slots + position + 2, counts.slots + position + 1,
+                                 (usage - position) * sizeof(size_t));
+                    recount(position, position + 1);
                 }
                 new(values + position) V(std::move(value));
                 new(keys + position) K(std::move(key));
                 usage++;
                 if (usage == 2 * B - 1) {
-                    auto result = split();
-                    if (parent) {
-                        parent->adopt(result.l, result.r, std::move(result.key), std::move(result.value), parent_idx,
-                                      root);
-                    } else {
-                        auto node = singleton(result.l, result.r, std::move(result.key), std::move(result.value),
-                                              this->comp);
-                        delete *root;
-                        *root = node;
-                    }
+                    return overflow(position, tree);
                 }
+                return {uint16_t(position), this};
             }
 
-
-            void borrow_left(NodePtr from) {
-                ASSERT(dynamic_cast<BTreeNode *>(from));
+            void borrow_left(BTreeNode *from) {
                 ASSERT(parent); // root will never borrow
-                ASSERT(parent == dynamic_cast<BTreeNode *>(from)->parent);
+                ASSERT(parent == from->parent);
                 ASSERT(parent_idx > 0);
-                ASSERT(parent_idx == from->node_idx() + 1);
-                ASSERT(from->node_usage() - 1 >= B - 1);
-                ASSERT(usage + 1 >= B - 1);
+                ASSERT(parent_idx == from->parent_idx + 1);
+                ASSERT(from->usage >= B);
+                ASSERT(usage + 1u < 2 * B - 1);
 
                 uninitialized_move_back(keys, keys + usage);
                 uninitialized_move_back(values, values + usage);
@@ -446,38 +1206,41 @@ namespace btree {
                 usage++;
 
                 /* update_parent */
-                auto from_usage = from->node_usage();
-                new(parent->values + parent_idx - 1) V(std::move(from->value_at(from_usage - 1)));
-                new(parent->keys + parent_idx - 1) K(std::move(from->key_at(from_usage - 1)));
+                auto from_usage = from->usage;
+                new(parent->values + parent_idx - 1) V(std::move(from->values[from_usage - 1]));
+                new(parent->keys + parent_idx - 1) K(std::move(from->keys[from_usage - 1]));
                 /* update from */
                 std::destroy_at(from->values + (from_usage - 1));
                 std::destroy_at(from->keys + (from_usage - 1));
-                from->node_usage() -= 1;
+                from->usage -= 1;
 
                 /* take the child */
                 if constexpr (IsInternal) {
                     std::memmove(children + 1, children, usage * sizeof(NodePtr));
-                    children[0] = from->child_at(from_usage);
-                    from->child_at(from_usage) = nullptr;
-                    children[0]->node_idx() = 0;
-                    children[0]->node_parent() = this;
+                    children[0] = from->children[from_usage];
+                    from->children[from_usage] = nullptr;
+                    children[0]->parent_idx = 0;
+                    children[0]->parent = this;
                     for (auto i = 1; i <= usage; ++i) {
-                        children[i]->node_idx() = i;
+                        children[i]->parent_idx = i;
+                    }
+                    if constexpr (Node::COUNTED) {
+                        std::memmove(counts.slots + 1, counts.slots, usage * sizeof(size_t));
+                        counts[0] = from->counts[from_usage];
                     }
                 }
+                parent->recount(parent_idx - 1, parent_idx);
             }
 
-            void borrow_right(NodePtr from) {
-                ASSERT(dynamic_cast<BTreeNode *>(from));
+            void borrow_right(BTreeNode *from_node) {
                 ASSERT(parent); // root will never borrow
-                ASSERT(parent == dynamic_cast<BTreeNode *>(from)->parent);
+                ASSERT(parent == from_node->parent);
                 ASSERT(parent_idx == 0); // only the first element call this
-                ASSERT(parent_idx < parent->node_usage());
-                ASSERT(parent_idx == from->node_idx() - 1);
-                ASSERT(from->node_usage() - 1 >= B - 1);
-                ASSERT(usage + 1 >= B - 1);
+                ASSERT(parent_idx < parent->usage);
+                ASSERT(parent_idx + 1 == from_node->parent_idx);
+                ASSERT(from_node->usage >= B);
+                ASSERT(usage + 1u < 2 * B - 1);
 
-                auto from_node = static_cast<BTreeNode *>(from);
                 /* update this node */
                 new(values + usage) V(std::move(parent->value_at(parent_idx)));
                 new(keys + usage) K(
@@ -486,8 +1249,11 @@ namespace btree {
                 std::destroy_at(parent->keys + parent_idx);
                 if constexpr (IsInternal) {
                     children[usage + 1] = from_node->children[0];
-                    children[usage + 1]->node_parent() = this;
-                    children[usage + 1]->node_idx() = usage + 1;
+                    children[usage + 1]->parent = this;
+                    children[usage + 1]->parent_idx = usage + 1;
+                    if constexpr (Node::COUNTED) {
+                        counts[usage + 1] = from_node->counts[0];
+                    }
                 }
                 usage++;
 
@@ -506,22 +1272,24 @@ namespace btree {
                     std::memmove(from_node->children, from_node->children + 1, from_node->usage * sizeof(NodePtr));
                     from_node->children[from_node->usage] = nullptr;
                     for (auto i = 0; i < from_node->usage; ++i) {
-                        from_node->children[i]->node_idx() = i;
+                        from_node->children[i]->parent_idx = i;
+                    }
+                    if constexpr (Node::COUNTED) {
+                        std::memmove(from_node->counts.slots, from_node->counts.slots + 1,
+                                     from_node->usage * sizeof(size_t));
                     }
                 }
                 from_node->usage -= 1;
+                parent->recount(parent_idx, parent_idx + 1);
             }
 
-            static void merge(NodePtr a, NodePtr b, NodePtr *root) {
-                auto left = static_cast<BTreeNode *>(a);
-                auto right = static_cast<BTreeNode *>(b);
-                auto parent = static_cast<BTreeNode<K, V, true, UseBinary, Compare> *>(left->parent);
-                ASSERT(dynamic_cast<BTreeNode *>(a));
-                ASSERT(dynamic_cast<BTreeNode *>(b));
-                ASSERT((dynamic_cast <BTreeNode<K, V, true, UseBinary, Compare> *> (left->parent))); // root will never borrow
+            template<typename Tree>
+            static void merge(BTreeNode *left, BTreeNode *right, Tree &tree) {
+                auto parent = left->parent;
+                ASSERT(parent); // root will never borrow
                 ASSERT(left->parent == right->parent);
-                ASSERT(left->parent_idx == right->node_idx() - 1);
-                ASSERT(left->usage + right->usage + 1 < 2 * B - 1);
+                ASSERT(left->parent_idx + 1 == right->parent_idx);
+                ASSERT(left->usage + right->usage + 1u < 2 * B - 1);
 
                 new(left->values + left->usage) V(std::move(parent->values[left->parent_idx]));
                 new(left->keys + left->usage) K(std::move(parent->keys[left->parent_idx]));
@@ -531,6 +1299,10 @@ namespace btree {
                 uninitialized_move_forward(parent->keys + right->parent_idx, parent->keys + parent->usage);
                 std::memmove(parent->children + right->parent_idx, parent->children + right->parent_idx + 1,
                              (parent->usage - right->parent_idx) * sizeof(NodePtr));
+                if constexpr (Node::COUNTED) {
+                    std::memmove(parent->counts.slots + right->parent_idx, parent->counts.slots + right->parent_idx + 1,
+                                 (parent->usage - right->parent_idx) * sizeof(size_t));
+                }
                 parent->children[parent->usage--] = nullptr;
 
 
@@ -543,53 +1315,168 @@ namespace btree {
                 if constexpr (IsInternal) {
                     std::memcpy(left->children + left->usage, right->children, (right->usage + 1) * sizeof(NodePtr));
                     for (auto i = left->usage; i <= left->usage + right->usage; ++i) {
-                        left->children[i]->node_idx() = i;
-                        left->children[i]->node_parent() = left;
+                        left->children[i]->parent_idx = i;
+                        left->children[i]->parent = left;
+                    }
+                    if constexpr (Node::COUNTED) {
+                        std::memcpy(left->counts.slots + left->usage, right->counts.slots,
+                                    (right->usage + 1) * sizeof(size_t));
                     }
                 }
 
                 left->usage += right->usage;
                 right->usage = 0;
-                delete right;
+                tree.free_node(right);
+                parent->recount(left->parent_idx, left->parent_idx);
 
                 for (auto i = left->parent_idx; i <= parent->usage; ++i) {
-                    parent->children[i]->node_idx() = i;
+                    parent->children[i]->parent_idx = i;
                 }
 
                 if (parent->usage == 0) /* only possible at root or B == 2 */ {
-                    ASSERT(parent == *root);
+                    ASSERT(parent == tree.root);
                     parent->usage = 0;
-                    delete (parent);
+                    tree.free_node(parent);
                     left->parent = nullptr;
-                    *root = left;
+                    tree.root = left;
+                    tree.height--;
                     return;
                 }
 
-                parent->fix_underflow(root);
+                parent->fix_underflow(tree);
             }
 
-            void fix_underflow(NodePtr *root) override {
+            template<typename Tree>
+            void fix_underflow(Tree &tree) {
                 if (usage >= B - 1 || !parent) return;
                 if (parent_idx) {
-                    auto target = parent->child_at(parent_idx - 1);
-                    if (target->node_usage() > B - 1) {
+                    auto target = static_cast<BTreeNode *>(parent->children[parent_idx - 1]);
+                    if (target->usage > B - 1) {
                         borrow_left(target);
                     } else {
-                        merge(target, this, root);
+                        merge(target, this, tree);
                     }
                 } else {
-                    auto target = parent->child_at(parent_idx + 1);
-                    if (target->node_usage() > B - 1) {
+                    auto target = static_cast<BTreeNode *>(parent->children[parent_idx + 1]);
+                    if (target->usage > B - 1) {
                         borrow_right(target);
                     } else {
-                        merge(this, target, root);
+                        merge(this, target, tree);
+                    }
+                }
+            }
+
+            /* like fix_underflow, but the node may miss any number of entries; it must have a left sibling */
+            template<typename Tree>
+            void refill_from_left(Tree &tree) {
+                ASSERT(parent && parent_idx);
+                auto target = static_cast<BTreeNode *>(parent->children[parent_idx - 1]);
+                while (usage < B - 1 && target->usage > B - 1) {
+                    borrow_left(target);
+                }
+                if (usage < B - 1) {
+                    merge(target, this, tree);
+                }
+            }
+
+            /* mirror of refill_from_left for the first child */
+            template<typename Tree>
+            void refill_from_right(Tree &tree) {
+                ASSERT(parent && parent_idx == 0);
+                auto target = static_cast<BTreeNode *>(parent->children[1]);
+                while (usage < B - 1 && target->usage > B - 1) {
+                    borrow_right(target);
+                }
+                if (usage < B - 1) {
+                    merge(this, target, tree);
+                }
+            }
+
+            /* tops up a non-root node from whichever sibling it has */
+            template<typename Tree>
+            void refill(Tree &tree) {
+                if (usage >= B - 1 || !parent) return;
+                if (parent_idx) {
+                    refill_from_left(tree);
+                } else {
+                    refill_from_right(tree);
+                }
+            }
+
+            /* takes `l` as the new first child, separated from the old one by the given entry */
+            template<typename Tree>
+            void adopt_first(NodePtr l, K key, V value, Tree &tree) {
+                static_assert(IsInternal, "only internal nodes adopt children");
+                uninitialized_move_back(values, values + usage);
+                uninitialized_move_back(keys, keys + usage);
+                std::memmove(children + 1, children, (usage + 1) * sizeof(NodePtr));
+                children[0] = l;
+                l->parent = this;
+                for (size_t i = 0; i < usage + 2u; ++i) {
+                    children[i]->parent_idx = i;
+                }
+                if constexpr (Node::COUNTED) {
+                    std::memmove(counts.slots + 1, counts.slots, (usage + 1) * sizeof(size_t));
+                    recount(0, 0);
+                }
+                new(values) V(std::move(value));
+                new(keys) K(std::move(key));
+                usage++;
+                if (usage == 2 * B - 1) {
+                    promote(split(tree), tree);
+                }
+            }
+
+            /* removes the entries in [from, to) and refills the leaf */
+            template<typename Tree>
+            size_t erase_slice(size_t from, size_t to, Tree &tree) {
+                static_assert(!IsInternal, "slices are cut from the leaves");
+                if (from == to) return 0;
+                std::destroy(keys + from, keys + to);
+                std::destroy(values + from, values + to);
+                for (auto i = to; i < usage; ++i) {
+                    new(values + from + (i - to)) V(std::move(values[i]));
+                    new(keys + from + (i - to)) K(std::move(keys[i]));
+                    std::destroy_at(values + i);
+                    std::destroy_at(keys + i);
+                }
+                usage -= to - from;
+                this->bump(-ptrdiff_t(to - from));
+                refill(tree);
+                return to - from;
+            }
+
+            /* drops every key of the sorted `batch[0, count)` present in this leaf in one pass */
+            template<typename Tree>
+            size_t remove_run(const K *batch, size_t count, Tree &tree) {
+                static_assert(!IsInternal, "runs are removed at the leaves");
+                auto &comp = tree.comp;
+                size_t kept = 0, j = 0;
+                for (size_t i = 0; i < usage; ++i) {
+                    while (j < count && comp(batch[j], keys[i])) j++;
+                    if (j < count && !comp(keys[i], batch[j])) {
+                        std::destroy_at(keys + i);
+                        std::destroy_at(values + i);
+                        continue;
                     }
+                    if (kept != i) {
+                        new(values + kept) V(std::move(values[i]));
+                        new(keys + kept) K(std::move(keys[i]));
+                        std::destroy_at(values + i);
+                        std::destroy_at(keys + i);
+                    }
+                    kept++;
                 }
+                auto removed = usage - kept;
+                usage = kept;
+                this->bump(-ptrdiff_t(removed));
+                refill(tree);
+                return removed;
             }
 
 #ifdef DEBUG_MODE
 
-            void display(size_t ident) override {
+            void display(size_t ident) {
                 std::string idents(ident ? ident - 1 : 0, '-');
                 if (ident) idents.push_back('>');
                 if (ident) idents.push_back(' ');
@@ -612,122 +1499,22 @@ namespace btree {
 
 #endif
 
-            typename Node::iterator min() override {
-                if constexpr(IsInternal) {
-                    return children[0]->min();
-                } else {
-                    return typename Node::iterator{
-                            .idx = 0,
-                            .node = this
-                    };
-                }
-            }
-
-            typename Node::iterator max() override {
-                if constexpr(IsInternal) {
-                    return children[usage]->max();
-                } else {
-                    return typename Node::iterator{
-                            .idx = uint16_t(usage - 1u),
-                            .node = this
-                    };
-                }
-            }
-
-            NodePtr &child_at(size_t i) override {
-                if constexpr (IsInternal) {
-                    return children[i];
-                } else {
-                    std::abort();
-                }
-            }
-
-            inline K &key_at(size_t i) override {
-                return keys[i];
-            }
-
-            inline V &value_at(size_t i) override {
-                return values[i];
-            }
-
-            typename Node::iterator predecessor(uint16_t idx) override {
-                if constexpr (IsInternal) {
-                    return children[idx]->max();
-                } else {
-                    if (idx)
-                        return typename Node::iterator{
-                                .idx = uint16_t(idx - 1u),
-                                .node = this
-                        };
-                    else {
-                        NodePtr node = this;
-                        while (node->node_parent() && node->node_idx() == 0) {
-                            node = node->node_parent();
-                        }
-                        if (node->node_parent()) {
-                            return typename Node::iterator{
-                                    .idx = uint16_t(node->node_idx() - 1u),
-                                    .node = node->node_parent()
-                            };
-                        } else {
-                            return typename Node::iterator{
-                                    .idx = 0,
-                                    .node = nullptr
-                            };
-                        }
-                    }
-                }
-            }
-
-            typename Node::iterator successor(uint16_t idx) override {
-                if constexpr (IsInternal) {
-                    return children[idx + 1]->min();
-                } else {
-                    if (idx < usage - 1)
-                        return typename Node::iterator{
-                                .idx = uint16_t(idx + 1u),
-                                .node = this
-                        };
-                    else {
-                        NodePtr node = this;
-                        while (node->node_parent() && node->node_idx() == node->node_parent()->node_usage()) {
-                            node = node->node_parent();
-                        }
-                        if (node->node_parent()) {
-                            return typename Node::iterator{
-                                    .idx = node->node_idx(),
-                                    .node = node->node_parent()
-                            };
-                        } else {
-                            return typename Node::iterator{
-                                    .idx = 0,
-                                    .node = nullptr
-                            };
-                        }
-                    }
-                }
-            }
-
-            ~BTreeNode() override {
+            ~BTreeNode() {
 #ifdef DEBUG_MODE
                 alive_node--;
 #endif
+                unlink();
                 std::destroy(keys, keys + usage);
                 std::destroy(values, values + usage);
-                if constexpr(IsInternal) {
-                    if (usage)
-                        for (auto i = 0; i <= usage; ++i) {
-                            delete children[i];
-                        }
-                }
             }
 
-            std::pair<K, V> erase(uint16_t index, NodePtr *root) override {
+            template<typename Tree>
+            std::pair<K, V> erase(uint16_t index, Tree &tree) {
                 if constexpr (IsInternal) {
                     auto pred = children[index]->max();
                     std::swap(keys[index], pred.node->key_at(pred.idx));
                     std::swap(values[index], pred.node->value_at(pred.idx));
-                    return pred.node->erase(pred.idx, root);
+                    return pred.node->as_leaf()->erase(pred.idx, tree);
                 } else {
                     std::pair<K, V> result(std::move(keys[index]), std::move(values[index]));
                     std::destroy_at(keys + index);
@@ -735,7 +1522,8 @@ namespace btree {
                     uninitialized_move_forward(keys + index + 1, keys + usage);
                     uninitialized_move_forward(values + index + 1, values + usage);
                     usage--;
-                    fix_underflow(root);
+                    this->bump(-1);
+                    fix_underflow(tree);
                     return result;
                 }
             }
@@ -743,33 +1531,788 @@ namespace btree {
 
     }
 
-    template<typename K, typename V, bool UseBinary, size_t B, typename Compare>
+    template<typename K, typename V, unsigned Search, size_t B, typename Compare, typename Alloc, unsigned Options>
     class BTree {
 
-        using Node = __btree_impl::AbstractBTNode<K, V, UseBinary, B, Compare>;
+        using Node = __btree_impl::NodeBase<K, V, Search, B, Compare, Options>;
+        using Leaf = typename Node::Leaf;
+        using Internal = typename Node::Internal;
+        using CacheLine = __btree_impl::CacheLine;
+        using NodeAlloc = typename std::allocator_traits<Alloc>::template rebind_alloc<CacheLine>;
+        using NodeAllocTraits = std::allocator_traits<NodeAlloc>;
         size_t _size = 0;
+        size_t height = 0; // number of internal levels above the leaves
         Node *root = nullptr;
 
-        Compare comp;
+        [[no_unique_address]] NodeAlloc alloc;
+        [[no_unique_address]] Compare comp;
+
+        template<typename T>
+        T *allocate_node() {
+            static_assert(sizeof(T) % sizeof(CacheLine) == 0);
+            auto memory = NodeAllocTraits::allocate(alloc, sizeof(T) / sizeof(CacheLine));
+            return new(memory) T();
+        }
+
+        template<typename T>
+        void free_node(T *node) {
+            std::destroy_at(node);
+            NodeAllocTraits::deallocate(alloc, reinterpret_cast<CacheLine *>(node), sizeof(T) / sizeof(CacheLine));
+        }
+
+        void free_node(Node *node) {
+            if (node->leaf) {
+                free_node(node->as_leaf());
+            } else {
+                free_node(node->as_internal());
+            }
+        }
+
+        /* frees a subtree and returns the number of entries it held */
+        size_t release(Node *node, size_t h) {
+            size_t count = node->usage;
+            if (h) {
+                auto internal = node->as_internal();
+                for (size_t i = 0; i <= internal->usage; ++i) {
+                    count += release(internal->children[i], h - 1);
+                }
+                free_node(internal);
+            } else {
+                free_node(node->as_leaf());
+            }
+            return count;
+        }
+
+        /* fills in the counts of a whole subtree and returns its size */
+        size_t recount(Node *node, size_t h) {
+            if (!h) return node->usage;
+            auto internal = node->as_internal();
+            size_t total = internal->usage;
+            for (size_t i = 0; i <= internal->usage; ++i) {
+                internal->counts[i] = recount(internal->children[i], h - 1);
+                total += internal->counts[i];
+            }
+            return total;
+        }
+
+        /* threads the leaves of a copied tree in key order */
+        void link_leaves(Node *node, size_t h, Leaf *&last) {
+            if (!h) {
+                auto leaf = node->as_leaf();
+                if (last) leaf->link_after(last);
+                last = leaf;
+                return;
+            }
+            for (size_t i = 0; i <= node->usage; ++i) {
+                link_leaves(node->as_internal()->children[i], h - 1, last);
+            }
+        }
+
+        /*
+         * Parallel copy and teardown only kick in for trees at least this large, and only with stateless
+         * allocators, which are the ones that can be shared between threads; everything else stays sequential.
+         */
+        static constexpr size_t PARALLEL_THRESHOLD = 1u << 16u;
+
+        bool parallel(unsigned threads) {
+            return NodeAllocTraits::is_always_equal::value && threads > 1 && _size >= PARALLEL_THRESHOLD;
+        }
+
+        /* levels to keep on the calling thread so that the subtrees below give every thread several of them */
+        size_t split_depth(unsigned threads) {
+            size_t depth = 0;
+            for (size_t width = 1; depth < height && width < 8 * size_t(threads); ++depth) width *= B;
+            return depth;
+        }
+
+        /* copies the `depth` levels at the top of `node` into this tree and lists the subtrees below them */
+        Node *copy_top(Node *node, size_t depth, Internal *parent, std::vector<std::pair<Node *, Internal *>> &below) {
+            auto from = node->as_internal();
+            auto now = allocate_node<Internal>();
+            std::uninitialized_copy(from->keys, from->keys + from->usage, now->keys);
+            std::uninitialized_copy(from->values, from->values + from->usage, now->values);
+            now->usage = from->usage;
+            now->parent_idx = from->parent_idx;
+            now->parent = parent;
+            now->counts = from->counts;
+            for (size_t i = 0; i <= from->usage; ++i) {
+                if (depth == 1) {
+                    below.emplace_back(from->children[i], now);
+                } else {
+                    now->children[i] = copy_top(from->children[i], depth - 1, now, below);
+                }
+            }
+            return now;
+        }
+
+        /* frees the `depth` levels at the top of `node` and lists the subtrees below them */
+        void cut_top(Node *node, size_t depth, std::vector<Node *> &below) {
+            if (!depth) {
+                below.push_back(node);
+                return;
+            }
+            auto internal = node->as_internal();
+            for (size_t i = 0; i <= internal->usage; ++i) {
+                cut_top(internal->children[i], depth - 1, below);
+            }
+            free_node(internal);
+        }
+
+        Leaf *leftmost(Node *node, size_t h) {
+            for (; h; --h) node = node->as_internal()->children[0];
+            return node->as_leaf();
+        }
+
+        /* a detached subtree of the given height, used while splitting and joining; empty if `node` is null */
+        struct Piece {
+            Node *node;
+            size_t height;
+        };
+
+        /* entries of a piece if there are at most `limit`, otherwise some number above it, after O(limit / B) nodes */
+        size_t count_upto(Piece piece, size_t limit) {
+            if (!piece.node) return 0;
+            size_t total = piece.node->usage;
+            for (size_t i = 0; piece.height && i <= piece.node->usage && total <= limit; ++i) {
+                total += count_upto({piece.node->as_internal()->children[i], piece.height - 1}, limit - total);
+            }
+            return total;
+        }
+
+        /* replaces a root without keys by its only child, or by the empty piece for a leaf */
+        Piece normalize(Piece piece) {
+            while (piece.node && piece.node->usage == 0) {
+                auto old = piece.node;
+                if (piece.height) {
+                    piece.node = old->as_internal()->children[0];
+                    piece.node->parent = nullptr;
+                    piece.node->parent_idx = 0;
+                    piece.height--;
+                } else {
+                    piece.node = nullptr;
+                }
+                free_node(old);
+            }
+            return piece;
+        }
+
+        void refill(Node *node, size_t h) {
+            if (h) {
+                node->as_internal()->refill(*this);
+            } else {
+                node->as_leaf()->refill(*this);
+            }
+        }
+
+        /*
+         * Joins two pieces whose keys are separated by the given entry. The shorter piece is grafted onto the
+         * facing spine of the taller one at its own height, and only the grafted root may need a refill; the node
+         * primitives run with `root` and `height` naming the piece being extended.
+         */
+        Piece join(Piece l, K key, V value, Piece r) {
+            if (!l.node && !r.node) {
+                auto leaf = allocate_node<Leaf>();
+                leaf->usage = 1;
+                new(leaf->__values) V(std::move(value));
+                new(leaf->__keys) K(std::move(key));
+                return {leaf, 0};
+            }
+            if (!l.node || !r.node) {
+                root = l.node ? l.node : r.node;
+                height = l.node ? l.height : r.height;
+                auto leaf = (l.node ? root->max() : root->min()).node->as_leaf();
+                leaf->insert(std::move(key), std::move(value), *this);
+            } else if (l.height == r.height) {
+                root = Leaf::singleton(l.node, r.node, std::move(key), std::move(value), *this);
+                height = l.height + 1;
+                refill(r.node, r.height);
+                if (l.node->parent) {
+                    refill(l.node, l.height);
+                }
+            } else if (l.height > r.height) {
+                root = l.node;
+                height = l.height;
+                auto node = l.node;
+                for (auto h = l.height; h > r.height + 1; --h) {
+                    node = node->as_internal()->children[node->usage];
+                }
+                node->as_internal()->adopt(r.node, std::move(key), std::move(value), node->usage, *this);
+                r.node->recount_path();
+                refill(r.node, r.height);
+            } else {
+                root = r.node;
+                height = r.height;
+                auto node = r.node;
+                for (auto h = r.height; h > l.height + 1; --h) {
+                    node = node->as_internal()->children[0];
+                }
+                node->as_internal()->adopt_first(l.node, std::move(key), std::move(value), *this);
+                l.node->recount_path();
+                refill(l.node, l.height);
+            }
+            return {root, height};
+        }
+
+        /* joins two pieces without a separator by lending the right piece's minimum */
+        Piece concat(Piece l, Piece r) {
+            if (!l.node) return r;
+            if (!r.node) return l;
+            root = r.node;
+            height = r.height;
+            auto first = root->min();
+            auto entry = first.node->as_leaf()->erase(first.idx, *this);
+            return join(l, std::move(entry.first), std::move(entry.second), normalize({root, height}));
+        }
+
+        /*
+         * Splits a piece into the entries less than `key` and the rest. Every node on the search path is cut in
+         * two around the child holding `key`, and the halves are joined back bottom-up with the split child;
+         * the joins telescope, so the whole split costs O(height).
+         */
+        std::pair<Piece, Piece> split_at(Piece piece, const K &key) {
+            if (!piece.node) return {piece, piece};
+            auto node = piece.node;
+            node->parent = nullptr;
+            node->parent_idx = 0;
+            auto res = node->local_search(key, comp);
+            size_t position = res & FOUND ? res & FOUND_MASK : res & GO_DOWN_MASK;
+            size_t usage = node->usage;
+            if (!piece.height) {
+                Piece right{nullptr, 0};
+                if (position < usage) {
+                    auto leaf = node->as_leaf();
+                    auto fresh = allocate_node<Leaf>();
+                    fresh->link_after(leaf);
+                    std::uninitialized_move(leaf->keys + position, leaf->keys + usage, fresh->keys);
+                    std::uninitialized_move(leaf->values + position, leaf->values + usage, fresh->values);
+                    std::destroy(leaf->keys + position, leaf->keys + usage);
+                    std::destroy(leaf->values + position, leaf->values + usage);
+                    fresh->usage = usage - position;
+                    leaf->usage = position;
+                    right = {fresh, 0};
+                }
+                return {normalize(piece), right};
+            }
+            auto internal = node->as_internal();
+            Piece child{internal->children[position], piece.height - 1};
+            std::pair<Piece, Piece> halves{child, Piece{nullptr, 0}};
+            if (res & FOUND) {
+                child.node->parent = nullptr;
+                child.node->parent_idx = 0;
+            } else {
+                halves = split_at(child, key);
+            }
+            auto right = halves.second;
+            if (position < usage) {
+                auto fresh = allocate_node<Internal>();
+                fresh->usage = usage - position - 1;
+                std::uninitialized_move(internal->keys + position + 1, internal->keys + usage, fresh->keys);
+                std::uninitialized_move(internal->values + position + 1, internal->values + usage, fresh->values);
+                std::memcpy(fresh->children, internal->children + position + 1,
+                            (usage - position) * sizeof(Node *));
+                for (size_t i = 0; i <= fresh->usage; ++i) {
+                    fresh->children[i]->parent = fresh;
+                    fresh->children[i]->parent_idx = i;
+                }
+                if constexpr (Node::COUNTED) {
+                    std::memcpy(fresh->counts.slots, internal->counts.slots + position + 1,
+                                (usage - position) * sizeof(size_t));
+                }
+                K separator = std::move(internal->keys[position]);
+                V value = std::move(internal->values[position]);
+                std::destroy(internal->keys + position, internal->keys + usage);
+                std::destroy(internal->values + position, internal->values + usage);
+                internal->usage = position;
+                right = join(right, std::move(separator), std::move(value), normalize({fresh, piece.height}));
+            }
+            auto left = halves.first;
+            if (position) {
+                K separator = std::move(internal->keys[position - 1]);
+                V value = std::move(internal->values[position - 1]);
+                std::destroy_at(internal->keys + position - 1);
+                std::destroy_at(internal->values + position - 1);
+                internal->usage = position - 1;
+                left = join(normalize(piece), std::move(separator), std::move(value), left);
+            } else {
+                free_node(internal);
+            }
+            return {left, right};
+        }
+
+        /* removes the entries in [lo, hi), or from `lo` onwards if `hi` is null, and returns their number */
+        size_t erase_pieces(const K &lo, const K *hi) {
+            if (!_size || (hi && !comp(lo, *hi))) return 0;
+            // a range below the upper fence of the leaf holding `lo` is cut out of that leaf in place
+            const K *fence = nullptr;
+            auto node = root;
+            auto h = height;
+            for (; h; --h) {
+                auto res = node->local_search(lo, comp);
+                if (res & FOUND) break;
+                auto position = res & GO_DOWN_MASK;
+                if (position < node->usage) {
+                    fence = &node->key_at(position);
+                }
+                node = node->as_internal()->children[position];
+            }
+            if (!h && hi && (!fence || !comp(*fence, *hi))) {
+                auto from = node->local_search(lo, comp), to = node->local_search(*hi, comp);
+                auto removed = node->as_leaf()->erase_slice(from & (from & FOUND ? FOUND_MASK : GO_DOWN_MASK),
+                                                            to & (to & FOUND ? FOUND_MASK : GO_DOWN_MASK), *this);
+                _size -= removed;
+                return removed;
+            }
+            auto [left, rest] = split_at({root, height}, lo);
+            auto right = Piece{nullptr, 0};
+            if (hi) {
+                std::tie(rest, right) = split_at(rest, *hi);
+            }
+            auto removed = rest.node ? release(rest.node, rest.height) : 0;
+            auto whole = concat(left, right);
+            root = whole.node;
+            height = whole.height;
+            _size -= removed;
+            return removed;
+        }
+
+        /* restores the minimum occupancy along the rightmost path, whose nodes may be arbitrarily under-full */
+        void fix_right_spine() {
+            for (;;) {
+                while (height && root->usage == 0) {
+                    auto old = root->as_internal();
+                    root = old->children[0];
+                    root->parent = nullptr;
+                    free_node(old);
+                    height--;
+                }
+                auto node = root;
+                auto h = height;
+                for (; h; --h) {
+                    auto child = node->as_internal()->children[node->usage];
+                    if (child->usage < B - 1) break;
+                    node = child;
+                }
+                if (!h) return;
+                auto child = node->as_internal()->children[node->usage];
+                if (h == 1) {
+                    child->as_leaf()->refill_from_left(*this);
+                } else {
+                    child->as_internal()->refill_from_left(*this);
+                }
+            }
+        }
+
+        /*
+         * Builds the tree bottom-up from entries pushed in strictly increasing key order. Every level keeps one
+         * open node; once the leaf reaches the fill target, the next entry becomes a separator in the lowest
+         * ancestor with room and fresh nodes are opened below it. Only the right spine can end up under-full.
+         */
+        class Builder {
+            BTree &tree;
+            size_t target;
+            std::vector<Node *> levels; // open node of every level, leaves first
+            const K *last = nullptr;
+
+            static void attach(Internal *parent, Node *child) {
+                parent->children[parent->usage] = child;
+                child->parent = parent;
+                child->parent_idx = parent->usage;
+            }
+
+        public:
+            Builder(BTree &tree, double fill) : tree(tree) {
+                target = std::clamp(size_t(fill * double(2 * B - 2) + 0.5), B - 1, 2 * B - 2);
+            }
+
+            /* whether `key` may come next, i.e. is greater than every key pushed so far */
+            bool accepts(const K &key) {
+                return !last || tree.comp(*last, key);
+            }
+
+            void push(K key, V value) {
+                ASSERT(accepts(key));
+                if (levels.empty()) {
+                    levels.push_back(tree.template allocate_node<Leaf>());
+                }
+                auto node = levels[0];
+                size_t level = 0;
+                if (node->usage == target) {
+                    for (level = 1; level < levels.size() && levels[level]->usage == target; ++level);
+                    if (level == levels.size()) {
+                        auto top = tree.template allocate_node<Internal>();
+                        attach(top, levels.back());
+                        levels.push_back(top);
+                    }
+                    node = levels[level];
+                }
+                new(node->values + node->usage) V(std::move(value));
+                new(node->keys + node->usage) K(std::move(key));
+                last = node->keys + node->usage;
+                node->usage++;
+                for (; level; --level) {
+                    Node *fresh;
+                    if (level == 1) {
+                        auto leaf = tree.template allocate_node<Leaf>();
+                        leaf->link_after(levels[0]->as_leaf());
+                        fresh = leaf;
+                    } else {
+                        fresh = tree.template allocate_node<Internal>();
+                    }
+                    attach(levels[level]->as_internal(), fresh);
+                    levels[level - 1] = fresh;
+                }
+                tree._size++;
+            }
+
+            void finish() {
+                if (levels.empty()) return;
+                tree.root = levels.back();
+                tree.height = levels.size() - 1;
+                if constexpr (Node::COUNTED) {
+                    tree.recount(tree.root, tree.height);
+                }
+                tree.fix_right_spine();
+            }
+        };
+
+        template<typename, typename, bool, unsigned, typename, size_t, unsigned>
+        friend struct __btree_impl::BTreeNode;
+
+        /*
+         * Streams `a` and `b` in key order into `builder` in one pass. Entries found on one side only are kept
+         * if `left` or `right` says so; keys on both sides are kept if `both` does, with the value returned by
+         * `resolve(key, a's value, b's value)`.
+         * With `Move`, keys and values are moved out of the operands instead of copied.
+         */
+        template<bool Move, typename Resolve>
+        static void combine(BTree &a, BTree &b, Builder &builder, bool left, bool both, bool right, Resolve &resolve) {
+            auto entry = [](typename Node::iterator iter) -> decltype(auto) {
+                if constexpr (Move) {
+                    return std::pair<K &&, V &&>(std::move(iter.node->key_at(iter.idx)),
+                                                 std::move(iter.node->value_at(iter.idx)));
+                } else {
+                    return std::pair<const K &, const V &>(iter.node->key_at(iter.idx), iter.node->value_at(iter.idx));
+                }
+            };
+            auto i = a.begin(), j = b.begin();
+            while (i != a.end() && j != b.end()) {
+                auto [x, u] = entry(i);
+                auto [y, v] = entry(j);
+                if (a.comp(x, y)) {
+                    if (left) builder.push(std::forward<decltype(x)>(x), std::forward<decltype(u)>(u));
+                    ++i;
+                } else if (a.comp(y, x)) {
+                    if (right) builder.push(std::forward<decltype(y)>(y), std::forward<decltype(v)>(v));
+                    ++j;
+                } else {
+                    if (both) {
+                        V value = resolve(std::as_const(x), std::forward<decltype(u)>(u), std::forward<decltype(v)>(v));
+                        builder.push(std::forward<decltype(x)>(x), std::move(value));
+                    }
+                    ++i, ++j;
+                }
+            }
+            for (; left && i != a.end(); ++i) {
+                auto [x, u] = entry(i);
+                builder.push(std::forward<decltype(x)>(x), std::forward<decltype(u)>(u));
+            }
+            for (; right && j != b.end(); ++j) {
+                auto [y, v] = entry(j);
+                builder.push(std::forward<decltype(y)>(y), std::forward<decltype(v)>(v));
+            }
+        }
+
+        template<typename Resolve>
+        static BTree combined(BTree &a, BTree &b, bool left, bool both, bool right, Resolve &resolve) {
+            BTree result(a.comp, NodeAllocTraits::select_on_container_copy_construction(a.alloc));
+            Builder builder(result, 1.0);
+            combine<false>(a, b, builder, left, both, right, resolve);
+            builder.finish();
+            return result;
+        }
+
+        /* descends to `key`: an exact hit, or the leaf position where it belongs */
+        std::pair<typename Node::iterator, bool> locate(const K &key) {
+            if (root == nullptr) {
+                root = allocate_node<Leaf>();
+            }
+            auto node = root;
+            for (auto h = height;; --h) {
+                auto res = node->local_search(key, comp);
+                if (res & FOUND) {
+                    return {{.idx = uint16_t(res & FOUND_MASK), .node = node}, true};
+                }
+                if (!h) {
+                    return {{.idx = uint16_t(res & GO_DOWN_MASK), .node = node}, false};
+                }
+                node = node->as_internal()->children[res & GO_DOWN_MASK];
+            }
+        }
+
+        template<typename Key, typename Value>
+        std::optional<V> insert_entry(Key &&key, Value &&value) {
+            auto [iter, found] = locate(key);
+            if (found) {
+                return iter.node->replace(iter.idx, std::forward<Value>(value));
+            }
+            iter.node->as_leaf()->emplace_at(iter.idx, *this, std::forward<Key>(key), std::forward<Value>(value));
+            _size++;
+            return std::nullopt;
+        }
+
+        template<typename Key, typename... Args>
+        std::pair<typename Node::iterator, bool> try_emplace_entry(Key &&key, Args &&... args) {
+            auto [iter, found] = locate(key);
+            if (found) {
+                return {iter, false};
+            }
+            _size++;
+            return {iter.node->as_leaf()->emplace_at(iter.idx, *this, std::forward<Key>(key),
+                                                     std::forward<Args>(args)...), true};
+        }
+
+        /* lookups kept in flight by the batched searches, enough for the others to hide one's cache miss */
+        static constexpr size_t BATCH_GROUP = 16;
+
+        /*
+         * Runs the descents of all of `batch`, BATCH_GROUP at a time and interleaved: a step searches one node of
+         * one lookup and prefetches the child it goes down to, then turns to the next lookup while that child
+         * arrives. `done(i, iter)` gets the result for batch[i], `end()` on a miss.
+         */
+        template<typename Done>
+        void descend_batch(std::span<const K> batch, Done &&done) {
+            if (!root) {
+                for (size_t i = 0; i < batch.size(); ++i) done(i, end());
+                return;
+            }
+            struct Lookup {
+                Node *node;
+                size_t h;
+                size_t i;
+            } group[BATCH_GROUP];
+            size_t active = 0, next = 0;
+            for (; active < BATCH_GROUP && next < batch.size(); ++active, ++next) {
+                group[active] = {root, height, next};
+            }
+            while (active) {
+                for (size_t slot = 0; slot < active;) {
+                    auto &lookup = group[slot];
+                    auto res = lookup.node->local_search(batch[lookup.i], comp);
+                    if (!(res & FOUND) && lookup.h) {
+                        lookup.node = lookup.node->as_internal()->children[res & GO_DOWN_MASK];
+                        lookup.h--;
+                        Node::prefetch_node(lookup.node, lookup.h ? sizeof(Internal) : sizeof(Leaf));
+                        slot++;
+                        continue;
+                    }
+                    done(lookup.i, res & FOUND ? iterator{.idx = uint16_t(res & FOUND_MASK), .node = lookup.node}
+                                               : end());
+                    if (next < batch.size()) {
+                        lookup = {root, height, next++};
+                        slot++;
+                    } else {
+                        lookup = group[--active]; // the last one takes this slot and is stepped next
+                    }
+                }
+            }
+        }
+
+        template<typename Key, typename Value>
+        std::pair<typename Node::iterator, bool> insert_or_assign_entry(Key &&key, Value &&value) {
+            auto [iter, found] = locate(key);
+            if (found) {
+                iter.node->value_at(iter.idx) = std::forward<Value>(value);
+                return {iter, false};
+            }
+            _size++;
+            return {iter.node->as_leaf()->emplace_at(iter.idx, *this, std::forward<Key>(key),
+                                                     std::forward<Value>(value)), true};
+        }
+
+#ifdef DEBUG_MODE
+
+        void validate(Node *node, size_t h, size_t &count, const K *&prev, Leaf *&last) {
+            ASSERT(node->leaf == (h == 0));
+            if constexpr (Node::LINKED) {
+                if (!h) {
+                    ASSERT(node->as_leaf()->links.prev == last);
+                    ASSERT(!last || last->links.next == node);
+                    last = node->as_leaf();
+                }
+            }
+            ASSERT(node->usage < 2 * B - 1);
+            ASSERT(node == root || node->usage >= B - 1);
+            for (size_t i = 0; i <= node->usage; ++i) {
+                if (h) {
+                    auto child = node->as_internal()->children[i];
+                    ASSERT(child->parent == node && child->parent_idx == i);
+                    [[maybe_unused]] auto before = count;
+                    validate(child, h - 1, count, prev, last);
+                    if constexpr (Node::COUNTED) {
+                        ASSERT(node->as_internal()->counts[i] == count - before);
+                    }
+                }
+                if (i < node->usage) {
+                    ASSERT(!prev || comp(*prev, node->key_at(i)));
+                    prev = &node->key_at(i);
+                    count++;
+                }
+            }
+        }
+
+#endif
     public:
 
-        BTree(Compare comp = Compare()) : comp(comp) {}
+        BTree(Compare comp = Compare(), const Alloc &alloc = Alloc()) : alloc(alloc), comp(comp) {}
 
-        BTree(BTree &&that) noexcept(Compare(std::move(comp))) {
-            root = that.root;
-            _size = that._size;
+        /* O(1): nodes hold no reference into the tree object, so the root is simply handed over */
+        BTree(BTree &&that) noexcept(std::is_nothrow_move_constructible_v<Compare>)
+                : _size(std::exchange(that._size, 0)), height(std::exchange(that.height, 0)),
+                  root(std::exchange(that.root, nullptr)), alloc(std::move(that.alloc)), comp(std::move(that.comp)) {}
+
+        BTree &operator=(BTree &&that) noexcept(std::is_nothrow_move_assignable_v<Compare>) {
+            if (this == &that) return *this;
+            clear();
+            if constexpr (NodeAllocTraits::propagate_on_container_move_assignment::value) {
+                alloc = that.alloc;
+            } else {
+                ASSERT(alloc == that.alloc);
+            }
             comp = std::move(that.comp);
+            root = std::exchange(that.root, nullptr);
+            height = std::exchange(that.height, 0);
+            _size = std::exchange(that._size, 0);
+            return *this;
+        }
+
+        void swap(BTree &that) noexcept(std::is_nothrow_swappable_v<Compare>) {
+            using std::swap;
+            if constexpr (NodeAllocTraits::propagate_on_container_swap::value) {
+                swap(alloc, that.alloc);
+            } else {
+                ASSERT(alloc == that.alloc);
+            }
+            swap(comp, that.comp);
+            swap(root, that.root);
+            swap(height, that.height);
+            swap(_size, that._size);
+        }
+
+        /*
+         * Builds a tree from entries sorted by strictly increasing key in O(n), without descending once.
+         * `fill` is the fraction of each node's capacity to use, clamped to the B-tree minimum.
+         */
+        template<typename Iter>
+        static BTree from_sorted(Iter first, Iter last, double fill = 1.0, Compare comp = Compare(),
+                                 const Alloc &alloc = Alloc()) {
+            BTree tree(comp, alloc);
+            tree.assign_sorted(first, last, fill);
+            return tree;
+        }
+
+        template<typename Iter>
+        void assign_sorted(Iter first, Iter last, double fill = 1.0) {
+            clear();
+            Builder builder(*this, fill);
+            for (; first != last; ++first) {
+                auto &&entry = *first;
+                builder.push(std::forward<decltype(entry)>(entry).first, std::forward<decltype(entry)>(entry).second);
+            }
+            builder.finish();
+        }
+
+        /*
+         * Writes every entry in key order to `out`, without a copy of the tree. `serializer(bytes, key, value)`
+         * appends one entry to a string. The stream is a magic, then blocks of about DUMP_BLOCK bytes holding an
+         * entry count, a byte count and the entries, each prefixed by its length; an empty block ends it.
+         * Blocks are independent of each other, so they can be compressed one by one. An entry longer than
+         * DUMP_BLOCK bytes fails the dump, so that `load` can refuse any block longer than DUMP_BLOCK_LIMIT.
+         */
+        template<typename Serializer = __btree_impl::RawEncoder>
+        bool dump(std::ostream &out, Serializer &&serializer = Serializer()) {
+            out.write(__btree_impl::DUMP_MAGIC, sizeof(__btree_impl::DUMP_MAGIC));
+            std::string block;
+            uint32_t count = 0;
+            auto flush = [&] {
+                std::string head;
+                __btree_impl::put_u32(head, count);
+                __btree_impl::put_u32(head, uint32_t(block.size()));
+                out.write(head.data(), std::streamsize(head.size()));
+                out.write(block.data(), std::streamsize(block.size()));
+                block.clear();
+                count = 0;
+            };
+            for (auto i : *this) {
+                auto start = block.size();
+                __btree_impl::put_u32(block, 0);
+                serializer(block, i.first, i.second);
+                auto length = block.size() - start - 4;
+                if (length > __btree_impl::DUMP_BLOCK) return false;
+                for (size_t b = 0; b < 4; ++b) block[start + b] = char(length >> (8 * b));
+                count++;
+                if (block.size() >= __btree_impl::DUMP_BLOCK) flush();
+            }
+            if (count) flush();
+            flush();
+            return bool(out);
+        }
+
+        /*
+         * Replaces the contents with a stream written by `dump`, built bottom-up as the blocks arrive, so only
+         * one block is held at a time. `deserializer(bytes)` turns one entry back into an optional pair. On a
+         * truncated or malformed stream, a block longer than `dump` writes, or keys out of order, the tree is left
+         * empty and false returned.
+         */
+        template<typename Deserializer = __btree_impl::RawDecoder<K, V>>
+        bool load(std::istream &in, Deserializer &&deserializer = Deserializer(), double fill = 1.0) {
+            clear();
+            char head[8];
+            if (!in.read(head, sizeof(head)) ||
+                std::memcmp(head, __btree_impl::DUMP_MAGIC, sizeof(__btree_impl::DUMP_MAGIC)) != 0) {
+                return false;
+            }
+            Builder builder(*this, fill);
+            std::string block;
+            auto intact = [&] {
+                for (;;) {
+                    if (!in.read(head, 8)) return false;
+                    auto count = __btree_impl::get_u32(head), bytes = __btree_impl::get_u32(head + 4);
+                    if (!count) return bytes == 0;
+                    if (bytes > __btree_impl::DUMP_BLOCK_LIMIT) return false;
+                    block.resize(bytes);
+                    if (!in.read(block.data(), bytes)) return false;
+                    size_t at = 0;
+                    for (; count; --count) {
+                        if (bytes - at < 4) return false;
+                        auto length = __btree_impl::get_u32(block.data() + at);
+                        at += 4;
+                        if (bytes - at < length) return false;
+                        auto entry = deserializer(std::string_view(block.data() + at, length));
+                        at += length;
+                        if (!entry || !builder.accepts(entry->first)) return false;
+                        builder.push(std::move(entry->first), std::move(entry->second));
+                    }
+                    if (at != bytes) return false;
+                }
+            }();
+            builder.finish();
+            if (!intact) clear();
+            return intact;
         }
 
-        BTree(const BTree &that) {
+        BTree(const BTree &that) : alloc(NodeAllocTraits::select_on_container_copy_construction(that.alloc)) {
             comp = that.comp;
             _size = that._size;
+            height = that.height;
             if (that.root == nullptr) {
                 root = nullptr;
                 return;
             } else {
-                root = that.root->same_type(comp);
-                that.root->traversal_copy(root, comp);
+                root = Node::traversal_copy(that.root, height, nullptr, *this);
+                if constexpr (Node::LINKED) {
+                    Leaf *last = nullptr;
+                    link_leaves(root, height, last);
+                }
             }
         }
 
@@ -779,21 +2322,111 @@ namespace btree {
         void display() {
             if (root) root->display(0);
         };
+
+        /* checks occupancy, key order, parent links and that all leaves sit at `height` */
+        void validate() {
+            if (!root) {
+                ASSERT(_size == 0);
+                return;
+            }
+            ASSERT(root->parent == nullptr);
+            size_t count = 0;
+            const K *prev = nullptr;
+            Leaf *last = nullptr;
+            validate(root, height, count, prev, last);
+            ASSERT(count == _size);
+            if constexpr (Node::LINKED) {
+                ASSERT(last->links.next == nullptr);
+            }
+        }
 #endif
 
-        std::optional<V> insert(const K &key, const V &value) {
+        /* returns the replaced value on a hit; rvalue keys and values are moved into the tree */
+        template<typename Value = V>
+        std::optional<V> insert(const K &key, Value &&value) {
+            return insert_entry(key, std::forward<Value>(value));
+        }
+
+        template<typename Value = V>
+        std::optional<V> insert(K &&key, Value &&value) {
+            return insert_entry(std::move(key), std::forward<Value>(value));
+        }
+
+        /* inserts a value built from `args` unless `key` is present, in which case nothing is constructed */
+        template<typename... Args>
+        std::pair<iterator, bool> try_emplace(const K &key, Args &&... args) {
+            return try_emplace_entry(key, std::forward<Args>(args)...);
+        }
+
+        template<typename... Args>
+        std::pair<iterator, bool> try_emplace(K &&key, Args &&... args) {
+            return try_emplace_entry(std::move(key), std::forward<Args>(args)...);
+        }
+
+        /* like std::map::emplace, the entry is built first and dropped if its key is present */
+        template<typename... Args>
+        std::pair<iterator, bool> emplace(Args &&... args) {
+            std::pair<K, V> entry(std::forward<Args>(args)...);
+            return try_emplace_entry(std::move(entry.first), std::move(entry.second));
+        }
+
+        /* assigns to the existing value in place on a hit */
+        template<typename Value>
+        std::pair<iterator, bool> insert_or_assign(const K &key, Value &&value) {
+            return insert_or_assign_entry(key, std::forward<Value>(value));
+        }
+
+        template<typename Value>
+        std::pair<iterator, bool> insert_or_assign(K &&key, Value &&value) {
+            return insert_or_assign_entry(std::move(key), std::forward<Value>(value));
+        }
+
+        /*
+         * Inserts a whole batch with sequential `insert` semantics, later duplicates overwriting earlier ones; the
+         * result for each entry is the value it replaced. The batch is sorted once, then every leaf is reached by a
+         * single descent and merged with all batch keys below its upper fence.
+         */
+        std::vector<std::optional<V>> insert_batch(std::span<const std::pair<K, V>> batch) {
+            std::vector<std::optional<V>> results(batch.size());
+            std::vector<size_t> order(batch.size());
+            for (size_t i = 0; i < order.size(); ++i) {
+                order[i] = i;
+            }
+            std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+                return comp(batch[a].first, batch[b].first);
+            });
             if (root == nullptr) {
-                auto node = new __btree_impl::BTreeNode<K, V, false, UseBinary, Compare, B>(comp);
-                node->usage = 1;
-                new(node->__keys) K(key);
-                new(node->__values) V(value);
-                root = node;
-                _size++;
-                return std::nullopt;
+                root = allocate_node<Leaf>();
+            }
+            std::vector<std::pair<K, V>> buffer;
+            for (size_t next = 0; next < order.size();) {
+                auto &key = batch[order[next]].first;
+                const K *fence = nullptr;
+                auto node = root;
+                auto h = height;
+                for (; h; --h) {
+                    auto res = node->local_search(key, comp);
+                    if (res & FOUND) {
+                        results[order[next]] = node->replace(res & FOUND_MASK, batch[order[next]].second);
+                        next++;
+                        break;
+                    }
+                    auto position = res & GO_DOWN_MASK;
+                    if (position < node->usage) {
+                        fence = &node->key_at(position);
+                    }
+                    node = node->as_internal()->children[position];
+                }
+                if (h) continue;
+                auto end = next + 1;
+                while (end < order.size() && (!fence || comp(batch[order[end]].first, *fence))) {
+                    end++;
+                }
+                _size += node->as_leaf()->absorb(batch.data(), order.data() + next, end - next, results.data(),
+                                                 buffer, *this);
+                next = end;
             }
-            auto res = root->insert(key, value, &root);
-            if (!res) _size++;
-            return res;
+            return results;
         }
 
         bool empty() {
@@ -801,7 +2434,200 @@ namespace btree {
         }
 
         bool member(const K &key) {
-            return root && root->member(key);
+            return member<K>(key);
+        }
+
+        /* lookups below also take any probe type that a transparent `Compare` orders against K, unconverted */
+        template<typename Q> requires __btree_impl::lookup_key<Q, K, Compare>
+        bool member(const Q &key) {
+            if (!root) return false;
+            auto node = root;
+            for (auto h = height; h; --h) {
+                auto res = node->local_search(key, comp);
+                if (res & FOUND) return true;
+                node = node->as_internal()->children[res & GO_DOWN_MASK];
+            }
+            return node->local_search(key, comp) & FOUND;
+        }
+
+        /* 1 if `key` is present, else 0 */
+        size_t count(const K &key) {
+            return member<K>(key);
+        }
+
+        template<typename Q> requires __btree_impl::lookup_key<Q, K, Compare>
+        size_t count(const Q &key) {
+            return member(key);
+        }
+
+        iterator find(const K &key) {
+            return find<K>(key);
+        }
+
+        template<typename Q> requires __btree_impl::lookup_key<Q, K, Compare>
+        iterator find(const Q &key) {
+            if (!root) return end();
+            auto node = root;
+            for (auto h = height;; --h) {
+                auto res = node->local_search(key, comp);
+                if (res & FOUND) {
+                    return iterator{
+                            .idx = uint16_t(res & FOUND_MASK),
+                            .node = node
+                    };
+                }
+                if (!h) return end();
+                node = node->as_internal()->children[res & GO_DOWN_MASK];
+            }
+        }
+
+        /* `member` for every key of `batch` into `out`, with the descents interleaved to overlap their misses */
+        void member_batch(std::span<const K> batch, std::span<bool> out) {
+            ASSERT(out.size() >= batch.size());
+            descend_batch(batch, [&](size_t i, iterator iter) { out[i] = iter.node != nullptr; });
+        }
+
+        /* `find` for every key of `batch` into `out`, with the descents interleaved to overlap their misses */
+        void find_batch(std::span<const K> batch, std::span<iterator> out) {
+            ASSERT(out.size() >= batch.size());
+            descend_batch(batch, [&](size_t i, iterator iter) { out[i] = iter; });
+        }
+
+        iterator lower_bound(const K &key) {
+            return lower_bound<K>(key);
+        }
+
+        /* first element not less than `key`; the deepest node with a greater key on the path holds it */
+        template<typename Q> requires __btree_impl::lookup_key<Q, K, Compare>
+        iterator lower_bound(const Q &key) {
+            auto result = end();
+            if (!root) return result;
+            auto node = root;
+            for (auto h = height;; --h) {
+                auto res = node->local_search(key, comp);
+                if (res & FOUND) {
+                    return iterator{
+                            .idx = uint16_t(res & FOUND_MASK),
+                            .node = node
+                    };
+                }
+                auto position = res & GO_DOWN_MASK;
+                if (position < node->usage) {
+                    result = iterator{
+                            .idx = uint16_t(position),
+                            .node = node
+                    };
+                }
+                if (!h) return result;
+                node = node->as_internal()->children[position];
+            }
+        }
+
+        iterator upper_bound(const K &key) {
+            return upper_bound<K>(key);
+        }
+
+        /* first element greater than `key` */
+        template<typename Q> requires __btree_impl::lookup_key<Q, K, Compare>
+        iterator upper_bound(const Q &key) {
+            return equal_range(key).second;
+        }
+
+        std::pair<iterator, iterator> equal_range(const K &key) {
+            return equal_range<K>(key);
+        }
+
+        template<typename Q> requires __btree_impl::lookup_key<Q, K, Compare>
+        std::pair<iterator, iterator> equal_range(const Q &key) {
+            auto lower = lower_bound(key);
+            auto upper = lower;
+            if (lower != end() && !comp(key, lower.node->key_at(lower.idx))) {
+                ++upper;
+            }
+            return {lower, upper};
+        }
+
+        /* the entry at position `k` in key order, or `end()` if there are not that many; needs ORDER_STATISTICS */
+        iterator nth(size_t k) {
+            static_assert(Node::COUNTED, "nth needs ORDER_STATISTICS");
+            if (k >= _size) return end();
+            return Node::select(root, k);
+        }
+
+        /* position of `iter` in key order, `size()` for `end()`; needs ORDER_STATISTICS */
+        size_t index_of(iterator iter) {
+            static_assert(Node::COUNTED, "index_of needs ORDER_STATISTICS");
+            return iter.node ? iter.node->index(iter.idx) : _size;
+        }
+
+        /*
+         * The entry `n` positions after `iter`, or before it for negative `n`, in O(log n). Stepping exactly past
+         * the last entry gives `end()`, and `end()` steps back like position `size()`. A target outside
+         * [0, size()] is rejected with `end()` as well; needs ORDER_STATISTICS.
+         */
+        iterator advance(iterator iter, ptrdiff_t n) {
+            static_assert(Node::COUNTED, "advance needs ORDER_STATISTICS");
+            auto from = index_of(iter);
+            if (n < 0 ? size_t(0) - size_t(n) > from : size_t(n) > _size - from) return end();
+            return nth(from + n);
+        }
+
+        /* number of keys less than `key`; needs ORDER_STATISTICS */
+        size_t rank(const K &key) {
+            static_assert(Node::COUNTED, "rank needs ORDER_STATISTICS");
+            if (!root) return 0;
+            size_t result = 0;
+            auto node = root;
+            for (auto h = height;; --h) {
+                auto res = node->local_search(key, comp);
+                auto position = res & FOUND ? res & FOUND_MASK : res & GO_DOWN_MASK;
+                result += position;
+                if (!h) return result;
+                auto internal = node->as_internal();
+                for (size_t i = 0; i < position; ++i) result += internal->counts[i];
+                if (res & FOUND) return result + internal->counts[position];
+                node = internal->children[position];
+            }
+        }
+
+        /* number of keys in [lo, hi) */
+        size_t count_range(const K &lo, const K &hi) {
+            if (!comp(lo, hi)) return 0;
+            return rank(hi) - rank(lo);
+        }
+
+        /*
+         * Moves every entry of `that` into this tree; `resolve(key, ours, theirs)` picks the value of a key
+         * present in both. Both trees are streamed once and the result is rebuilt bottom-up into packed nodes,
+         * so the cost is linear instead of one descent per entry of `that`.
+         */
+        template<typename Resolve = KeepFirst>
+        void merge_from(BTree &&that, Resolve resolve = Resolve()) {
+            if (!that._size) return;
+            BTree result(comp, Alloc(alloc));
+            Builder builder(result, 1.0);
+            combine<true>(*this, that, builder, true, true, true, resolve);
+            builder.finish();
+            that.clear();
+            *this = std::move(result);
+        }
+
+        /* entries of both trees, each built into a packed new tree in one sorted pass over the operands */
+        template<typename Resolve = KeepFirst>
+        static BTree set_union(BTree &a, BTree &b, Resolve resolve = Resolve()) {
+            return combined(a, b, true, true, true, resolve);
+        }
+
+        /* entries whose key is in both trees, with values from `resolve` */
+        template<typename Resolve = KeepFirst>
+        static BTree set_intersection(BTree &a, BTree &b, Resolve resolve = Resolve()) {
+            return combined(a, b, false, true, false, resolve);
+        }
+
+        /* entries of `a` whose key is not in `b` */
+        static BTree set_difference(BTree &a, BTree &b) {
+            KeepFirst unused;
+            return combined(a, b, true, false, false, unused);
         }
 
         const K &min_key() {
@@ -815,8 +2641,11 @@ namespace btree {
         }
 
         iterator begin() {
-            if (_size)
-                return root->min();
+            if (_size) {
+                auto first = root->min();
+                first.node->template prefetch_leaves<true>();
+                return first;
+            }
             return end();
         }
 
@@ -827,13 +2656,244 @@ namespace btree {
             };
         }
 
+        void clear() {
+            if (!root) return;
+            if constexpr (std::is_trivially_destructible_v<K> && std::is_trivially_destructible_v<V> &&
+                          requires(NodeAlloc &a) { a.exclusive(); a.release(); }) {
+                if (alloc.exclusive()) {
+                    [[maybe_unused]] auto dropped = alloc.release();
+#ifdef DEBUG_MODE
+                    alive_node -= dropped;
+#endif
+                } else {
+                    release(root, height);
+                }
+            } else {
+                release(root, height);
+            }
+            root = nullptr;
+            height = 0;
+            _size = 0;
+        }
+
         ~BTree() {
-            delete root;
+            clear();
+        }
+
+        /*
+         * Deep copy with the subtrees below the top levels copied on up to `threads` threads and stitched under
+         * a copy of the top made by the caller. Falls back to the copy constructor for small trees or stateful
+         * allocators.
+         */
+        BTree parallel_copy(unsigned threads = std::thread::hardware_concurrency()) {
+            if (!parallel(threads)) return BTree(*this);
+            BTree result(comp, NodeAllocTraits::select_on_container_copy_construction(alloc));
+            result._size = _size;
+            result.height = height;
+            auto depth = split_depth(threads);
+            std::vector<std::pair<Node *, Internal *>> below;
+            result.root = result.copy_top(root, depth, nullptr, below);
+            std::vector<std::pair<Leaf *, Leaf *>> ends(below.size());
+            __btree_impl::fan_out(below.size(), threads, [&](size_t i) {
+                auto [source, parent] = below[i];
+                auto copy = Node::traversal_copy(source, height - depth, parent, result);
+                parent->children[source->parent_idx] = copy;
+                if constexpr (Node::LINKED) {
+                    Leaf *last = nullptr;
+                    result.link_leaves(copy, height - depth, last);
+                    ends[i] = {result.leftmost(copy, height - depth), last};
+                }
+            });
+            if constexpr (Node::LINKED) {
+                for (size_t i = 1; i < ends.size(); ++i) { // join the chains, not single leaves as `link_after` does
+                    ends[i - 1].second->links.next = ends[i].first;
+                    ends[i].first->links.prev = ends[i - 1].second;
+                }
+            }
+            return result;
+        }
+
+        /* `clear()` with the subtrees below the top levels freed on up to `threads` threads */
+        void parallel_clear(unsigned threads = std::thread::hardware_concurrency()) {
+            if (!parallel(threads)) return clear();
+            auto depth = split_depth(threads);
+            std::vector<Node *> below;
+            cut_top(root, depth, below);
+            if constexpr (Node::LINKED) { // leaves unlink themselves when freed, so cut the chain between subtrees
+                for (size_t i = 1; i < below.size(); ++i) {
+                    auto first = leftmost(below[i], height - depth);
+                    first->links.prev->links.next = nullptr;
+                    first->links.prev = nullptr;
+                }
+            }
+            __btree_impl::fan_out(below.size(), threads, [&](size_t i) { release(below[i], height - depth); });
+            root = nullptr;
+            height = 0;
+            _size = 0;
+        }
+
+        /*
+         * Empties the tree at once and leaves freeing the nodes to `reclaimer`'s thread. With a stateful
+         * allocator this is a plain `clear()`.
+         */
+        void clear(Reclaimer &reclaimer) {
+            if constexpr (NodeAllocTraits::is_always_equal::value) {
+                if (!root) return;
+                auto dropped = std::make_shared<BTree>(std::move(*this));
+                reclaimer.defer([dropped] { dropped->clear(); });
+            } else {
+                clear();
+            }
         }
 
         std::pair<K, V> erase(iterator iter) {
             _size--;
-            return iter.node->erase(iter.idx, &root);
+            if (iter.node->leaf) {
+                return iter.node->as_leaf()->erase(iter.idx, *this);
+            }
+            return iter.node->as_internal()->erase(iter.idx, *this);
+        }
+
+        size_t erase(const K &key) {
+            return erase<K>(key);
+        }
+
+        template<typename Q> requires __btree_impl::lookup_key<Q, K, Compare>
+        size_t erase(const Q &key) {
+            auto iter = find(key);
+            if (!(iter != end())) return 0;
+            erase(iter);
+            return 1;
+        }
+
+        /*
+         * Removes every key in [lo, hi) in O(log n + k): the tree is split along the two boundary paths, the
+         * subtrees in between are freed without rebalancing, and the outer parts are joined back.
+         */
+        size_t erase_range(const K &lo, const K &hi) {
+            return erase_pieces(lo, &hi);
+        }
+
+        /* range version of erase(iterator); returns the position following the removed entries */
+        iterator erase(iterator first, iterator last) {
+            if (!(first != last)) return last;
+            K lo = first.node->key_at(first.idx);
+            if (!(last != end())) {
+                erase_pieces(lo, nullptr);
+                return end();
+            }
+            K hi = last.node->key_at(last.idx);
+            erase_pieces(lo, &hi);
+            return find(hi);
+        }
+
+        /*
+         * Removes every key of a batch sorted by `comp` and returns how many were present. Like insert_batch, each
+         * leaf is reached once and loses all of its batch keys in a single pass before it is refilled.
+         */
+        size_t erase_batch(std::span<const K> batch) {
+            ASSERT(std::is_sorted(batch.begin(), batch.end(), comp));
+            size_t removed = 0;
+            for (size_t next = 0; next < batch.size() && _size;) {
+                auto &key = batch[next];
+                const K *fence = nullptr;
+                auto node = root;
+                auto h = height;
+                for (; h; --h) {
+                    auto res = node->local_search(key, comp);
+                    if (res & FOUND) {
+                        erase(iterator{.idx = uint16_t(res & FOUND_MASK), .node = node});
+                        removed++;
+                        next++;
+                        break;
+                    }
+                    auto position = res & GO_DOWN_MASK;
+                    if (position < node->usage) {
+                        fence = &node->key_at(position);
+                    }
+                    node = node->as_internal()->children[position];
+                }
+                if (h) continue;
+                auto end = next + 1;
+                while (end < batch.size() && (!fence || comp(batch[end], *fence))) {
+                    end++;
+                }
+                auto count = node->as_leaf()->remove_run(batch.data() + next, end - next, *this);
+                _size -= count;
+                removed += count;
+                next = end;
+            }
+            return removed;
+        }
+
+        /*
+         * Moves every entry not less than `key` into a new tree sharing our allocator. The tree is cut along the
+         * path to `key` in O(log n) node operations. ORDER_STATISTICS gives the sizes of the parts from the counts;
+         * otherwise both parts are counted with a doubling bound until the smaller one is done, which walks
+         * O(min(left, right) / B) nodes.
+         */
+        BTree split_off(const K &key) {
+            BTree right(comp, Alloc(alloc));
+            if (!_size) return right;
+            auto [l, r] = split_at({root, height}, key);
+            if constexpr (Node::LINKED) {
+                if (l.node && r.node) {
+                    l.node->max().node->as_leaf()->links.next = nullptr;
+                    r.node->min().node->as_leaf()->links.prev = nullptr;
+                }
+            }
+            right.root = r.node;
+            right.height = r.height;
+            if constexpr (Node::COUNTED) {
+                right._size = r.node ? r.node->subtree_size() : 0;
+            } else {
+                for (size_t limit = 2 * B;; limit *= 2) {
+                    if (auto n = count_upto(r, limit); n <= limit) {
+                        right._size = n;
+                        break;
+                    }
+                    if (auto n = count_upto(l, limit); n <= limit) {
+                        right._size = _size - n;
+                        break;
+                    }
+                }
+            }
+            root = l.node;
+            height = l.height;
+            _size -= right._size;
+            return right;
+        }
+
+        /*
+         * Moves all entries of `that` behind ours in O(log n), provided its keys are all greater than ours;
+         * otherwise returns false and leaves both trees as they were. Nodes are grafted only between equal
+         * allocators. Unequal ones, such as two independent `SlabAllocator` pools, cannot share nodes, and the
+         * entries are then moved over by a linear rebuild instead.
+         */
+        bool append(BTree &&that) {
+            if (!that._size) return true;
+            if (_size && !comp(max_key(), that.min_key())) return false;
+            if (!(alloc == that.alloc)) {
+                merge_from(std::move(that));
+                return true;
+            }
+            if (!_size) {
+                clear();
+                root = std::exchange(that.root, nullptr);
+                height = std::exchange(that.height, 0);
+                _size = std::exchange(that._size, 0);
+                return true;
+            }
+            if constexpr (Node::LINKED) {
+                auto last = root->max().node->as_leaf(), first = that.root->min().node->as_leaf();
+                last->links.next = first;
+                first->links.prev = last;
+            }
+            auto whole = concat({root, height}, {std::exchange(that.root, nullptr), std::exchange(that.height, 0)});
+            root = whole.node;
+            height = whole.height;
+            _size += std::exchange(that._size, 0);
+            return true;
         }
 
         std::pair<K, V> pop_min() {
@@ -0,0 +1,737 @@
+#ifndef CONCURRENT_BTREE_HPP
+#define CONCURRENT_BTREE_HPP
+
+#include <btree.hpp>
+#include <atomic>
+#include <mutex>
+#include <thread>
+
+#define keys node_keys()
+#define values node_values()
+
+namespace btree {
+
+    template<typename K, typename V, unsigned Search = BINARY_SEARCH, size_t B = DEFAULT_BTREE_FACTOR, typename Compare = std::less<K>,
+            typename Alloc = std::allocator<std::pair<const K, V>>>
+    class ConcurrentBTree;
+
+    namespace __concurrent_impl {
+
+        /*
+         * Optimistic version lock. Bit 1 is the write lock, bit 0 marks a node that was unlinked from the tree and
+         * the bits above count write critical sections. Readers remember the version, read without locking and
+         * trust what they read only if the version is still the same afterwards. Writers upgrade a remembered
+         * version, so an upgrade fails whenever anyone wrote in between.
+         */
+        class VersionLock {
+            std::atomic<uint64_t> version{0};
+
+        public:
+            static constexpr uint64_t OBSOLETE = 1;
+            static constexpr uint64_t LOCKED = 2;
+
+            /* waits out a writer; fails on an unlinked node */
+            bool read_lock(uint64_t &v) {
+                v = version.load(std::memory_order_acquire);
+                while (v & LOCKED) {
+                    std::this_thread::yield();
+                    v = version.load(std::memory_order_acquire);
+                }
+                return !(v & OBSOLETE);
+            }
+
+            /* whether nothing was written since `read_lock` returned `v` */
+            bool validate(uint64_t v) {
+                std::atomic_thread_fence(std::memory_order_acquire);
+                return version.load(std::memory_order_relaxed) == v;
+            }
+
+            bool upgrade(uint64_t v) {
+                return version.compare_exchange_strong(v, v + LOCKED, std::memory_order_acquire);
+            }
+
+            void unlock() {
+                version.fetch_add(LOCKED, std::memory_order_release);
+            }
+
+            /* unlocks a node that is no longer reachable, so that everyone still holding it restarts */
+            void unlock_obsolete() {
+                version.fetch_add(LOCKED | OBSOLETE, std::memory_order_release);
+            }
+
+#ifdef DEBUG_MODE
+
+            bool idle() {
+                return !(version.load(std::memory_order_relaxed) & (LOCKED | OBSOLETE));
+            }
+
+#endif
+        };
+
+        /*
+         * Epoch-based reclamation. Every operation pins the global epoch in its thread's slot while it runs. A node
+         * unlinked from the tree is retired with the epoch of that moment, and the epoch only advances once every
+         * pinned slot has seen the current one, so two advances later no operation can still hold the node.
+         * Slots are claimed per thread on first use and handed to other threads once their owner exits.
+         */
+        template<typename Node>
+        class Epochs {
+            struct alignas(64) Slot {
+                std::atomic<uint64_t> pinned{0}; // 0 while the owner is outside the tree
+                std::atomic<bool> owned{true};
+                std::vector<std::pair<uint64_t, Node *>> retired;
+            };
+
+            /* the slots a thread holds, released when it exits */
+            struct Claims {
+                std::vector<std::pair<uint64_t, std::shared_ptr<Slot>>> held;
+
+                ~Claims() {
+                    for (auto &i : held) {
+                        i.second->owned.store(false, std::memory_order_release);
+                    }
+                }
+            };
+
+            static constexpr size_t BATCH = 64;
+            static inline std::atomic<uint64_t> next_id{0};
+
+            const uint64_t id = next_id.fetch_add(1, std::memory_order_relaxed);
+            std::atomic<uint64_t> epoch{1};
+            std::mutex registry;
+            std::vector<std::shared_ptr<Slot>> slots;
+
+            Slot &local() {
+                thread_local Claims claims;
+                for (auto &i : claims.held) {
+                    if (i.first == id) return *i.second;
+                }
+                std::erase_if(claims.held, [](auto &i) { return i.second.use_count() == 1; }); // epochs already gone
+                std::shared_ptr<Slot> slot;
+                {
+                    std::lock_guard guard(registry);
+                    for (auto &i : slots) {
+                        bool expected = false;
+                        if (i->owned.compare_exchange_strong(expected, true, std::memory_order_acquire)) {
+                            slot = i;
+                            break;
+                        }
+                    }
+                    if (!slot) slot = slots.emplace_back(std::make_shared<Slot>());
+                }
+                return *claims.held.emplace_back(id, std::move(slot)).second;
+            }
+
+            /* moves the epoch forward if every pinned slot is at the current one */
+            uint64_t advance() {
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+                auto current = epoch.load(std::memory_order_relaxed);
+                std::lock_guard guard(registry);
+                for (auto &i : slots) {
+                    auto pinned = i->pinned.load(std::memory_order_relaxed);
+                    if (pinned && pinned != current) return current;
+                }
+                std::atomic_thread_fence(std::memory_order_acquire);
+                epoch.compare_exchange_strong(current, current + 1, std::memory_order_release);
+                return epoch.load(std::memory_order_relaxed);
+            }
+
+        public:
+            class Guard {
+                Slot &slot;
+
+            public:
+                explicit Guard(Epochs &epochs) : slot(epochs.local()) {
+                    slot.pinned.store(epochs.epoch.load(std::memory_order_relaxed), std::memory_order_relaxed);
+                    std::atomic_thread_fence(std::memory_order_seq_cst);
+                }
+
+                Guard(const Guard &) = delete;
+
+                ~Guard() {
+                    slot.pinned.store(0, std::memory_order_release);
+                }
+
+                friend class Epochs;
+            };
+
+            /* hands an unlinked node over for freeing once no operation can reach it anymore */
+            template<typename Free>
+            void retire(Guard &guard, Node *node, Free &&free) {
+                auto &retired = guard.slot.retired;
+                retired.emplace_back(epoch.load(std::memory_order_relaxed), node);
+                if (retired.size() % BATCH) return;
+                auto current = advance();
+                std::erase_if(retired, [&](auto &i) {
+                    if (i.first + 2 > current) return false;
+                    free(i.second);
+                    return true;
+                });
+            }
+
+            /* frees everything still retired; only when no operation is running */
+            template<typename Free>
+            void drain(Free &&free) {
+                std::lock_guard guard(registry);
+                for (auto &i : slots) {
+                    for (auto &j : i->retired) free(j.second);
+                    i->retired.clear();
+                }
+            }
+        };
+
+        template<typename K, typename V, unsigned Search, size_t B, typename Compare>
+        struct Internal;
+
+        /*
+         * Same key/value layout as `BTree` nodes, with the parent link traded for a version lock: nothing points
+         * upwards, so a writer only touches the nodes it locked itself. Keys and values are read while a writer may
+         * be moving them and are only trusted after validation, hence both must be trivially copyable.
+         */
+        template<typename K, typename V, unsigned Search, size_t B, typename Compare>
+        struct alignas(64) NodeBase {
+            static_assert(B > 2, "B is too small");
+            static_assert(2 * B < (1u << 16u), "B is too large");
+            static_assert(std::is_trivially_copyable_v<K> && std::is_trivially_copyable_v<V>,
+                          "optimistic readers copy keys and values that may be torn");
+            using Internal = __concurrent_impl::Internal<K, V, Search, B, Compare>;
+            using KeyBlock = std::aligned_storage_t<sizeof(K), alignof(K)>;
+            using ValueBlock = std::aligned_storage_t<sizeof(V), alignof(V)>;
+            static constexpr bool USE_SIMD = Search == SIMD_SEARCH && __btree_impl::simd_searchable<K, Compare>;
+            static constexpr size_t CAPACITY = 2 * B - 1;
+            static constexpr size_t KEY_SLOTS = USE_SIMD ?
+                                                (CAPACITY + __btree_impl::SIMD_LANES<K> - 1) /
+                                                __btree_impl::SIMD_LANES<K> * __btree_impl::SIMD_LANES<K> :
+                                                CAPACITY;
+
+            VersionLock lock;
+            uint16_t usage = 0;
+            bool leaf;
+
+            KeyBlock __keys[KEY_SLOTS];
+            ValueBlock __values[CAPACITY];
+
+            explicit NodeBase(bool leaf) : leaf(leaf) {
+#ifdef DEBUG_MODE
+                alive_node++;
+#endif
+            }
+
+#ifdef DEBUG_MODE
+
+            ~NodeBase() {
+                alive_node--;
+            }
+
+#endif
+
+            inline Internal *as_internal() {
+                ASSERT(!leaf);
+                return static_cast<Internal *>(this);
+            }
+
+            inline K *node_keys() {
+                return reinterpret_cast<K *>(__keys);
+            }
+
+            inline V *node_values() {
+                return reinterpret_cast<V *>(__values);
+            }
+
+            /* position of the first key not less than `key` and whether it is `key`; may run on a node being written */
+            inline std::pair<uint16_t, bool> search(const K &key, Compare &comp) {
+                uint16_t n = std::min<uint16_t>(usage, CAPACITY);
+                uint16_t position;
+                if constexpr (USE_SIMD) {
+                    position = __btree_impl::simd_lower_bound<KEY_SLOTS>(keys, n, key);
+                } else if constexpr (Search != LINEAR_SEARCH) {
+                    position = std::lower_bound(keys, keys + n, key, comp) - keys;
+                } else {
+                    for (position = 0; position < n && comp(keys[position], key); ++position);
+                }
+                return {position, position < n && !comp(key, keys[position])};
+            }
+
+            void insert_at(uint16_t position, const K &key, const V &value) {
+                ASSERT(usage < CAPACITY);
+                std::memmove(keys + position + 1, keys + position, (usage - position) * sizeof(K));
+                std::memmove(values + position + 1, values + position, (usage - position) * sizeof(V));
+                new(keys + position) K(key);
+                new(values + position) V(value);
+                usage++;
+            }
+
+            void remove_at(uint16_t position) {
+                std::memmove(keys + position, keys + position + 1, (usage - position - 1) * sizeof(K));
+                std::memmove(values + position, values + position + 1, (usage - position - 1) * sizeof(V));
+                usage--;
+            }
+        };
+
+        template<typename K, typename V, unsigned Search, size_t B, typename Compare>
+        struct Internal : NodeBase<K, V, Search, B, Compare> {
+            using Node = NodeBase<K, V, Search, B, Compare>;
+            using Node::usage;
+            using Node::CAPACITY;
+
+            Node *children[2 * B];
+
+            Internal() : Node(false) {}
+
+            /* splits the full children[idx] around its middle entry, which moves up here */
+            template<typename Tree>
+            void split_child(uint16_t idx, Tree &tree) {
+                auto child = children[idx];
+                ASSERT(child->usage == CAPACITY && usage < CAPACITY);
+                Node *r = child->leaf ? tree.template allocate_node<Node>(true) : tree.template allocate_node<Internal>();
+                std::memcpy(r->keys, child->keys + B, (B - 1) * sizeof(K));
+                std::memcpy(r->values, child->values + B, (B - 1) * sizeof(V));
+                if (!child->leaf) {
+                    std::memcpy(r->as_internal()->children, child->as_internal()->children + B, B * sizeof(Node *));
+                }
+                r->usage = B - 1;
+                std::memmove(children + idx + 2, children + idx + 1, (usage - idx) * sizeof(Node *));
+                children[idx + 1] = r;
+                this->insert_at(idx, child->keys[B - 1], child->values[B - 1]);
+                child->usage = B - 1;
+            }
+
+            /* moves the last entry of children[idx - 1] up here and the separator down into children[idx] */
+            void rotate_right(uint16_t idx) {
+                auto from = children[idx - 1], to = children[idx];
+                to->insert_at(0, this->keys[idx - 1], this->values[idx - 1]);
+                if (!to->leaf) {
+                    auto target = to->as_internal();
+                    std::memmove(target->children + 1, target->children, to->usage * sizeof(Node *));
+                    target->children[0] = from->as_internal()->children[from->usage];
+                }
+                this->keys[idx - 1] = from->keys[from->usage - 1];
+                this->values[idx - 1] = from->values[from->usage - 1];
+                from->usage--;
+            }
+
+            /* moves the first entry of children[idx + 1] up here and the separator down into children[idx] */
+            void rotate_left(uint16_t idx) {
+                auto from = children[idx + 1], to = children[idx];
+                if (!to->leaf) {
+                    to->as_internal()->children[to->usage + 1] = from->as_internal()->children[0];
+                    auto source = from->as_internal();
+                    std::memmove(source->children, source->children + 1, from->usage * sizeof(Node *));
+                }
+                to->insert_at(to->usage, this->keys[idx], this->values[idx]);
+                this->keys[idx] = from->keys[0];
+                this->values[idx] = from->values[0];
+                from->remove_at(0);
+            }
+
+            /* folds separator `idx` and children[idx + 1] into children[idx]; returns the emptied right node */
+            Node *merge(uint16_t idx) {
+                auto left = children[idx], right = children[idx + 1];
+                ASSERT(left->usage + right->usage < CAPACITY);
+                left->insert_at(left->usage, this->keys[idx], this->values[idx]);
+                std::memcpy(left->keys + left->usage, right->keys, right->usage * sizeof(K));
+                std::memcpy(left->values + left->usage, right->values, right->usage * sizeof(V));
+                if (!left->leaf) {
+                    std::memcpy(left->as_internal()->children + left->usage, right->as_internal()->children,
+                                (right->usage + 1) * sizeof(Node *));
+                }
+                left->usage += right->usage;
+                this->remove_at(idx);
+                std::memmove(children + idx + 1, children + idx + 2, (usage - idx) * sizeof(Node *));
+                return right;
+            }
+        };
+    }
+
+    /*
+     * Thread-safe B-tree with optimistic lock coupling. Readers take no locks: they validate node versions on the
+     * way down and restart from the root when a writer got in between. Writers also descend optimistically and
+     * only lock the nodes they change, upgrading the versions they read. Insertion splits full nodes on the way
+     * down and erasure tops up minimal ones, so no change ever propagates upwards; after such a structural step
+     * the operation restarts. Unlinked nodes are reclaimed through epochs.
+     *
+     * Keys and values are handed out by copy. `size()` is exact once writers are quiescent; construction,
+     * destruction and `validate()` must not race with anything. `Alloc` must be safe to use from several threads.
+     */
+    template<typename K, typename V, unsigned Search, size_t B, typename Compare, typename Alloc>
+    class ConcurrentBTree {
+        using Node = __concurrent_impl::NodeBase<K, V, Search, B, Compare>;
+        using Internal = typename Node::Internal;
+        using Epochs = __concurrent_impl::Epochs<Node>;
+        using Guard = typename Epochs::Guard;
+        using CacheLine = __btree_impl::CacheLine;
+        using NodeAlloc = typename std::allocator_traits<Alloc>::template rebind_alloc<CacheLine>;
+        using NodeAllocTraits = std::allocator_traits<NodeAlloc>;
+
+        std::atomic<Node *> root;
+        std::atomic<size_t> count{0};
+        Epochs epochs;
+
+        [[no_unique_address]] NodeAlloc alloc;
+        [[no_unique_address]] Compare comp;
+
+        template<typename, typename, unsigned, size_t, typename>
+        friend struct __concurrent_impl::Internal;
+
+        template<typename T, typename... Args>
+        T *allocate_node(Args &&... args) {
+            static_assert(sizeof(T) % sizeof(CacheLine) == 0);
+            auto memory = NodeAllocTraits::allocate(alloc, sizeof(T) / sizeof(CacheLine));
+            return new(memory) T(std::forward<Args>(args)...);
+        }
+
+        void free_node(Node *node) {
+            if (node->leaf) {
+                std::destroy_at(node);
+                NodeAllocTraits::deallocate(alloc, reinterpret_cast<CacheLine *>(node), sizeof(Node) / sizeof(CacheLine));
+            } else {
+                std::destroy_at(node->as_internal());
+                NodeAllocTraits::deallocate(alloc, reinterpret_cast<CacheLine *>(node),
+                                            sizeof(Internal) / sizeof(CacheLine));
+            }
+        }
+
+        void release(Node *node) {
+            if (!node->leaf) {
+                for (size_t i = 0; i <= node->usage; ++i) {
+                    release(node->as_internal()->children[i]);
+                }
+            }
+            free_node(node);
+        }
+
+        void retire(Guard &guard, Node *node) {
+            epochs.retire(guard, node, [this](Node *i) { free_node(i); });
+        }
+
+        /* reads the root and its version, failing if the root was replaced meanwhile */
+        bool enter(Node *&node, uint64_t &v) {
+            node = root.load(std::memory_order_acquire);
+            return node->lock.read_lock(v) && node == root.load(std::memory_order_acquire);
+        }
+
+        /* steps from `node` to children[idx], failing if `node` changed before the child's version was read */
+        static bool descend(Node *&node, uint64_t &v, uint16_t idx) {
+            auto child = node->as_internal()->children[idx];
+            uint64_t cv;
+            if (!node->lock.validate(v) || !child->lock.read_lock(cv) || !node->lock.validate(v)) return false;
+            node = child;
+            v = cv;
+            return true;
+        }
+
+        /* the attempts below return false to be restarted from the root */
+
+        bool try_find(const K &key, std::optional<V> &result) {
+            Node *node;
+            uint64_t v;
+            if (!enter(node, v)) return false;
+            for (;;) {
+                auto [position, found] = node->search(key, comp);
+                if (found) {
+                    V value = node->values[position];
+                    if (!node->lock.validate(v)) return false;
+                    result = value;
+                    return true;
+                }
+                if (node->leaf) {
+                    result.reset();
+                    return node->lock.validate(v);
+                }
+                if (!descend(node, v, position)) return false;
+            }
+        }
+
+        bool try_insert(const K &key, const V &value, std::optional<V> &result) {
+            Node *node;
+            uint64_t v;
+            if (!enter(node, v)) return false;
+            if (node->usage == Node::CAPACITY) { // grow a new root above the full one
+                if (!node->lock.upgrade(v)) return false;
+                auto top = allocate_node<Internal>();
+                top->children[0] = node;
+                top->split_child(0, *this);
+                root.store(top, std::memory_order_release);
+                node->lock.unlock();
+                return false;
+            }
+            for (;;) {
+                auto [position, found] = node->search(key, comp);
+                if (found) {
+                    if (!node->lock.upgrade(v)) return false;
+                    result = node->values[position];
+                    node->values[position] = value;
+                    node->lock.unlock();
+                    return true;
+                }
+                if (node->leaf) {
+                    if (!node->lock.upgrade(v)) return false;
+                    node->insert_at(position, key, value); // full nodes never get this far
+                    node->lock.unlock();
+                    result.reset();
+                    return true;
+                }
+                auto parent = node;
+                auto pv = v;
+                if (!descend(node, v, position)) return false;
+                if (node->usage == Node::CAPACITY) {
+                    if (!parent->lock.upgrade(pv)) return false;
+                    if (!node->lock.upgrade(v)) {
+                        parent->lock.unlock();
+                        return false;
+                    }
+                    parent->as_internal()->split_child(position, *this);
+                    node->lock.unlock();
+                    parent->lock.unlock();
+                    return false;
+                }
+            }
+        }
+
+        /*
+         * Gives children[idx] of `node`, which is at the minimum, a spare entry by rotating one over from a sibling
+         * or merging it with one. `node` itself is the root or above the minimum, so it may lose a separator.
+         */
+        void top_up(Guard &guard, Node *node, uint64_t v, uint16_t idx, Node *child, uint64_t cv) {
+            auto parent = node->as_internal();
+            auto left = idx ? parent->children[idx - 1] : nullptr;
+            auto right = idx < node->usage ? parent->children[idx + 1] : nullptr;
+            uint64_t lv = 0, rv = 0;
+            if (!node->lock.validate(v)) return;
+            ASSERT(left || right);
+            if (left && !left->lock.read_lock(lv)) return;
+            if (right && !right->lock.read_lock(rv)) return;
+            if (!node->lock.validate(v)) return;
+            bool borrow_left = left && left->usage >= B;
+            bool borrow_right = !borrow_left && right && right->usage >= B;
+            auto sibling = borrow_left || !right ? left : right;
+            auto sv = sibling == left ? lv : rv;
+            if (!node->lock.upgrade(v)) return;
+            if (!child->lock.upgrade(cv)) {
+                node->lock.unlock();
+                return;
+            }
+            if (!sibling->lock.upgrade(sv)) {
+                child->lock.unlock();
+                node->lock.unlock();
+                return;
+            }
+            if (borrow_left) {
+                parent->rotate_right(idx);
+            } else if (borrow_right) {
+                parent->rotate_left(idx);
+            } else {
+                auto gone = parent->merge(sibling == left ? idx - 1 : idx);
+                (gone == child ? sibling : child)->lock.unlock();
+                gone->lock.unlock_obsolete();
+                node->lock.unlock();
+                retire(guard, gone);
+                return;
+            }
+            sibling->lock.unlock();
+            child->lock.unlock();
+            node->lock.unlock();
+        }
+
+        /*
+         * Erases separator `idx` of `node` by pulling up its predecessor or successor from the adjacent child that
+         * has an entry to spare, or merges the two children around it when neither has and restarts.
+         */
+        bool erase_separator(Guard &guard, Node *node, uint64_t v, uint16_t idx, std::optional<V> &result) {
+            auto parent = node->as_internal();
+            auto left = parent->children[idx], right = parent->children[idx + 1];
+            uint64_t lv, rv;
+            if (!node->lock.validate(v) || !left->lock.read_lock(lv) || !right->lock.read_lock(rv) ||
+                !node->lock.validate(v)) {
+                return false;
+            }
+            bool predecessor = left->usage >= B;
+            if (!predecessor && right->usage < B) {
+                if (!node->lock.upgrade(v)) return false;
+                if (!left->lock.upgrade(lv)) {
+                    node->lock.unlock();
+                    return false;
+                }
+                if (!right->lock.upgrade(rv)) {
+                    left->lock.unlock();
+                    node->lock.unlock();
+                    return false;
+                }
+                parent->merge(idx);
+                left->lock.unlock();
+                right->lock.unlock_obsolete();
+                node->lock.unlock();
+                retire(guard, right);
+                return false;
+            }
+            /*
+             * The entry comes from the far end of that subtree, whose key range shrinks or grows with the new
+             * separator all the way down; the whole spine gets locked so that nobody still routing by the old
+             * separator can pass it.
+             */
+            constexpr size_t MAX_HEIGHT = 64;
+            std::pair<Node *, uint64_t> spine[MAX_HEIGHT];
+            size_t depth = 0;
+            auto leaf = predecessor ? left : right;
+            auto fv = predecessor ? lv : rv;
+            spine[depth++] = {leaf, fv};
+            while (!leaf->leaf) {
+                auto above = leaf;
+                auto av = fv;
+                uint16_t next = predecessor ? leaf->usage : 0;
+                if (!descend(leaf, fv, next)) return false;
+                if (leaf->usage < B) {
+                    top_up(guard, above, av, next, leaf, fv);
+                    return false;
+                }
+                ASSERT(depth < MAX_HEIGHT);
+                spine[depth++] = {leaf, fv};
+            }
+            if (!node->lock.upgrade(v)) return false;
+            for (size_t i = 0; i < depth; ++i) {
+                if (!spine[i].first->lock.upgrade(spine[i].second)) {
+                    while (i--) spine[i].first->lock.unlock();
+                    node->lock.unlock();
+                    return false;
+                }
+            }
+            uint16_t from = predecessor ? leaf->usage - 1 : 0;
+            result = node->values[idx];
+            node->keys[idx] = leaf->keys[from];
+            node->values[idx] = leaf->values[from];
+            leaf->remove_at(from);
+            for (size_t i = 0; i < depth; ++i) {
+                spine[i].first->lock.unlock();
+            }
+            node->lock.unlock();
+            return true;
+        }
+
+        bool try_erase(Guard &guard, const K &key, std::optional<V> &result) {
+            Node *node;
+            uint64_t v;
+            if (!enter(node, v)) return false;
+            if (!node->leaf && node->usage == 0) { // a merge emptied the root: its only child takes over
+                if (!node->lock.upgrade(v)) return false;
+                root.store(node->as_internal()->children[0], std::memory_order_release);
+                node->lock.unlock_obsolete();
+                retire(guard, node);
+                return false;
+            }
+            for (;;) {
+                auto [position, found] = node->search(key, comp);
+                if (node->leaf) {
+                    if (!found) {
+                        result.reset();
+                        return node->lock.validate(v);
+                    }
+                    if (!node->lock.upgrade(v)) return false;
+                    result = node->values[position];
+                    node->remove_at(position); // minimal leaves were topped up on the way down
+                    node->lock.unlock();
+                    return true;
+                }
+                if (found) return erase_separator(guard, node, v, position, result);
+                auto parent = node;
+                auto pv = v;
+                if (!descend(node, v, position)) return false;
+                if (node->usage < B) {
+                    top_up(guard, parent, pv, position, node, v);
+                    return false;
+                }
+            }
+        }
+
+#ifdef DEBUG_MODE
+
+        /* every key below `node` must lie strictly between `lo` and `hi`; returns the height of the subtree */
+        size_t validate(Node *node, const K *lo, const K *hi, size_t &entries) {
+            ASSERT(node->lock.idle());
+            ASSERT(node == root.load() || node->usage >= B - 1);
+            ASSERT(node->usage <= Node::CAPACITY);
+            for (size_t i = 0; i < node->usage; ++i) {
+                ASSERT(!lo || comp(*lo, node->keys[i]));
+                ASSERT(!hi || comp(node->keys[i], *hi));
+                ASSERT(!i || comp(node->keys[i - 1], node->keys[i]));
+            }
+            entries += node->usage;
+            if (node->leaf) return 0;
+            size_t height = 0;
+            for (size_t i = 0; i <= node->usage; ++i) {
+                auto h = validate(node->as_internal()->children[i], i ? &node->keys[i - 1] : lo,
+                                  i < node->usage ? &node->keys[i] : hi, entries);
+                ASSERT(!i || h == height);
+                height = h;
+            }
+            return height + 1;
+        }
+
+#endif
+
+    public:
+        ConcurrentBTree(Compare comp = Compare(), const Alloc &alloc = Alloc()) : alloc(alloc), comp(comp) {
+            root.store(allocate_node<Node>(true));
+        }
+
+        ConcurrentBTree(const ConcurrentBTree &) = delete;
+
+        ConcurrentBTree &operator=(const ConcurrentBTree &) = delete;
+
+        ~ConcurrentBTree() {
+            epochs.drain([this](Node *i) { free_node(i); });
+            release(root.load());
+        }
+
+        /* returns the replaced value on a hit */
+        std::optional<V> insert(const K &key, const V &value) {
+            Guard guard(epochs);
+            std::optional<V> result;
+            while (!try_insert(key, value, result));
+            if (!result) count.fetch_add(1, std::memory_order_relaxed);
+            return result;
+        }
+
+        std::optional<V> find(const K &key) {
+            Guard guard(epochs);
+            std::optional<V> result;
+            while (!try_find(key, result));
+            return result;
+        }
+
+        bool member(const K &key) {
+            return find(key).has_value();
+        }
+
+        /* returns the erased value, if there was one */
+        std::optional<V> erase(const K &key) {
+            Guard guard(epochs);
+            std::optional<V> result;
+            while (!try_erase(guard, key, result));
+            if (result) count.fetch_sub(1, std::memory_order_relaxed);
+            return result;
+        }
+
+        size_t size() const {
+            return count.load(std::memory_order_relaxed);
+        }
+
+        bool empty() const {
+            return size() == 0;
+        }
+
+#ifdef DEBUG_MODE
+
+        /* checks occupancy, ordering, separator bounds, that all leaves sit at one depth and that nothing is locked */
+        void validate() {
+            size_t entries = 0;
+            validate(root.load(), nullptr, nullptr, entries);
+            ASSERT(entries == size());
+        }
+
+#endif
+    };
+}
+
+#undef keys
+#undef values
+#endif // CONCURRENT_BTREE_HPP
@@ -0,0 +1,251 @@
+#ifndef FROZEN_BTREE_HPP
+#define FROZEN_BTREE_HPP
+
+#include <btree.hpp>
+
+namespace btree {
+
+    /*
+     * Immutable search tree in the implicit S+tree layout, built once from a sorted tree by `freeze`. Keys sit in
+     * cache-line blocks of BLOCK keys; the bottom layer is simply all keys in order, and every layer above holds,
+     * for each block of (BLOCK + 1) children, the smallest key of children 1..BLOCK. A child is found by index
+     * arithmetic, not by pointer, and a descent compares one whole block per layer without branching on the
+     * keys. Values live apart, in key order, so the descent never touches them. Keys, layers and values share a
+     * single allocation. Block slots past the last key repeat the largest key; lookups beyond it stop early.
+     */
+    template<typename K, typename V, typename Compare = std::less<K>>
+    class FrozenBTree {
+        static constexpr bool USE_SIMD = __btree_impl::simd_searchable<K, Compare>;
+        static constexpr size_t BLOCK = std::max<size_t>(64 / sizeof(K), 4);
+        static constexpr size_t ALIGN = 64;
+        static_assert(!USE_SIMD || BLOCK % __btree_impl::SIMD_LANES<K> == 0);
+
+        static size_t blocks(size_t n) {
+            return (n + BLOCK - 1) / BLOCK;
+        }
+
+        /* keys of the layer above one of `n` keys: a block for every BLOCK + 1 blocks below */
+        static size_t keys_above(size_t n) {
+            return (blocks(n) + BLOCK) / (BLOCK + 1) * BLOCK;
+        }
+
+        size_t _size = 0;
+        size_t layers = 0;
+        std::vector<size_t> offsets; // first key of every layer, the sorted bottom one at 0
+        size_t slots = 0;            // keys in all layers, padding included
+        K *key_array = nullptr;
+        V *value_array = nullptr;
+        void *memory = nullptr;
+        [[no_unique_address]] Compare comp;
+
+        /* number of keys in the block at `block` that are less than `key` */
+        size_t rank(const K *block, const K &key) {
+            if constexpr (USE_SIMD) {
+                return __btree_impl::simd_lower_bound<BLOCK>(block, BLOCK, key);
+            } else {
+                size_t less = 0;
+                for (size_t i = 0; i < BLOCK; ++i) {
+                    less += comp(block[i], key);
+                }
+                return less;
+            }
+        }
+
+        /* position of the first key not less than `key` among the sorted keys, `_size` if there is none */
+        size_t lower_index(const K &key) {
+            if (!_size || comp(key_array[_size - 1], key)) return _size;
+            size_t k = 0;
+            for (size_t h = layers - 1; h; --h) {
+                k = k * (BLOCK + 1) + rank(key_array + offsets[h] + k, key) * BLOCK;
+            }
+            return k + rank(key_array + k, key);
+        }
+
+        /* lays out `_size` keys and values taken in order from `tree` */
+        template<typename Tree>
+        void build(Tree &tree) {
+            for (auto n = _size; ; n = keys_above(n)) {
+                offsets.push_back(slots);
+                slots += blocks(n) * BLOCK;
+                if (n <= BLOCK) break;
+            }
+            layers = offsets.size();
+            auto value_offset = (slots * sizeof(K) + alignof(V) - 1) / alignof(V) * alignof(V);
+            memory = ::operator new(value_offset + _size * sizeof(V), std::align_val_t(ALIGN));
+            key_array = static_cast<K *>(memory);
+            value_array = reinterpret_cast<V *>(static_cast<char *>(memory) + value_offset);
+            size_t i = 0;
+            for (auto entry : tree) {
+                new(key_array + i) K(entry.first);
+                new(value_array + i) V(entry.second);
+                i++;
+            }
+            ASSERT(i == _size);
+            auto &largest = key_array[_size - 1];
+            std::uninitialized_fill(key_array + _size, key_array + blocks(_size) * BLOCK, largest);
+            for (size_t h = 1; h < layers; ++h) {
+                for (size_t j = offsets[h]; j < (h + 1 < layers ? offsets[h + 1] : slots); ++j) {
+                    auto at = j - offsets[h];
+                    auto child = at / BLOCK * (BLOCK + 1) + at % BLOCK + 1; // right of the key, then leftmost down
+                    for (size_t l = 1; l < h; ++l) child *= BLOCK + 1;
+                    new(key_array + j) K(child * BLOCK < _size ? key_array[child * BLOCK] : largest);
+                }
+            }
+        }
+
+    public:
+        /* position in key order; entries are adjacent, so stepping is plain index arithmetic */
+        class iterator {
+            FrozenBTree *tree = nullptr;
+            size_t idx = 0;
+
+            friend class FrozenBTree;
+
+            iterator(FrozenBTree *tree, size_t idx) : tree(tree), idx(idx) {}
+
+        public:
+            iterator() = default;
+
+            inline bool operator!=(const iterator &that) const noexcept {
+                return idx != that.idx;
+            }
+
+            inline bool operator==(const iterator &that) const noexcept {
+                return idx == that.idx;
+            }
+
+            iterator &operator++() {
+                idx++;
+                return *this;
+            }
+
+            iterator operator++(int) {
+                auto old = *this;
+                idx++;
+                return old;
+            }
+
+            iterator &operator--() {
+                idx--;
+                return *this;
+            }
+
+            std::pair<const K &, const V &> operator*() const {
+                return {tree->key_array[idx], tree->value_array[idx]};
+            }
+        };
+
+        /* the entries of `tree`, which must iterate in strictly increasing order by `comp` */
+        template<typename Tree>
+        static FrozenBTree freeze(Tree &tree, Compare comp = Compare()) {
+            FrozenBTree frozen(comp);
+            frozen._size = tree.size();
+            if (frozen._size) frozen.build(tree);
+            return frozen;
+        }
+
+        explicit FrozenBTree(Compare comp = Compare()) : comp(comp) {}
+
+        FrozenBTree(FrozenBTree &&that) noexcept
+                : _size(std::exchange(that._size, 0)), layers(std::exchange(that.layers, 0)),
+                  offsets(std::move(that.offsets)), slots(std::exchange(that.slots, 0)),
+                  key_array(std::exchange(that.key_array, nullptr)), value_array(std::exchange(that.value_array, nullptr)),
+                  memory(std::exchange(that.memory, nullptr)), comp(std::move(that.comp)) {}
+
+        FrozenBTree &operator=(FrozenBTree &&that) noexcept {
+            if (this != &that) {
+                FrozenBTree moved(std::move(that));
+                swap(moved);
+            }
+            return *this;
+        }
+
+        FrozenBTree(const FrozenBTree &) = delete;
+
+        FrozenBTree &operator=(const FrozenBTree &) = delete;
+
+        void swap(FrozenBTree &that) noexcept {
+            using std::swap;
+            swap(_size, that._size);
+            swap(layers, that.layers);
+            swap(offsets, that.offsets);
+            swap(slots, that.slots);
+            swap(key_array, that.key_array);
+            swap(value_array, that.value_array);
+            swap(memory, that.memory);
+            swap(comp, that.comp);
+        }
+
+        ~FrozenBTree() {
+            if (!memory) return;
+            std::destroy(key_array, key_array + slots);
+            std::destroy(value_array, value_array + _size);
+            ::operator delete(memory, std::align_val_t(ALIGN));
+        }
+
+#ifdef DEBUG_MODE
+
+        /* checks the order of the bottom layer and every key of the layers above against the rule it was built by */
+        void validate() {
+            if (!_size) {
+                ASSERT(!memory);
+                return;
+            }
+            for (size_t i = 1; i < _size; ++i) {
+                ASSERT(comp(key_array[i - 1], key_array[i]));
+            }
+            auto &largest = key_array[_size - 1];
+            for (size_t i = _size; i < blocks(_size) * BLOCK; ++i) {
+                ASSERT(!comp(key_array[i], largest) && !comp(largest, key_array[i]));
+            }
+            for (size_t h = 1; h < layers; ++h) {
+                for (size_t j = offsets[h]; j < (h + 1 < layers ? offsets[h + 1] : slots); ++j) {
+                    auto at = j - offsets[h];
+                    auto child = at / BLOCK * (BLOCK + 1) + at % BLOCK + 1;
+                    for (size_t l = 1; l < h; ++l) child *= BLOCK + 1;
+                    auto &expected = child * BLOCK < _size ? key_array[child * BLOCK] : largest;
+                    ASSERT(!comp(key_array[j], expected) && !comp(expected, key_array[j]));
+                }
+            }
+        }
+
+#endif
+
+        bool empty() const {
+            return _size == 0;
+        }
+
+        size_t size() const {
+            return _size;
+        }
+
+        bool member(const K &key) {
+            auto i = lower_index(key);
+            return i < _size && !comp(key, key_array[i]);
+        }
+
+        iterator lower_bound(const K &key) {
+            return iterator(this, lower_index(key));
+        }
+
+        iterator upper_bound(const K &key) {
+            auto i = lower_index(key);
+            return iterator(this, i + (i < _size && !comp(key, key_array[i])));
+        }
+
+        iterator find(const K &key) {
+            auto i = lower_index(key);
+            return iterator(this, i < _size && !comp(key, key_array[i]) ? i : _size);
+        }
+
+        iterator begin() {
+            return iterator(this, 0);
+        }
+
+        iterator end() {
+            return iterator(this, _size);
+        }
+    };
+}
+
+#endif // FROZEN_BTREE_HPP
@@ -0,0 +1,422 @@
+#ifndef MAPPED_BTREE_HPP
+#define MAPPED_BTREE_HPP
+
+#include <btree.hpp>
+#include <array>
+#include <cstdio>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define keys node_keys()
+#define values node_values()
+
+namespace btree {
+
+    template<typename K, typename V, unsigned Search = BINARY_SEARCH, size_t B = DEFAULT_BTREE_FACTOR, typename Compare = std::less<K>>
+    class MappedBTree;
+
+    namespace __mapped_impl {
+
+        /* first bytes of an image; the rest of the header pins down the layout the nodes were written with */
+        struct alignas(64) Header {
+            char magic[8];
+            uint32_t key_size;
+            uint32_t value_size;
+            uint32_t key_slots;
+            uint32_t factor;
+            uint64_t size;
+            uint64_t height;
+            uint64_t root; // offset of the root node, 0 for an empty tree
+        };
+
+        static constexpr char MAGIC[8] = {'B', 'T', 'I', 'M', 'A', 'G', 'E', '1'};
+
+        /*
+         * Node as it lies in an image: the key/value layout of `BTree` nodes, no parent link, and children given
+         * as byte offsets from the start of the image, so the file can be mapped at any address and searched in
+         * place. Nodes are packed full; only the last node of each level may hold fewer entries, down to none.
+         */
+        template<typename K, typename V, unsigned Search, size_t B, typename Compare>
+        struct alignas(64) Node {
+            static_assert(B > 2, "B is too small");
+            static_assert(2 * B < (1u << 16u), "B is too large");
+            using KeyBlock = std::aligned_storage_t<sizeof(K), alignof(K)>;
+            using ValueBlock = std::aligned_storage_t<sizeof(V), alignof(V)>;
+            static constexpr bool USE_SIMD = Search == SIMD_SEARCH && __btree_impl::simd_searchable<K, Compare>;
+            static constexpr size_t KEY_SLOTS = USE_SIMD ?
+                                                (2 * B - 1 + __btree_impl::SIMD_LANES<K> - 1) /
+                                                __btree_impl::SIMD_LANES<K> * __btree_impl::SIMD_LANES<K> :
+                                                2 * B - 1;
+
+            uint16_t usage;
+            bool leaf;
+
+            KeyBlock __keys[KEY_SLOTS];
+            ValueBlock __values[2 * B - 1];
+
+            inline const K *node_keys() const {
+                return reinterpret_cast<const K *>(__keys);
+            }
+
+            inline const V *node_values() const {
+                return reinterpret_cast<const V *>(__values);
+            }
+
+            inline const K &key_at(size_t i) const {
+                return keys[i];
+            }
+
+            inline const V &value_at(size_t i) const {
+                return values[i];
+            }
+
+            /* position of the first key not less than `key`, and whether it is `key` */
+            inline std::pair<uint16_t, bool> search(const K &key, Compare &comp) const {
+                uint16_t position;
+                if constexpr (USE_SIMD) {
+                    position = __btree_impl::simd_lower_bound<KEY_SLOTS>(keys, usage, key);
+                } else if constexpr (Search != LINEAR_SEARCH) {
+                    position = std::lower_bound(keys, keys + usage, key, comp) - keys;
+                } else {
+                    for (position = 0; position < usage && comp(keys[position], key); ++position);
+                }
+                return {position, position < usage && !comp(key, keys[position])};
+            }
+        };
+
+        template<typename K, typename V, unsigned Search, size_t B, typename Compare>
+        struct alignas(64) Internal : Node<K, V, Search, B, Compare> {
+            uint64_t children[2 * B];
+        };
+    }
+
+    /*
+     * Read-only B-tree served straight from a file mapping. `save_image` streams any tree, sorted by `Compare`,
+     * into a file of packed nodes linked by offsets; `map_image` maps such a file and searches and iterates it in
+     * place, without reading it in first: pages are faulted in as lookups touch them. Keys and values must be
+     * trivially copyable, and an image is only valid on machines with the same type layout. To write, `thaw()`
+     * the mapping into a `BTree`, which copies the entries out in one linear pass.
+     */
+    template<typename K, typename V, unsigned Search, size_t B, typename Compare>
+    class MappedBTree {
+        static_assert(std::is_trivially_copyable_v<K> && std::is_trivially_copyable_v<V>,
+                      "images hold raw bytes of keys and values");
+        using Header = __mapped_impl::Header;
+        using Node = __mapped_impl::Node<K, V, Search, B, Compare>;
+        using Internal = __mapped_impl::Internal<K, V, Search, B, Compare>;
+
+        /* levels of the tallest image that fits in memory: 2^58 entries, one per level on the right spine */
+        static constexpr size_t MAX_HEIGHT = [] {
+            size_t height = 2;
+            for (long double reach = 2 * B - 1; reach < 0x1p58L; reach *= 2 * B) height++;
+            return height;
+        }();
+
+        const char *base = nullptr;
+        size_t length = 0;
+        size_t _size = 0;
+        size_t height = 0;
+        const Node *root = nullptr;
+        [[no_unique_address]] Compare comp;
+
+        MappedBTree(Compare comp) : comp(comp) {}
+
+        friend __btree_impl::PathIterator<MappedBTree, const Node, K, V, MAX_HEIGHT>;
+
+        const Node *child(const Node *node, size_t i) const {
+            return reinterpret_cast<const Node *>(base + static_cast<const Internal *>(node)->children[i]);
+        }
+
+        /*
+         * Appends nodes to an image as entries arrive in order. Each level keeps the node it is filling; a full
+         * leaf is written out when the next entry comes, which then goes up as the separator after it.
+         */
+        class Writer {
+            std::FILE *file;
+            uint64_t cursor = sizeof(Header);
+            std::vector<Internal> levels; // levels[0] is the leaf, in the key/value prefix of its slot
+            bool failed = false;
+
+            uint64_t write(Node &node, size_t h) {
+                auto size = h ? sizeof(Internal) : sizeof(Node);
+                failed |= std::fwrite(&node, size, 1, file) != 1;
+                auto at = cursor;
+                cursor += size;
+                node.usage = 0;
+                return at;
+            }
+
+            static void place(Node &node, const K &key, const V &value) {
+                std::memcpy(&node.__keys[node.usage], &key, sizeof(K));
+                std::memcpy(&node.__values[node.usage], &value, sizeof(V));
+                node.usage++;
+            }
+
+            Internal &level(size_t h) {
+                if (h == levels.size()) {
+                    levels.emplace_back();
+                    std::memset(&levels.back(), 0, sizeof(Internal));
+                    levels.back().leaf = !h;
+                }
+                return levels[h];
+            }
+
+        public:
+            size_t size = 0;
+
+            explicit Writer(std::FILE *file) : file(file) {
+                Header blank{};
+                failed |= std::fwrite(&blank, sizeof(Header), 1, file) != 1;
+                levels.reserve(MAX_HEIGHT);
+                level(0);
+            }
+
+            void push(const K &key, const V &value) {
+                size++;
+                if (levels[0].usage < 2 * B - 1) {
+                    place(levels[0], key, value);
+                    return;
+                }
+                auto below = write(levels[0], 0);
+                for (size_t h = 1;; ++h) {
+                    auto &node = level(h);
+                    node.children[node.usage] = below;
+                    if (node.usage < 2 * B - 1) {
+                        place(node, key, value);
+                        return;
+                    }
+                    below = write(node, h);
+                }
+            }
+
+            /* writes the unfinished node of every level and then the header; false if any write failed */
+            bool finish() {
+                Header header{};
+                std::memcpy(header.magic, __mapped_impl::MAGIC, sizeof(header.magic));
+                header.key_size = sizeof(K);
+                header.value_size = sizeof(V);
+                header.key_slots = Node::KEY_SLOTS;
+                header.factor = B;
+                header.size = size;
+                if (size) {
+                    auto top = levels.size() - 1;
+                    auto below = write(levels[0], 0);
+                    for (size_t h = 1; h <= top; ++h) {
+                        levels[h].children[levels[h].usage] = below;
+                        below = write(levels[h], h);
+                    }
+                    header.height = top;
+                    header.root = below;
+                }
+                failed |= std::fseek(file, 0, SEEK_SET) != 0;
+                failed |= std::fwrite(&header, sizeof(Header), 1, file) != 1;
+                return !failed;
+            }
+        };
+
+        /*
+         * Whether the subtree at `offset` can be walked without leaving the mapping: every node lies inside it,
+         * aligned, with a leaf tag matching its level and at most 2B - 1 entries, and children written before their
+         * parent in increasing order, as `Writer` lays them out. `budget` is the number of nodes that fit in the
+         * file, so a corrupted image that reuses nodes cannot make the check run longer than a read of the file.
+         */
+        bool well_formed(uint64_t offset, size_t h, uint64_t parent, size_t &count, size_t &budget) const {
+            auto bytes = h ? sizeof(Internal) : sizeof(Node);
+            if (!budget-- || offset < sizeof(Header) || offset % alignof(Node) || offset >= parent ||
+                bytes > length - offset) {
+                return false;
+            }
+            auto node = reinterpret_cast<const Node *>(base + offset);
+            uint8_t tag;
+            std::memcpy(&tag, &node->leaf, 1); // a corrupted tag need not be a valid bool
+            if (tag != !h || node->usage > 2 * B - 1) return false;
+            count += node->usage;
+            if (!h) return true;
+            auto children = static_cast<const Internal *>(node)->children;
+            for (size_t i = 0; i <= node->usage; ++i) {
+                if (i && children[i] <= children[i - 1]) return false;
+                if (!well_formed(children[i], h - 1, offset, count, budget)) return false;
+            }
+            return true;
+        }
+
+#ifdef DEBUG_MODE
+
+        /* every key below `node` must lie strictly between `lo` and `hi` */
+        void validate(const Node *node, size_t h, const K *lo, const K *hi, size_t &count) {
+            ASSERT(node->leaf == !h);
+            ASSERT(node->usage <= 2 * B - 1);
+            for (size_t i = 0; i < node->usage; ++i) {
+                ASSERT(!lo || comp(*lo, node->keys[i]));
+                ASSERT(!hi || comp(node->keys[i], *hi));
+                ASSERT(!i || comp(node->keys[i - 1], node->keys[i]));
+            }
+            count += node->usage;
+            if (!h) return;
+            for (size_t i = 0; i <= node->usage; ++i) {
+                validate(child(node, i), h - 1, i ? &node->keys[i - 1] : lo, i < node->usage ? &node->keys[i] : hi,
+                         count);
+            }
+        }
+
+    public:
+        void validate() {
+            if (!root) {
+                ASSERT(_size == 0 && height == 0);
+                return;
+            }
+            size_t count = 0;
+            validate(root, height, nullptr, nullptr, count);
+            ASSERT(count == _size);
+        }
+
+#endif
+    public:
+        /* in-order position held as the path from the root, as in `PersistentBTree` */
+        using iterator = __btree_impl::PathIterator<MappedBTree, const Node, K, V, MAX_HEIGHT>;
+
+        MappedBTree(MappedBTree &&that) noexcept
+                : base(std::exchange(that.base, nullptr)), length(std::exchange(that.length, 0)),
+                  _size(std::exchange(that._size, 0)), height(std::exchange(that.height, 0)),
+                  root(std::exchange(that.root, nullptr)), comp(std::move(that.comp)) {}
+
+        MappedBTree &operator=(MappedBTree &&that) noexcept {
+            if (this != &that) {
+                MappedBTree moved(std::move(that));
+                swap(moved);
+            }
+            return *this;
+        }
+
+        MappedBTree(const MappedBTree &) = delete;
+
+        MappedBTree &operator=(const MappedBTree &) = delete;
+
+        void swap(MappedBTree &that) noexcept {
+            using std::swap;
+            swap(base, that.base);
+            swap(length, that.length);
+            swap(_size, that._size);
+            swap(height, that.height);
+            swap(root, that.root);
+            swap(comp, that.comp);
+        }
+
+        ~MappedBTree() {
+            if (base) munmap(const_cast<char *>(base), length);
+        }
+
+        /* writes the entries of `tree`, which must iterate in strictly increasing order, as an image at `path` */
+        template<typename Tree>
+        static bool save_image(Tree &tree, const char *path) {
+            auto file = std::fopen(path, "wb");
+            if (!file) return false;
+            Writer writer(file);
+            for (auto i : tree) {
+                writer.push(i.first, i.second);
+            }
+            auto written = writer.finish();
+            return std::fclose(file) == 0 && written;
+        }
+
+        /*
+         * Maps the image at `path` read-only; empty if it cannot be opened, was written with another layout, or is
+         * truncated or corrupted. Every node is checked once here, so lookups need no bounds checks; this reads the
+         * whole file once, sequentially.
+         */
+        static std::optional<MappedBTree> map_image(const char *path, Compare comp = Compare()) {
+            auto fd = open(path, O_RDONLY);
+            if (fd < 0) return std::nullopt;
+            struct stat info{};
+            auto mapped = fstat(fd, &info) == 0 && size_t(info.st_size) >= sizeof(Header) ?
+                          mmap(nullptr, info.st_size, PROT_READ, MAP_SHARED, fd, 0) : MAP_FAILED;
+            close(fd);
+            if (mapped == MAP_FAILED) return std::nullopt;
+            MappedBTree tree(comp);
+            tree.base = static_cast<const char *>(mapped);
+            tree.length = info.st_size;
+            auto header = reinterpret_cast<const Header *>(tree.base);
+            if (std::memcmp(header->magic, __mapped_impl::MAGIC, sizeof(header->magic)) != 0 ||
+                header->key_size != sizeof(K) || header->value_size != sizeof(V) ||
+                header->key_slots != Node::KEY_SLOTS || header->factor != B || header->height >= MAX_HEIGHT ||
+                (!header->size && header->height)) {
+                return std::nullopt;
+            }
+            if (header->size) {
+                size_t count = 0, budget = tree.length / sizeof(Node);
+                if (!tree.well_formed(header->root, header->height, tree.length, count, budget) ||
+                    count != header->size) {
+                    return std::nullopt;
+                }
+            }
+            tree._size = header->size;
+            tree.height = header->height;
+            if (header->size) tree.root = reinterpret_cast<const Node *>(tree.base + header->root);
+            return tree;
+        }
+
+        /* copies every entry into a fresh `BTree`, built bottom-up in one pass */
+        template<typename Alloc = std::allocator<std::pair<const K, V>>, unsigned Options = NO_OPTIONS>
+        BTree<K, V, Search, B, Compare, Alloc, Options> thaw(const Alloc &alloc = Alloc()) {
+            return BTree<K, V, Search, B, Compare, Alloc, Options>::from_sorted(begin(), end(), 1.0, comp, alloc);
+        }
+
+        bool empty() const {
+            return _size == 0;
+        }
+
+        size_t size() const {
+            return _size;
+        }
+
+        bool member(const K &key) {
+            for (auto [node, h] = std::pair(root, height); node; --h) {
+                auto [position, found] = node->search(key, comp);
+                if (found) return true;
+                if (!h) return false;
+                node = child(node, position);
+            }
+            return false;
+        }
+
+        iterator lower_bound(const K &key) {
+            iterator iter(this);
+            for (auto [node, h] = std::pair(root, height); node; --h) {
+                auto [position, found] = node->search(key, comp);
+                iter.push(node, position);
+                if (found || !h) break;
+                node = child(node, position);
+            }
+            iter.settle();
+            return iter;
+        }
+
+        iterator upper_bound(const K &key) {
+            auto iter = lower_bound(key);
+            if (iter != end() && !comp(key, (*iter).first)) ++iter;
+            return iter;
+        }
+
+        iterator find(const K &key) {
+            auto iter = lower_bound(key);
+            if (iter != end() && comp(key, (*iter).first)) return end();
+            return iter;
+        }
+
+        iterator begin() {
+            iterator iter(this);
+            if (root) iter.descend_first(root);
+            return iter;
+        }
+
+        iterator end() {
+            return iterator(this);
+        }
+    };
+}
+
+#undef keys
+#undef values
+#endif // MAPPED_BTREE_HPP
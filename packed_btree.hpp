@@ -0,0 +1,626 @@
+#ifndef PACKED_BTREE_HPP
+#define PACKED_BTREE_HPP
+
+#include <btree.hpp>
+#include <limits>
+
+namespace btree {
+
+    namespace __packed_impl {
+
+        /* number of lanes in [lanes, lanes + usage) less than `probe`; lanes up to the next vector are all ones */
+        template<typename Lane>
+        inline uint16_t count_less(const Lane *lanes, uint16_t usage, Lane probe) {
+            constexpr size_t LANES = __btree_impl::SIMD_BYTES / sizeof(Lane);
+            typedef Lane Vec __attribute__((vector_size(__btree_impl::SIMD_BYTES)));
+            typedef std::make_signed_t<Lane> Mask __attribute__((vector_size(__btree_impl::SIMD_BYTES)));
+            Vec broadcast;
+            Mask count = {};
+            for (size_t i = 0; i < LANES; ++i) {
+                broadcast[i] = probe;
+            }
+            for (size_t at = 0; at < usage; at += LANES) {
+                Vec chunk;
+                std::memcpy(&chunk, lanes + at, sizeof(Vec));
+                count += chunk < broadcast;
+            }
+            int total = 0;
+            for (size_t i = 0; i < LANES; ++i) {
+                total -= count[i];
+            }
+            return uint16_t(total);
+        }
+
+        /*
+         * Up to Capacity entries in frame-of-reference form: the smallest key in full as `base`, and for each key
+         * its distance from `base` in a lane of 1, 2, 4 or 8 bytes, as narrow as the largest distance allows.
+         * Lanes past `usage` are all ones, so a vector compare may run over whole vectors without masking. The lanes
+         * follow the leaf in the same allocation, sized for `room` bytes a lane, so a leaf search reads one block
+         * and a leaf of narrow lanes is that much smaller. A leaf whose keys need wider lanes than its room is moved
+         * to a larger block by the tree; see `make` and `resized`.
+         */
+        template<typename K, typename V, size_t Capacity>
+        struct alignas(64) Leaf {
+            using U = std::make_unsigned_t<K>;
+            using ValueBlock = std::aligned_storage_t<sizeof(V), alignof(V)>;
+            static_assert(Capacity % (__btree_impl::SIMD_BYTES / sizeof(uint8_t)) == 0);
+            static_assert(Capacity / __btree_impl::SIMD_BYTES < 128, "lane counts would overflow");
+
+            K base{};
+            uint16_t usage = 0;
+            uint8_t width = 0; // bytes per lane
+            uint8_t room;      // bytes per lane allocated after the leaf, at least `width`
+            Leaf *prev = nullptr;
+            Leaf *next = nullptr;
+            ValueBlock __values[Capacity];
+
+            static uint8_t width_for(U delta) {
+                if (delta <= 0xFFu) return 1;
+                if (delta <= 0xFFFFu) return 2;
+                if (delta <= 0xFFFFFFFFu) return 4;
+                return 8;
+            }
+
+            inline V *value_slots() {
+                return reinterpret_cast<V *>(__values);
+            }
+
+            inline const V *value_slots() const {
+                return reinterpret_cast<const V *>(__values);
+            }
+
+            /* the lanes, right after the leaf; `sizeof(Leaf)` is a multiple of 64, so they start on a cache line */
+            inline unsigned char *deltas() const {
+                return reinterpret_cast<unsigned char *>(const_cast<Leaf *>(this + 1));
+            }
+
+            /* calls `f` with the lanes typed by the current width */
+            template<typename F>
+            decltype(auto) with_lanes(F &&f) const {
+                auto deltas = this->deltas();
+                switch (width) {
+                    case 1:
+                        return f(reinterpret_cast<uint8_t *>(deltas));
+                    case 2:
+                        return f(reinterpret_cast<uint16_t *>(deltas));
+                    case 4:
+                        return f(reinterpret_cast<uint32_t *>(deltas));
+                    default:
+                        return f(reinterpret_cast<uint64_t *>(deltas));
+                }
+            }
+
+            inline U delta_at(size_t i) const {
+                return with_lanes([&](auto lanes) { return U(lanes[i]); });
+            }
+
+            inline K key_at(size_t i) const {
+                return K(U(base) + delta_at(i));
+            }
+
+            /* number of keys less than `key`, compared as distances from `base` in the packed lanes */
+            uint16_t search(K key) const {
+                if (key < base) return 0;
+                U delta = U(key) - U(base);
+                return with_lanes([&](auto lanes) -> uint16_t {
+                    using Lane = std::remove_pointer_t<decltype(lanes)>;
+                    if constexpr (sizeof(Lane) < sizeof(U)) {
+                        if (delta > std::numeric_limits<Lane>::max()) return usage;
+                    }
+                    return count_less(lanes, usage, Lane(delta));
+                });
+            }
+
+            /* writes every key in full to `out`; a widening add per lane, which the compiler vectorizes */
+            void decode(K *out) const {
+                with_lanes([&](auto lanes) {
+                    for (size_t i = 0; i < usage; ++i) {
+                        out[i] = K(U(base) + U(lanes[i]));
+                    }
+                });
+            }
+
+            /* packs the `n` sorted keys at `in` afresh, picking the lane width their span needs, within `room` */
+            void encode(const K *in, uint16_t n) {
+                ASSERT(n && n <= Capacity);
+                base = in[0];
+                usage = n;
+                width = width_for(U(in[n - 1]) - U(base));
+                ASSERT(width <= room);
+                std::memset(deltas(), 0xFF, Capacity * width);
+                with_lanes([&](auto lanes) {
+                    using Lane = std::remove_pointer_t<decltype(lanes)>;
+                    for (size_t i = 0; i < n; ++i) {
+                        lanes[i] = Lane(U(in[i]) - U(base));
+                    }
+                });
+            }
+
+            /* lane width needed once `key` joins the keys here */
+            uint8_t width_with(K key) const {
+                if (!usage) return 1;
+                auto last = key_at(usage - 1);
+                return width_for(U(std::max(key, last)) - U(std::min(key, base)));
+            }
+
+            /* shifts lanes in place when the key keeps `base` and fits the width, and repacks otherwise */
+            template<typename... Args>
+            void emplace(uint16_t position, K key, Args &&... args) {
+                ASSERT(usage < Capacity);
+                __btree_impl::uninitialized_move_back(value_slots() + position, value_slots() + usage);
+                new(value_slots() + position) V(std::forward<Args>(args)...);
+                if (usage && !(key < base) && width_for(U(key) - U(base)) <= width) {
+                    with_lanes([&](auto lanes) {
+                        using Lane = std::remove_pointer_t<decltype(lanes)>;
+                        std::memmove(lanes + position + 1, lanes + position, (usage - position) * sizeof(Lane));
+                        lanes[position] = Lane(U(key) - U(base));
+                    });
+                    usage++;
+                    return;
+                }
+                K buffer[Capacity];
+                decode(buffer);
+                std::copy_backward(buffer + position, buffer + usage, buffer + usage + 1);
+                buffer[position] = key;
+                encode(buffer, usage + 1);
+            }
+
+            /* drops the entry at `position`; losing the first key moves `base` and repacks */
+            std::pair<K, V> remove(uint16_t position) {
+                std::pair<K, V> result(key_at(position), std::move(value_slots()[position]));
+                std::destroy_at(value_slots() + position);
+                __btree_impl::uninitialized_move_forward(value_slots() + position + 1, value_slots() + usage);
+                if (!position && usage > 1) {
+                    K buffer[Capacity];
+                    decode(buffer);
+                    encode(buffer + 1, usage - 1);
+                    return result;
+                }
+                with_lanes([&](auto lanes) {
+                    using Lane = std::remove_pointer_t<decltype(lanes)>;
+                    std::memmove(lanes + position, lanes + position + 1, (usage - position - 1) * sizeof(Lane));
+                    lanes[usage - 1] = Lane(~Lane(0));
+                });
+                usage--;
+                return result;
+            }
+
+            explicit Leaf(uint8_t room) : room(room) {
+#ifdef DEBUG_MODE
+                alive_node++;
+#endif
+            }
+
+            ~Leaf() {
+#ifdef DEBUG_MODE
+                alive_node--;
+#endif
+                std::destroy(value_slots(), value_slots() + usage);
+            }
+
+            /* an empty, unlinked leaf with lanes of up to `room` bytes */
+            static Leaf *make(uint8_t room) {
+                auto bytes = sizeof(Leaf) + Capacity * room;
+                return new(::operator new(bytes, std::align_val_t(alignof(Leaf)))) Leaf(room);
+            }
+
+            static void destroy(Leaf *leaf) {
+                leaf->~Leaf();
+                ::operator delete(leaf, std::align_val_t(alignof(Leaf)));
+            }
+
+            /* a copy of the lanes and values in a block of just the room they need, unlinked */
+            static Leaf *copy(const Leaf &that) {
+                auto leaf = make(that.width);
+                leaf->base = that.base;
+                leaf->width = that.width;
+                std::memcpy(leaf->deltas(), that.deltas(), Capacity * that.width);
+                std::uninitialized_copy(that.value_slots(), that.value_slots() + that.usage, leaf->value_slots());
+                leaf->usage = that.usage;
+                return leaf;
+            }
+
+            /* moves the contents of `leaf` into a block of `room` bytes a lane and frees it; links are copied as is */
+            static Leaf *resized(Leaf *leaf, uint8_t room) {
+                ASSERT(leaf->width <= room);
+                auto fresh = make(room);
+                fresh->base = leaf->base;
+                fresh->width = leaf->width;
+                fresh->prev = leaf->prev;
+                fresh->next = leaf->next;
+                std::memcpy(fresh->deltas(), leaf->deltas(), Capacity * leaf->width);
+                std::uninitialized_move(leaf->value_slots(), leaf->value_slots() + leaf->usage, fresh->value_slots());
+                fresh->usage = leaf->usage;
+                destroy(leaf);
+                return fresh;
+            }
+        };
+    }
+
+    /*
+     * Map from integral keys to `V` whose leaves store keys in frame-of-reference form: each leaf of up to 64
+     * entries keeps its smallest key in full and every key as a distance from it, in lanes only as wide as the
+     * largest distance needs. Dense runs such as sequential IDs or timestamps take 1 or 2 bytes a key instead of
+     * 8, and a leaf search is a vector compare over the packed lanes, without unpacking them. The leaves are
+     * chained and routed by a `BTree` over their smallest keys, so the levels above hold keys at full width.
+     * Keys are ordered by `<` only. Dereferencing an iterator yields the key by value, as it is not stored as such.
+     */
+    template<typename K, typename V, unsigned Search = BINARY_SEARCH, size_t B = DEFAULT_BTREE_FACTOR>
+    class PackedBTree {
+        static_assert(std::is_integral_v<K> && !std::is_same_v<K, bool>, "leaves pack integral keys only");
+        static constexpr size_t CAPACITY = 64;
+        using Leaf = __packed_impl::Leaf<K, V, CAPACITY>;
+        using U = typename Leaf::U;
+        using Index = BTree<K, Leaf *, Search, B>;
+
+        Index index; // the smallest key of every leaf
+        Leaf *head = nullptr;
+        Leaf *tail = nullptr;
+        size_t _size = 0;
+
+        /* the last leaf whose smallest key is not greater than `key`, or the first leaf */
+        Leaf *route(const K &key) {
+            auto at = index.lower_bound(key);
+            if (!(at != index.end())) return tail;
+            auto leaf = (*at).second;
+            return leaf->base == key || !leaf->prev ? leaf : leaf->prev;
+        }
+
+        /* the index orders leaves by their smallest keys, which may be rewritten in place while they keep the order */
+        void rebase(const K &old, Leaf *leaf) {
+            const_cast<K &>((*index.find(old)).first) = leaf->base;
+        }
+
+        /* moves `leaf` to a block of `room` bytes a lane and repoints its neighbours and its index entry */
+        Leaf *reroom(Leaf *leaf, uint8_t room) {
+            auto at = index.find(leaf->base);
+            auto fresh = Leaf::resized(leaf, room);
+            if (fresh->prev) fresh->prev->next = fresh;
+            else head = fresh;
+            if (fresh->next) fresh->next->prev = fresh;
+            else tail = fresh;
+            (*at).second = fresh;
+            return fresh;
+        }
+
+        void link_back(Leaf *leaf) {
+            leaf->prev = tail;
+            if (tail) tail->next = leaf;
+            else head = leaf;
+            tail = leaf;
+        }
+
+        void unlink(Leaf *leaf) {
+            if (leaf->prev) leaf->prev->next = leaf->next;
+            else head = leaf->next;
+            if (leaf->next) leaf->next->prev = leaf->prev;
+            else tail = leaf->prev;
+        }
+
+        /*
+         * Moves the upper half of the full `leaf` into a new right sibling. Each half gets a block of the width its
+         * keys need, so a leaf does not keep the room of the wider span it once had.
+         */
+        Leaf *split(Leaf *&leaf) {
+            constexpr uint16_t HALF = CAPACITY / 2;
+            K buffer[CAPACITY];
+            leaf->decode(buffer);
+            auto r = Leaf::make(Leaf::width_for(U(buffer[CAPACITY - 1]) - U(buffer[HALF])));
+            std::uninitialized_move(leaf->value_slots() + HALF, leaf->value_slots() + CAPACITY, r->value_slots());
+            std::destroy(leaf->value_slots() + HALF, leaf->value_slots() + CAPACITY);
+            r->encode(buffer + HALF, CAPACITY - HALF);
+            leaf->encode(buffer, HALF);
+            r->prev = leaf;
+            r->next = leaf->next;
+            if (r->next) r->next->prev = r;
+            else tail = r;
+            leaf->next = r;
+            index.insert(r->base, r);
+            if (leaf->width < leaf->room) leaf = reroom(leaf, leaf->width);
+            return r;
+        }
+
+        /* moves every entry of `right` to the end of `left`, its predecessor, and frees it */
+        void absorb(Leaf *left, Leaf *right) {
+            if (auto width = left->width_with(right->key_at(right->usage - 1)); width > left->room) {
+                left = reroom(left, width);
+            }
+            K buffer[CAPACITY];
+            left->decode(buffer);
+            right->decode(buffer + left->usage);
+            std::uninitialized_move(right->value_slots(), right->value_slots() + right->usage,
+                                    left->value_slots() + left->usage);
+            std::destroy(right->value_slots(), right->value_slots() + right->usage);
+            left->encode(buffer, left->usage + right->usage);
+            right->usage = 0;
+            index.erase(right->base);
+            unlink(right);
+            Leaf::destroy(right);
+        }
+
+    public:
+        /* position in key order; leaves are chained, so stepping never consults the index */
+        class iterator {
+            Leaf *node = nullptr;
+            uint16_t idx = 0;
+
+            friend class PackedBTree;
+
+            iterator(Leaf *node, uint16_t idx) : node(node), idx(idx) {}
+
+        public:
+            iterator() = default;
+
+            inline bool operator!=(const iterator &that) const noexcept {
+                return idx != that.idx || node != that.node;
+            }
+
+            inline bool operator==(const iterator &that) const noexcept {
+                return idx == that.idx && node == that.node;
+            }
+
+            iterator &operator++() {
+                if (++idx == node->usage) {
+                    node = node->next;
+                    idx = 0;
+                }
+                return *this;
+            }
+
+            iterator operator++(int) {
+                auto old = *this;
+                ++*this;
+                return old;
+            }
+
+            /* stepping back from the first entry gives `end()` */
+            iterator &operator--() {
+                if (idx) {
+                    idx--;
+                } else {
+                    node = node->prev;
+                    idx = node ? node->usage - 1 : 0;
+                }
+                return *this;
+            }
+
+            std::pair<K, V &> operator*() const {
+                return {node->key_at(idx), node->value_slots()[idx]};
+            }
+        };
+
+        PackedBTree() = default;
+
+        /* `[first, last)` must be sorted and unique; every leaf but the last gets `fill` of its capacity */
+        template<typename Iter>
+        static PackedBTree from_sorted(Iter first, Iter last, double fill = 1.0) {
+            PackedBTree tree;
+            auto per_leaf = std::clamp<size_t>(size_t(fill * CAPACITY), 1, CAPACITY);
+            std::vector<std::pair<K, Leaf *>> bases;
+            K buffer[CAPACITY];
+            while (first != last) {
+                auto leaf = Leaf::make(sizeof(U)); // the keys are only known as they are read, so it shrinks after
+                uint16_t n = 0;
+                for (; n < per_leaf && first != last; ++first, ++n) {
+                    buffer[n] = first->first;
+                    new(leaf->value_slots() + n) V(first->second);
+                }
+                leaf->encode(buffer, n);
+                if (leaf->width < leaf->room) leaf = Leaf::resized(leaf, leaf->width);
+                tree.link_back(leaf);
+                bases.emplace_back(leaf->base, leaf);
+                tree._size += n;
+            }
+            tree.index = Index::from_sorted(bases.begin(), bases.end());
+            return tree;
+        }
+
+        PackedBTree(const PackedBTree &that) : _size(that._size) {
+            std::vector<std::pair<K, Leaf *>> bases;
+            for (auto leaf = that.head; leaf; leaf = leaf->next) {
+                auto copy = Leaf::copy(*leaf);
+                link_back(copy);
+                bases.emplace_back(copy->base, copy);
+            }
+            index = Index::from_sorted(bases.begin(), bases.end());
+        }
+
+        PackedBTree(PackedBTree &&that) noexcept
+                : index(std::move(that.index)), head(std::exchange(that.head, nullptr)),
+                  tail(std::exchange(that.tail, nullptr)), _size(std::exchange(that._size, 0)) {}
+
+        PackedBTree &operator=(const PackedBTree &that) {
+            if (this != &that) {
+                PackedBTree copy(that);
+                swap(copy);
+            }
+            return *this;
+        }
+
+        PackedBTree &operator=(PackedBTree &&that) noexcept {
+            if (this != &that) {
+                PackedBTree moved(std::move(that));
+                swap(moved);
+            }
+            return *this;
+        }
+
+        void swap(PackedBTree &that) noexcept {
+            using std::swap;
+            index.swap(that.index);
+            swap(head, that.head);
+            swap(tail, that.tail);
+            swap(_size, that._size);
+        }
+
+        ~PackedBTree() {
+            clear();
+        }
+
+#ifdef DEBUG_MODE
+
+        /* the index against the chain, and every leaf's lanes: increasing, wide enough, and padded with ones */
+        void validate() {
+            index.validate();
+            size_t count = 0;
+            Leaf *prev = nullptr;
+            auto at = index.begin();
+            for (auto leaf = head; leaf; prev = leaf, leaf = leaf->next) {
+                ASSERT(leaf->usage && leaf->prev == prev);
+                ASSERT(at != index.end() && (*at).first == leaf->base && (*at).second == leaf);
+                ++at;
+                ASSERT(leaf->delta_at(0) == 0);
+                ASSERT(leaf->width >= Leaf::width_for(leaf->delta_at(leaf->usage - 1)) && leaf->width <= leaf->room);
+                for (size_t i = 1; i < leaf->usage; ++i) {
+                    ASSERT(leaf->delta_at(i - 1) < leaf->delta_at(i));
+                }
+                leaf->with_lanes([&](auto lanes) {
+                    using Lane = std::remove_pointer_t<decltype(lanes)>;
+                    for (size_t i = leaf->usage; i < CAPACITY; ++i) {
+                        ASSERT(lanes[i] == Lane(~Lane(0)));
+                    }
+                });
+                if (prev) ASSERT(prev->key_at(prev->usage - 1) < leaf->base);
+                count += leaf->usage;
+            }
+            ASSERT(prev == tail && !(at != index.end()) && count == _size);
+        }
+
+#endif
+
+        /*
+         * Returns the replaced value on a hit. A full leaf splits in halves first, except that a key past the last
+         * one starts a new last leaf, so keys arriving in order leave full leaves behind. A leaf is moved to a
+         * larger block first if the key needs wider lanes than it has room for.
+         */
+        template<typename Value = V>
+        std::optional<V> insert(const K &key, Value &&value) {
+            auto leaf = head ? route(key) : nullptr;
+            auto position = leaf ? leaf->search(key) : 0;
+            if (leaf && position < leaf->usage && leaf->key_at(position) == key) {
+                return std::exchange(leaf->value_slots()[position], V(std::forward<Value>(value)));
+            }
+            if (!leaf || (leaf == tail && leaf->usage == CAPACITY && position == CAPACITY)) {
+                link_back(Leaf::make(1));
+                tail->emplace(0, key, std::forward<Value>(value));
+                index.insert(key, tail);
+                _size++;
+                return std::nullopt;
+            }
+            if (leaf->usage == CAPACITY) {
+                auto r = split(leaf);
+                if (position > leaf->usage) {
+                    position -= leaf->usage;
+                    leaf = r;
+                }
+            }
+            if (auto width = leaf->width_with(key); width > leaf->room) leaf = reroom(leaf, width);
+            auto old = leaf->base;
+            leaf->emplace(position, key, std::forward<Value>(value));
+            if (leaf->base != old) rebase(old, leaf);
+            _size++;
+            return std::nullopt;
+        }
+
+        bool member(const K &key) {
+            if (!head) return false;
+            auto leaf = route(key);
+            auto position = leaf->search(key);
+            return position < leaf->usage && leaf->key_at(position) == key;
+        }
+
+        iterator find(const K &key) {
+            if (!head) return end();
+            auto leaf = route(key);
+            auto position = leaf->search(key);
+            if (position < leaf->usage && leaf->key_at(position) == key) return iterator(leaf, position);
+            return end();
+        }
+
+        iterator lower_bound(const K &key) {
+            if (!head) return end();
+            auto leaf = route(key);
+            auto position = leaf->search(key);
+            if (position < leaf->usage) return iterator(leaf, position);
+            return iterator(leaf->next, 0);
+        }
+
+        iterator upper_bound(const K &key) {
+            auto iter = lower_bound(key);
+            if (iter != end() && (*iter).first == key) ++iter;
+            return iter;
+        }
+
+        /* an emptied leaf is dropped, and a leaf that fits into a neighbour within half a leaf is merged into it */
+        size_t erase(const K &key) {
+            if (!head) return 0;
+            auto leaf = route(key);
+            auto position = leaf->search(key);
+            if (position == leaf->usage || leaf->key_at(position) != key) return 0;
+            auto old = leaf->base;
+            leaf->remove(position);
+            _size--;
+            if (!leaf->usage) {
+                index.erase(old);
+                unlink(leaf);
+                Leaf::destroy(leaf);
+                return 1;
+            }
+            if (leaf->base != old) rebase(old, leaf);
+            if (leaf->next && leaf->usage + leaf->next->usage <= CAPACITY / 2) {
+                absorb(leaf, leaf->next);
+            } else if (leaf->prev && leaf->prev->usage + leaf->usage <= CAPACITY / 2) {
+                absorb(leaf->prev, leaf);
+            }
+            return 1;
+        }
+
+        /* calls `f(key, value)` on every entry in order, unpacking the keys a whole leaf at a time */
+        template<typename F>
+        void for_each(F f) {
+            K buffer[CAPACITY];
+            for (auto leaf = head; leaf; leaf = leaf->next) {
+                leaf->decode(buffer);
+                for (size_t i = 0; i < leaf->usage; ++i) {
+                    f(buffer[i], leaf->value_slots()[i]);
+                }
+            }
+        }
+
+        void clear() {
+            while (head) {
+                Leaf::destroy(std::exchange(head, head->next));
+            }
+            tail = nullptr;
+            index.clear();
+            _size = 0;
+        }
+
+        bool empty() const {
+            return _size == 0;
+        }
+
+        size_t size() const {
+            return _size;
+        }
+
+        /* bytes allocated for keys: each leaf's full key plus the lanes of its block, empty slots included */
+        size_t packed_bytes() const {
+            size_t bytes = 0;
+            for (auto leaf = head; leaf; leaf = leaf->next) {
+                bytes += sizeof(K) + CAPACITY * leaf->room;
+            }
+            return bytes;
+        }
+
+        iterator begin() {
+            return iterator(head, 0);
+        }
+
+        iterator end() {
+            return iterator();
+        }
+    };
+}
+
+#endif // PACKED_BTREE_HPP
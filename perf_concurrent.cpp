@@ -0,0 +1,102 @@
+#define DEFAULT_BTREE_FACTOR 6
+
+#include <iostream>
+#include <btree.hpp>
+#include <concurrent_btree.hpp>
+#include <chrono>
+#include <mutex>
+#include <random>
+#include <thread>
+
+#define SEED 0x114514
+using namespace btree;
+
+template<typename F, typename... Args>
+void timeit(F f, Args &&... args) {
+    auto start = std::chrono::high_resolution_clock::now();
+    f(std::forward<Args>(args)...);
+    auto end = std::chrono::high_resolution_clock::now();
+    std::cout << "microsecs: " << std::chrono::duration_cast<std::chrono::microseconds>(end - start).count()
+              << std::endl;
+}
+
+/* the single-writer tree behind one global mutex, which is what the concurrent tree replaces */
+struct Locked {
+    std::mutex lock;
+    BTree<int, int> tree;
+
+    void insert(int key, int value) {
+        std::lock_guard guard(lock);
+        tree.insert(key, value);
+    }
+
+    bool member(int key) {
+        std::lock_guard guard(lock);
+        return tree.member(key);
+    }
+
+    void erase(int key) {
+        std::lock_guard guard(lock);
+        tree.erase(key);
+    }
+};
+
+/*
+ * Every thread runs `ops` operations over keys drawn from [0, range): `reads` percent lookups, the rest split
+ * evenly between insertions and erasures, so the size stays around its prefilled half of the range.
+ */
+template<typename Tree>
+void mixed(Tree &tree, unsigned threads, int ops, int range, unsigned reads) {
+    std::vector<std::thread> workers;
+    std::atomic<size_t> hits{0};
+    for (unsigned t = 0; t < threads; ++t) {
+        workers.emplace_back([&, t] {
+            std::mt19937_64 rng(SEED + t);
+            size_t found = 0;
+            for (int i = 0; i < ops; ++i) {
+                auto k = int(rng() % range);
+                auto dice = rng() % 100;
+                if (dice < reads) {
+                    found += tree.member(k);
+                } else if (dice % 2) {
+                    tree.insert(k, k);
+                } else {
+                    tree.erase(k);
+                }
+            }
+            hits += found;
+        });
+    }
+    for (auto &i : workers) {
+        i.join();
+    }
+    if (hits == 42) std::abort();
+}
+
+int main() {
+    auto cores = std::max(1u, std::thread::hardware_concurrency());
+    auto range = 2'000'000;
+    auto total = 8'000'000;
+    for (unsigned reads : {90u, 50u}) {
+        std::vector<unsigned> counts;
+        for (unsigned t = 1; t < cores; t *= 2) counts.push_back(t);
+        counts.push_back(cores);
+        for (auto threads : counts) {
+            {
+                std::cout << total << " mixed ops, " << reads << "% reads, " << threads << " threads (btree + mutex)"
+                          << std::endl;
+                Locked tree;
+                for (int i = 0; i < range; i += 2) tree.insert(i, i);
+                timeit([&] { mixed(tree, threads, total / threads, range, reads); });
+            }
+            {
+                std::cout << total << " mixed ops, " << reads << "% reads, " << threads << " threads (concurrent btree)"
+                          << std::endl;
+                ConcurrentBTree<int, int> tree;
+                for (int i = 0; i < range; i += 2) tree.insert(i, i);
+                timeit([&] { mixed(tree, threads, total / threads, range, reads); });
+            }
+        }
+    }
+    return 0;
+}
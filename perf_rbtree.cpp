@@ -4,8 +4,18 @@
 
 #include <iostream>
 #include <btree.hpp>
+#include <bplustree.hpp>
+#include <persistent_btree.hpp>
+#include <mapped_btree.hpp>
+#include <frozen_btree.hpp>
+#include <string_btree.hpp>
+#include <packed_btree.hpp>
 #include <chrono>
+#include <fstream>
+#include <memory>
 #include <random>
+#include <algorithm>
+#include <string>
 
 #define LIMIT 200000
 #define SEED 0x114514
@@ -61,6 +71,114 @@ int main() {
         });
     }
 
+    {
+        auto limit = 10'000'000;
+        std::cout << limit << " insertions (btree, slab)" << std::endl;
+        timeit([&] {
+            BTree<int, int, true, DEFAULT_BTREE_FACTOR, std::less<int>, SlabAllocator<std::pair<const int, int>>> tester;
+            for (int i = 0; i < limit; ++i) {
+                tester.insert(data[i], data[i]);
+            }
+        });
+    }
+
+    {
+        auto limit = 10'000'000;
+        std::cout << limit << " insertions (bplus)" << std::endl;
+        timeit([&] {
+            BPlusTree<int, int> tester;
+            for (int i = 0; i < limit; ++i) {
+                tester.insert(data[i], data[i]);
+            }
+        });
+    }
+
+    {
+        auto limit = 10'000'000;
+        std::vector<std::pair<int, int>> pairs;
+        for (auto i : data) {
+            pairs.emplace_back(i, i);
+        }
+        std::cout << limit << " batched insertions (btree)" << std::endl;
+        timeit([&] {
+            BTree<int, int> tester;
+            for (size_t i = 0; i < pairs.size(); i += 50'000) {
+                tester.insert_batch(std::span(pairs).subspan(i, std::min<size_t>(50'000, pairs.size() - i)));
+            }
+        });
+    }
+
+    {
+        auto limit = 1'000'000;
+        std::cout << limit << " string insertions x2, copied (btree)" << std::endl;
+        timeit([&] {
+            BTree<int, std::string> tester;
+            for (int round = 0; round < 2; ++round) {
+                for (int i = 0; i < limit; ++i) {
+                    std::string value(40, char('a' + round));
+                    tester.insert(data[i], value);
+                }
+            }
+        });
+        std::cout << limit << " string insertions x2, moved (btree)" << std::endl;
+        timeit([&] {
+            BTree<int, std::string> tester;
+            for (int round = 0; round < 2; ++round) {
+                for (int i = 0; i < limit; ++i) {
+                    std::string value(40, char('a' + round));
+                    tester.insert_or_assign(data[i], std::move(value));
+                }
+            }
+        });
+    }
+
+    {
+        std::vector<std::pair<int, int>> sorted;
+        for (auto i : data) {
+            sorted.emplace_back(i, i);
+        }
+        std::sort(sorted.begin(), sorted.end());
+        sorted.erase(std::unique(sorted.begin(), sorted.end(), [](auto &a, auto &b) {
+            return a.first == b.first;
+        }), sorted.end());
+        std::cout << sorted.size() << " sorted insertions (btree)" << std::endl;
+        timeit([&] {
+            BTree<int, int> tester;
+            for (auto &i : sorted) {
+                tester.insert(i.first, i.second);
+            }
+        });
+        std::cout << sorted.size() << " bulk load (btree)" << std::endl;
+        timeit([&] {
+            auto tester = BTree<int, int>::from_sorted(sorted.begin(), sorted.end());
+        });
+    }
+
+    {
+        auto limit = 10'000'000;
+        std::cout << limit << " destruct (btree)" << std::endl;
+        auto tester = std::make_unique<BTree<int, int>>();
+        for (int i = 0; i < limit; ++i) {
+            tester->insert(data[i], data[i]);
+        }
+        timeit([&] {
+            tester.reset();
+        });
+    }
+
+    {
+        auto limit = 10'000'000;
+        std::cout << limit << " destruct (btree, slab)" << std::endl;
+        auto tester = std::make_unique<BTree<int, int, true, DEFAULT_BTREE_FACTOR, std::less<int>,
+                SlabAllocator<std::pair<const int, int>>>>();
+        for (int i = 0; i < limit; ++i) {
+            tester->insert(data[i], data[i]);
+        }
+        timeit([&] {
+            tester.reset();
+        });
+    }
+
     auto M = 0;
     {
         auto limit = 10'000'000;
@@ -90,7 +208,156 @@ int main() {
             }
         });
     }
-    if (M != N) std::abort();
+    auto Q = 0;
+    {
+        auto limit = 10'000'000;
+        std::cout << limit << " membership (btree, member_batch)" << std::endl;
+        BTree<int, int> tester;
+        for (int i = 0; i < limit; ++i) {
+            tester.insert(data[i], data[i]);
+        }
+        bool hits[1024];
+        timeit([&] {
+            for (int i = 0; i < limit; i += 1024) {
+                auto n = std::min(1024, limit - i);
+                tester.member_batch(std::span(codata).subspan(i, n), std::span(hits, n));
+                Q += std::count(hits, hits + n, true);
+            }
+        });
+    }
+    auto F = 0;
+    {
+        auto limit = 10'000'000;
+        std::cout << limit << " membership (frozen btree)" << std::endl;
+        BTree<int, int> tester;
+        for (int i = 0; i < limit; ++i) {
+            tester.insert(data[i], data[i]);
+        }
+        auto frozen = FrozenBTree<int, int>::freeze(tester);
+        tester.clear();
+        timeit([&] {
+            for (int i = 0; i < limit; ++i) {
+                F += frozen.member(codata[i]);
+            }
+        });
+    }
+    auto S = 0;
+    {
+        auto limit = 10'000'000;
+        std::cout << limit << " membership (btree, simd)" << std::endl;
+        BTree<int, int, SIMD_SEARCH> tester;
+        for (int i = 0; i < limit; ++i) {
+            tester.insert(data[i], data[i]);
+        }
+        timeit([&] {
+            for (int i = 0; i < limit; ++i) {
+                S += tester.member(codata[i]);
+            }
+        });
+    }
+    auto P = 0;
+    {
+        auto limit = 10'000'000;
+        std::cout << limit << " membership (bplus)" << std::endl;
+        BPlusTree<int, int> tester;
+        for (int i = 0; i < limit; ++i) {
+            tester.insert(data[i], data[i]);
+        }
+        timeit([&] {
+            for (int i = 0; i < limit; ++i) {
+                P += tester.member(codata[i]);
+            }
+        });
+    }
+    if (M != N || M != Q || M != F || M != S || M != P) std::abort();
+    {
+        auto limit = 1'000'000;
+        std::vector<std::string> urls(limit), probes(limit);
+        for (int i = 0; i < limit; ++i) {
+            urls[i] = "https://example.com/users/" + std::to_string(data[i] % (4 * limit)) + "/profile";
+            probes[i] = "https://example.com/users/" + std::to_string(codata[i] % (4 * limit)) + "/profile";
+        }
+        auto U = 0, T = 0, W = 0;
+        {
+            std::cout << limit << " url membership from string_view (btree, std::string keys)" << std::endl;
+            BTree<std::string, int> tester;
+            for (auto &i : urls) {
+                tester.insert(i, 0);
+            }
+            timeit([&] {
+                for (auto &i : probes) {
+                    std::string_view received = i;
+                    U += tester.member(std::string(received));
+                }
+            });
+        }
+        {
+            std::cout << limit << " url membership from string_view (btree, std::less<>)" << std::endl;
+            BTree<std::string, int, BINARY_SEARCH, DEFAULT_BTREE_FACTOR, std::less<>> tester;
+            for (auto &i : urls) {
+                tester.insert(i, 0);
+            }
+            timeit([&] {
+                for (auto &i : probes) {
+                    std::string_view received = i;
+                    T += tester.member(received);
+                }
+            });
+        }
+        {
+            std::cout << limit << " url membership from string_view (string btree)" << std::endl;
+            StringBTree<int> tester;
+            for (auto &i : urls) {
+                tester.insert(i, 0);
+            }
+            timeit([&] {
+                for (auto &i : probes) {
+                    W += tester.member(i);
+                }
+            });
+        }
+        if (U != T || U != W) std::abort();
+    }
+    {
+        auto limit = 10'000'000;
+        std::vector<int64_t> ids(limit), probes(limit);
+        int64_t id = 1'600'000'000'000ll; // millisecond timestamps, a few apart
+        for (int i = 0; i < limit; ++i) {
+            ids[i] = id += 1 + data[i] % 8;
+        }
+        for (int i = 0; i < limit; ++i) {
+            probes[i] = ids[0] + codata[i] % (id - ids[0] + 1);
+        }
+        std::shuffle(ids.begin(), ids.end(), rng.engine);
+        auto D = 0, E = 0;
+        {
+            std::cout << limit << " timestamp membership (btree)" << std::endl;
+            BTree<int64_t, int> tester;
+            for (auto i : ids) {
+                tester.insert(i, 0);
+            }
+            timeit([&] {
+                for (auto i : probes) {
+                    D += tester.member(i);
+                }
+            });
+            std::cout << "key bytes: " << tester.size() * sizeof(int64_t) << std::endl;
+        }
+        {
+            std::cout << limit << " timestamp membership (packed btree)" << std::endl;
+            PackedBTree<int64_t, int> tester;
+            for (auto i : ids) {
+                tester.insert(i, 0);
+            }
+            timeit([&] {
+                for (auto i : probes) {
+                    E += tester.member(i);
+                }
+            });
+            std::cout << "key bytes: " << tester.packed_bytes() << std::endl;
+        }
+        if (D != E) std::abort();
+    }
     {
         auto limit = 10'000'000;
         std::cout << limit << " erase min (map)" << std::endl;
@@ -118,6 +385,114 @@ int main() {
             }
         });
     }
+    {
+        auto limit = 10'000'000;
+        std::cout << 1000 << " range erasures (map)" << std::endl;
+        std::map<int, int> tester;
+        for (int i = 0; i < limit; ++i) {
+            tester.insert({data[i], data[i]});
+        }
+        timeit([&] {
+            for (int i = 0; i < 1000; ++i) {
+                tester.erase(tester.lower_bound(codata[i] / 2), tester.lower_bound(codata[i] / 2 + (1 << 20)));
+            }
+        });
+    }
+
+    {
+        auto limit = 10'000'000;
+        std::cout << 1000 << " range erasures (btree)" << std::endl;
+        BTree<int, int> tester;
+        for (int i = 0; i < limit; ++i) {
+            tester.insert(data[i], data[i]);
+        }
+        timeit([&] {
+            for (int i = 0; i < 1000; ++i) {
+                tester.erase_range(codata[i] / 2, codata[i] / 2 + (1 << 20));
+            }
+        });
+    }
+
+    {
+        auto limit = 10'000'000;
+        std::vector<int> batch(data.begin(), data.begin() + limit / 2);
+        std::sort(batch.begin(), batch.end());
+        std::cout << batch.size() << " erasures (btree)" << std::endl;
+        BTree<int, int> tester;
+        for (int i = 0; i < limit; ++i) {
+            tester.insert(data[i], data[i]);
+        }
+        timeit([&] {
+            for (auto i : batch) {
+                tester.erase(i);
+            }
+        });
+        std::cout << batch.size() << " batched erasures (btree)" << std::endl;
+        for (int i = 0; i < limit; ++i) {
+            tester.insert(data[i], data[i]);
+        }
+        timeit([&] {
+            tester.erase_batch(batch);
+        });
+    }
+
+    {
+        auto limit = 10'000'000;
+        std::cout << 1000 << " split_off + append (btree, counted)" << std::endl;
+        BTree<int, int, BINARY_SEARCH, DEFAULT_BTREE_FACTOR, std::less<int>, std::allocator<std::pair<const int, int>>,
+                ORDER_STATISTICS> tester;
+        for (int i = 0; i < limit; ++i) {
+            tester.insert(data[i], data[i]);
+        }
+        timeit([&] {
+            for (int i = 0; i < 1000; ++i) {
+                auto right = tester.split_off(codata[i]);
+                tester.append(std::move(right));
+            }
+        });
+        if (tester.size() == 0) std::abort();
+    }
+
+    {
+        auto limit = 10'000'000;
+        std::cout << 1'000'000 << " nth + rank queries (btree, counted)" << std::endl;
+        BTree<int, int, BINARY_SEARCH, DEFAULT_BTREE_FACTOR, std::less<int>, std::allocator<std::pair<const int, int>>,
+                ORDER_STATISTICS> tester;
+        for (int i = 0; i < limit; ++i) {
+            tester.insert(data[i], data[i]);
+        }
+        size_t R = 0;
+        timeit([&] {
+            for (int i = 0; i < 1'000'000; ++i) {
+                R += (*tester.nth(size_t(codata[i]) % tester.size())).first;
+                R += tester.rank(codata[i]);
+            }
+        });
+        if (R == 42) std::abort();
+    }
+
+    {
+        auto limit = 5'000'000;
+        std::cout << limit << " union of two trees (btree, set_union)" << std::endl;
+        BTree<int, int> a, b;
+        for (int i = 0; i < limit; ++i) {
+            a.insert(data[i], data[i]);
+            b.insert(codata[i], codata[i]);
+        }
+        timeit([&] {
+            auto joined = BTree<int, int>::set_union(a, b);
+            if (joined.size() == 0) std::abort();
+        });
+        std::cout << limit << " union of two trees (btree, insert one by one)" << std::endl;
+        timeit([&] {
+            auto joined = a;
+            for (auto i : b) {
+                joined.insert(i.first, i.second);
+            }
+            if (joined.size() == 0) std::abort();
+        });
+    }
+
     size_t A = 0;
     {
         auto limit = 10'000'000;
@@ -150,7 +525,40 @@ int main() {
             }
         });
     }
-    if (A != B) std::abort();
+    size_t C = 0;
+    {
+        auto limit = 10'000'000;
+        std::cout << limit << " iterate through (btree, linked)" << std::endl;
+        BTree<int, int, BINARY_SEARCH, DEFAULT_BTREE_FACTOR, std::less<int>, std::allocator<std::pair<const int, int>>,
+                LEAF_LINKS> tester;
+        for (int i = 0; i < limit; ++i) {
+            tester.insert(data[i], data[i]);
+        }
+        timeit([&] {
+            auto iter = tester.begin();
+            while (iter != tester.end()) {
+                C ^= (*iter).first;
+                ++iter;
+            }
+        });
+    }
+    size_t D = 0;
+    {
+        auto limit = 10'000'000;
+        std::cout << limit << " iterate through (bplus)" << std::endl;
+        BPlusTree<int, int> tester;
+        for (int i = 0; i < limit; ++i) {
+            tester.insert(data[i], data[i]);
+        }
+        timeit([&] {
+            auto iter = tester.begin();
+            while (iter != tester.end()) {
+                D ^= (*iter).first;
+                ++iter;
+            }
+        });
+    }
+    if (A != B || A != C || A != D) std::abort();
 
     {
         auto limit = 10'000'000;
@@ -173,6 +581,92 @@ int main() {
         timeit([&] {
             auto another = tester;
         });
+        std::cout << limit << " copy construct (btree, parallel_copy)" << std::endl;
+        timeit([&] {
+            auto another = tester.parallel_copy();
+        });
+        auto another = tester;
+        std::cout << limit << " clear (btree)" << std::endl;
+        timeit([&] {
+            another.clear();
+        });
+        another = BTree<int, int>(tester);
+        std::cout << limit << " clear (btree, parallel_clear)" << std::endl;
+        timeit([&] {
+            another.parallel_clear();
+        });
+        Reclaimer reclaimer;
+        another = BTree<int, int>(tester);
+        std::cout << limit << " clear (btree, handed to a reclaimer)" << std::endl;
+        timeit([&] {
+            another.clear(reclaimer);
+        });
+    }
+    {
+        auto limit = 10'000'000;
+        std::cout << 1000 << " snapshots, each followed by a write (persistent btree)" << std::endl;
+        PersistentBTree<int, int> tester;
+        for (int i = 0; i < limit; ++i) {
+            tester.insert(data[i], data[i]);
+        }
+        std::vector<PersistentBTree<int, int>> snapshots;
+        timeit([&] {
+            for (int i = 0; i < 1000; ++i) {
+                snapshots.push_back(tester.snapshot());
+                tester.insert(codata[i], i);
+            }
+        });
+        timeit([&] {
+            snapshots.clear();
+        });
+    }
+    {
+        auto limit = 10'000'000;
+        BTree<int, int> tester;
+        for (int i = 0; i < limit; ++i) {
+            tester.insert(data[i], data[i]);
+        }
+        std::cout << limit << " save image (btree)" << std::endl;
+        timeit([&] {
+            if (!MappedBTree<int, int>::save_image(tester, "perf_rbtree.image")) std::abort();
+        });
+        std::cout << limit << " restart by insertion (btree)" << std::endl;
+        timeit([&] {
+            BTree<int, int> restarted;
+            for (int i = 0; i < limit; ++i) {
+                restarted.insert(data[i], data[i]);
+            }
+        });
+        std::cout << limit << " restart by mapping the image, then membership (mapped btree)" << std::endl;
+        auto I = 0;
+        timeit([&] {
+            auto mapped = MappedBTree<int, int>::map_image("perf_rbtree.image");
+            for (int i = 0; i < limit; ++i) {
+                I += mapped->member(codata[i]);
+            }
+        });
+        std::remove("perf_rbtree.image");
+        if (I != M) std::abort();
+    }
+    {
+        auto limit = 10'000'000;
+        BTree<int, int> tester;
+        for (int i = 0; i < limit; ++i) {
+            tester.insert(data[i], data[i]);
+        }
+        std::cout << limit << " dump to a file (btree)" << std::endl;
+        timeit([&] {
+            std::ofstream out("perf_rbtree.dump", std::ios::binary);
+            if (!tester.dump(out)) std::abort();
+        });
+        std::cout << limit << " load from a file (btree)" << std::endl;
+        BTree<int, int> loaded;
+        timeit([&] {
+            std::ifstream in("perf_rbtree.dump", std::ios::binary);
+            if (!loaded.load(in)) std::abort();
+        });
+        std::remove("perf_rbtree.dump");
+        if (loaded.size() != tester.size()) std::abort();
     }
 
 
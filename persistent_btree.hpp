@@ -0,0 +1,594 @@
+#ifndef PERSISTENT_BTREE_HPP
+#define PERSISTENT_BTREE_HPP
+
+#include <btree.hpp>
+#include <array>
+#include <atomic>
+
+#define keys node_keys()
+#define values node_values()
+
+namespace btree {
+
+    template<typename K, typename V, unsigned Search = BINARY_SEARCH, size_t B = DEFAULT_BTREE_FACTOR, typename Compare = std::less<K>,
+            typename Alloc = std::allocator<std::pair<const K, V>>>
+    class PersistentBTree;
+
+    namespace __persistent_impl {
+
+        template<typename K, typename V, unsigned Search, size_t B, typename Compare>
+        struct Internal;
+
+        /*
+         * Same key/value layout as `BTree` nodes, with the parent link traded for a reference count: a node may
+         * hang below several trees at once, so nothing points upwards. A node is written in place only while its
+         * count is one; otherwise the writer clones it first and the clone shares the children.
+         */
+        template<typename K, typename V, unsigned Search, size_t B, typename Compare>
+        struct alignas(64) NodeBase {
+            static_assert(B > 2, "B is too small");
+            static_assert(2 * B < (1u << 16u), "B is too large");
+            using Internal = __persistent_impl::Internal<K, V, Search, B, Compare>;
+            using KeyBlock = std::aligned_storage_t<sizeof(K), alignof(K)>;
+            using ValueBlock = std::aligned_storage_t<sizeof(V), alignof(V)>;
+            static constexpr bool USE_SIMD = Search == SIMD_SEARCH && __btree_impl::simd_searchable<K, Compare>;
+            static constexpr size_t KEY_SLOTS = USE_SIMD ?
+                                                (2 * B - 1 + __btree_impl::SIMD_LANES<K> - 1) /
+                                                __btree_impl::SIMD_LANES<K> * __btree_impl::SIMD_LANES<K> :
+                                                2 * B - 1;
+
+            std::atomic<uint32_t> refs{1}; // atomic, so snapshots may be released on other threads
+            uint16_t usage = 0;
+            bool leaf;
+
+            KeyBlock __keys[KEY_SLOTS];
+            ValueBlock __values[2 * B - 1];
+
+            explicit NodeBase(bool leaf) : leaf(leaf) {
+#ifdef DEBUG_MODE
+                alive_node++;
+#endif
+            }
+
+            ~NodeBase() {
+#ifdef DEBUG_MODE
+                alive_node--;
+#endif
+                std::destroy(keys, keys + usage);
+                std::destroy(values, values + usage);
+            }
+
+            inline Internal *as_internal() {
+                ASSERT(!leaf);
+                return static_cast<Internal *>(this);
+            }
+
+            inline K *node_keys() {
+                return reinterpret_cast<K *>(__keys);
+            }
+
+            inline V *node_values() {
+                return reinterpret_cast<V *>(__values);
+            }
+
+            inline K &key_at(size_t i) {
+                return keys[i];
+            }
+
+            inline V &value_at(size_t i) {
+                return values[i];
+            }
+
+            /* position of the first key not less than `key`, and whether it is `key` */
+            inline std::pair<uint16_t, bool> search(const K &key, Compare &comp) {
+                uint16_t position;
+                if constexpr (USE_SIMD) {
+                    position = __btree_impl::simd_lower_bound<KEY_SLOTS>(keys, usage, key);
+                } else if constexpr (Search != LINEAR_SEARCH) {
+                    position = std::lower_bound(keys, keys + usage, key, comp) - keys;
+                } else {
+                    for (position = 0; position < usage && comp(keys[position], key); ++position);
+                }
+                return {position, position < usage && !comp(key, keys[position])};
+            }
+
+            template<typename Key, typename... Args>
+            void emplace(uint16_t position, Key &&key, Args &&... args) {
+                __btree_impl::uninitialized_move_back(values + position, values + usage);
+                __btree_impl::uninitialized_move_back(keys + position, keys + usage);
+                new(values + position) V(std::forward<Args>(args)...);
+                new(keys + position) K(std::forward<Key>(key));
+                usage++;
+            }
+
+            std::pair<K, V> take(uint16_t position) {
+                std::pair<K, V> result(std::move(keys[position]), std::move(values[position]));
+                std::destroy_at(keys + position);
+                std::destroy_at(values + position);
+                __btree_impl::uninitialized_move_forward(keys + position + 1, keys + usage);
+                __btree_impl::uninitialized_move_forward(values + position + 1, values + usage);
+                usage--;
+                return result;
+            }
+
+            template<typename Value>
+            std::optional<V> replace(uint16_t idx, Value &&value) {
+                std::optional<V> original(std::move(values[idx]));
+                values[idx] = std::forward<Value>(value);
+                return original;
+            }
+        };
+
+        template<typename K, typename V, unsigned Search, size_t B, typename Compare>
+        struct Internal : NodeBase<K, V, Search, B, Compare> {
+            using Node = NodeBase<K, V, Search, B, Compare>;
+            using Node::usage;
+
+            Node *children[2 * B];
+
+            Internal() : Node(false) {}
+
+            /* takes the new right sibling of children[position] together with their separator */
+            void adopt(uint16_t position, K key, V value, Node *right) {
+                std::memmove(children + position + 2, children + position + 1, (usage - position) * sizeof(Node *));
+                children[position + 1] = right;
+                this->emplace(position, std::move(key), std::move(value));
+            }
+
+            /* moves the last entry of children[idx - 1] up here and the separator down into children[idx] */
+            void rotate_right(uint16_t idx) {
+                auto from = children[idx - 1], to = children[idx];
+                to->emplace(0, std::move(this->keys[idx - 1]), std::move(this->values[idx - 1]));
+                if (!to->leaf) {
+                    auto target = to->as_internal();
+                    std::memmove(target->children + 1, target->children, to->usage * sizeof(Node *));
+                    target->children[0] = from->as_internal()->children[from->usage];
+                }
+                auto [key, value] = from->take(from->usage - 1);
+                this->keys[idx - 1] = std::move(key);
+                this->values[idx - 1] = std::move(value);
+            }
+
+            /* moves the first entry of children[idx + 1] up here and the separator down into children[idx] */
+            void rotate_left(uint16_t idx) {
+                auto from = children[idx + 1], to = children[idx];
+                if (!to->leaf) {
+                    to->as_internal()->children[to->usage + 1] = from->as_internal()->children[0];
+                    auto source = from->as_internal();
+                    std::memmove(source->children, source->children + 1, from->usage * sizeof(Node *));
+                }
+                to->emplace(to->usage, std::move(this->keys[idx]), std::move(this->values[idx]));
+                auto [key, value] = from->take(0);
+                this->keys[idx] = std::move(key);
+                this->values[idx] = std::move(value);
+            }
+
+            /* folds separator `idx` and children[idx + 1] into children[idx]; returns the emptied right node */
+            Node *merge(uint16_t idx) {
+                auto left = children[idx], right = children[idx + 1];
+                ASSERT(left->usage + right->usage + 1u < 2 * B - 1);
+                auto [key, value] = this->take(idx);
+                left->emplace(left->usage, std::move(key), std::move(value));
+                std::uninitialized_move(right->keys, right->keys + right->usage, left->keys + left->usage);
+                std::uninitialized_move(right->values, right->values + right->usage, left->values + left->usage);
+                if (!left->leaf) {
+                    std::memcpy(left->as_internal()->children + left->usage, right->as_internal()->children,
+                                (right->usage + 1) * sizeof(Node *));
+                }
+                left->usage += right->usage;
+                std::destroy(right->keys, right->keys + right->usage);
+                std::destroy(right->values, right->values + right->usage);
+                right->usage = 0;
+                std::memmove(children + idx + 1, children + idx + 2, (usage - idx) * sizeof(Node *));
+                return right;
+            }
+        };
+    }
+
+    /*
+     * B-tree with reference-counted nodes and path copying. Copying a tree, or taking a `snapshot()`, is O(1): both
+     * share the root. A write clones only the shared nodes on its root-to-leaf path and leaves every other tree
+     * untouched, so snapshots and their iterators stay valid while the original keeps changing. Iterators carry
+     * their path from the root instead of following parent links, and hand out values read-only since the node
+     * under them may be shared. Each tree is used by one thread at a time, but trees sharing nodes may live on
+     * different threads; their allocators must be interchangeable.
+     */
+    template<typename K, typename V, unsigned Search, size_t B, typename Compare, typename Alloc>
+    class PersistentBTree {
+        using Node = __persistent_impl::NodeBase<K, V, Search, B, Compare>;
+        using Internal = typename Node::Internal;
+        using CacheLine = __btree_impl::CacheLine;
+        using NodeAlloc = typename std::allocator_traits<Alloc>::template rebind_alloc<CacheLine>;
+        using NodeAllocTraits = std::allocator_traits<NodeAlloc>;
+
+        /* levels of the tallest tree that fits in memory: 2^58 entries with every node at its minimum */
+        static constexpr size_t MAX_HEIGHT = [] {
+            size_t height = 1;
+            for (long double reach = B - 1; reach < 0x1p58L; reach *= B) height++;
+            return height;
+        }();
+
+        size_t _size = 0;
+        size_t height = 0; // number of internal levels above the leaves
+        Node *root = nullptr;
+
+        friend __btree_impl::PathIterator<PersistentBTree, Node, K, V, MAX_HEIGHT>;
+
+        Node *child(Node *node, size_t i) const {
+            return node->as_internal()->children[i];
+        }
+
+        [[no_unique_address]] NodeAlloc alloc;
+        [[no_unique_address]] Compare comp;
+
+        template<typename T>
+        T *allocate_node() {
+            static_assert(sizeof(T) % sizeof(CacheLine) == 0);
+            auto memory = NodeAllocTraits::allocate(alloc, sizeof(T) / sizeof(CacheLine));
+            return new(memory) T();
+        }
+
+        Node *allocate_node(size_t h) {
+            if (h) return allocate_node<Internal>();
+            return new(NodeAllocTraits::allocate(alloc, sizeof(Node) / sizeof(CacheLine))) Node(true);
+        }
+
+        void free_node(Node *node, size_t h) {
+            if (h) {
+                std::destroy_at(node->as_internal());
+                NodeAllocTraits::deallocate(alloc, reinterpret_cast<CacheLine *>(node), sizeof(Internal) / sizeof(CacheLine));
+            } else {
+                std::destroy_at(node);
+                NodeAllocTraits::deallocate(alloc, reinterpret_cast<CacheLine *>(node), sizeof(Node) / sizeof(CacheLine));
+            }
+        }
+
+        /* gives up one reference to `node`, freeing the subtree parts nobody else holds */
+        void drop(Node *node, size_t h) {
+            if (node->refs.fetch_sub(1, std::memory_order_acq_rel) != 1) return;
+            if (h) {
+                for (size_t i = 0; i <= node->usage; ++i) {
+                    drop(node->as_internal()->children[i], h - 1);
+                }
+            }
+            free_node(node, h);
+        }
+
+        /* makes the node in `slot` exclusively ours, cloning it if it is shared; the clone shares the children */
+        Node *unique(Node *&slot, size_t h) {
+            auto node = slot;
+            if (node->refs.load(std::memory_order_acquire) == 1) return node;
+            auto copy = allocate_node(h);
+            std::uninitialized_copy(node->keys, node->keys + node->usage, copy->keys);
+            std::uninitialized_copy(node->values, node->values + node->usage, copy->values);
+            copy->usage = node->usage;
+            if (h) {
+                for (size_t i = 0; i <= node->usage; ++i) {
+                    auto child = node->as_internal()->children[i];
+                    child->refs.fetch_add(1, std::memory_order_relaxed);
+                    copy->as_internal()->children[i] = child;
+                }
+            }
+            drop(node, h);
+            return slot = copy;
+        }
+
+        struct Split {
+            K key;
+            V value;
+            Node *right;
+        };
+
+        /* moves the upper half of a full node into a new right sibling and returns it with the middle entry */
+        Split split(Node *node, size_t h) {
+            ASSERT(node->usage == 2 * B - 1);
+            auto right = allocate_node(h);
+            std::uninitialized_move(node->keys + B, node->keys + node->usage, right->keys);
+            std::uninitialized_move(node->values + B, node->values + node->usage, right->values);
+            if (h) {
+                std::memcpy(right->as_internal()->children, node->as_internal()->children + B, B * sizeof(Node *));
+            }
+            right->usage = B - 1;
+            Split result{std::move(node->keys[B - 1]), std::move(node->values[B - 1]), right};
+            std::destroy(node->keys + B - 1, node->keys + node->usage);
+            std::destroy(node->values + B - 1, node->values + node->usage);
+            node->usage = B - 1;
+            return result;
+        }
+
+        /* puts `key` below `slot`; returns the new right sibling when the node there had to split */
+        template<typename Key, typename Value>
+        std::optional<Split> insert_into(Node *&slot, size_t h, Key &&key, Value &&value, std::optional<V> &replaced) {
+            auto node = unique(slot, h);
+            auto [position, found] = node->search(key, comp);
+            if (found) {
+                replaced = node->replace(position, std::forward<Value>(value));
+                return std::nullopt;
+            }
+            if (h) {
+                auto split = insert_into(node->as_internal()->children[position], h - 1, std::forward<Key>(key),
+                                         std::forward<Value>(value), replaced);
+                if (!split) return std::nullopt;
+                node->as_internal()->adopt(position, std::move(split->key), std::move(split->value), split->right);
+            } else {
+                node->emplace(position, std::forward<Key>(key), std::forward<Value>(value));
+            }
+            if (node->usage < 2 * B - 1) return std::nullopt;
+            return split(node, h);
+        }
+
+        /* refills children[idx] of the exclusively held `node` after it fell below the minimum */
+        void fix_underflow(Node *node, uint16_t idx, size_t h) {
+            auto parent = node->as_internal();
+            if (idx && parent->children[idx - 1]->usage > B - 1) {
+                unique(parent->children[idx - 1], h - 1);
+                parent->rotate_right(idx);
+            } else if (idx < node->usage && parent->children[idx + 1]->usage > B - 1) {
+                unique(parent->children[idx + 1], h - 1);
+                parent->rotate_left(idx);
+            } else {
+                unique(parent->children[idx ? idx - 1 : idx + 1], h - 1);
+                free_node(parent->merge(idx ? idx - 1 : idx), h - 1);
+            }
+        }
+
+        /* removes the last entry below `slot` (the first one if `!back`); returns whether the node there underflows */
+        bool take_end(Node *&slot, size_t h, bool back, std::optional<std::pair<K, V>> &out) {
+            auto node = unique(slot, h);
+            if (!h) {
+                out.emplace(node->take(back ? node->usage - 1 : 0));
+                return node->usage < B - 1;
+            }
+            uint16_t idx = back ? node->usage : 0;
+            if (take_end(node->as_internal()->children[idx], h - 1, back, out)) fix_underflow(node, idx, h);
+            return node->usage < B - 1;
+        }
+
+        /* removes `key`, which must be present below `slot`; returns whether the node there underflows */
+        bool erase_from(Node *&slot, size_t h, const K &key, std::optional<std::pair<K, V>> &out) {
+            auto node = unique(slot, h);
+            auto [position, found] = node->search(key, comp);
+            if (!h) {
+                ASSERT(found);
+                out.emplace(node->take(position));
+                return node->usage < B - 1;
+            }
+            bool under;
+            if (found) {
+                std::optional<std::pair<K, V>> predecessor;
+                under = take_end(node->as_internal()->children[position], h - 1, true, predecessor);
+                out.emplace(std::move(node->keys[position]), std::move(node->values[position]));
+                node->keys[position] = std::move(predecessor->first);
+                node->values[position] = std::move(predecessor->second);
+            } else {
+                under = erase_from(node->as_internal()->children[position], h - 1, key, out);
+            }
+            if (under) fix_underflow(node, position, h);
+            return node->usage < B - 1;
+        }
+
+        /* a root left without entries hands the tree to its only child, or leaves it empty */
+        void shrink() {
+            if (root->usage) return;
+            auto old = root;
+            if (height) {
+                root = root->as_internal()->children[0];
+                height--;
+            } else {
+                root = nullptr;
+            }
+            free_node(old, root ? height + 1 : 0);
+        }
+
+        template<typename Key, typename Value>
+        std::optional<V> insert_entry(Key &&key, Value &&value) {
+            if (!root) root = allocate_node(0);
+            std::optional<V> replaced;
+            auto split = insert_into(root, height, std::forward<Key>(key), std::forward<Value>(value), replaced);
+            if (split) {
+                auto top = allocate_node<Internal>();
+                top->children[0] = root;
+                top->adopt(0, std::move(split->key), std::move(split->value), split->right);
+                root = top;
+                height++;
+            }
+            if (!replaced) _size++;
+            return replaced;
+        }
+
+        std::pair<K, V> pop_end(bool back) {
+            ASSERT(_size);
+            std::optional<std::pair<K, V>> result;
+            take_end(root, height, back, result);
+            shrink();
+            _size--;
+            return std::move(*result);
+        }
+
+#ifdef DEBUG_MODE
+
+        /* every key below `node` must lie strictly between `lo` and `hi` */
+        void validate(Node *node, size_t h, const K *lo, const K *hi, size_t &count) {
+            ASSERT(node->refs.load() >= 1);
+            ASSERT(node->leaf == !h);
+            ASSERT(node == root || node->usage >= B - 1);
+            ASSERT(node->usage < 2 * B - 1);
+            for (size_t i = 0; i < node->usage; ++i) {
+                ASSERT(!lo || comp(*lo, node->keys[i]));
+                ASSERT(!hi || comp(node->keys[i], *hi));
+                ASSERT(!i || comp(node->keys[i - 1], node->keys[i]));
+            }
+            count += node->usage;
+            if (!h) return;
+            for (size_t i = 0; i <= node->usage; ++i) {
+                validate(node->as_internal()->children[i], h - 1, i ? &node->keys[i - 1] : lo,
+                         i < node->usage ? &node->keys[i] : hi, count);
+            }
+        }
+
+#endif
+    public:
+        /* in-order position held as the path from the root */
+        using iterator = __btree_impl::PathIterator<PersistentBTree, Node, K, V, MAX_HEIGHT>;
+
+        PersistentBTree(Compare comp = Compare(), const Alloc &alloc = Alloc()) : alloc(alloc), comp(comp) {}
+
+        /* O(1): the copy shares every node until one side writes to it */
+        PersistentBTree(const PersistentBTree &that)
+                : _size(that._size), height(that.height), root(that.root), alloc(that.alloc), comp(that.comp) {
+            if (root) root->refs.fetch_add(1, std::memory_order_relaxed);
+        }
+
+        PersistentBTree(PersistentBTree &&that) noexcept(std::is_nothrow_move_constructible_v<Compare>)
+                : _size(std::exchange(that._size, 0)), height(std::exchange(that.height, 0)),
+                  root(std::exchange(that.root, nullptr)), alloc(std::move(that.alloc)), comp(std::move(that.comp)) {}
+
+        PersistentBTree &operator=(const PersistentBTree &that) {
+            if (this != &that) {
+                PersistentBTree copy(that);
+                swap(copy);
+            }
+            return *this;
+        }
+
+        PersistentBTree &operator=(PersistentBTree &&that) noexcept(std::is_nothrow_move_assignable_v<Compare>) {
+            if (this == &that) return *this;
+            clear();
+            if constexpr (NodeAllocTraits::propagate_on_container_move_assignment::value) {
+                alloc = that.alloc;
+            } else {
+                ASSERT(alloc == that.alloc);
+            }
+            comp = std::move(that.comp);
+            root = std::exchange(that.root, nullptr);
+            height = std::exchange(that.height, 0);
+            _size = std::exchange(that._size, 0);
+            return *this;
+        }
+
+        void swap(PersistentBTree &that) noexcept(std::is_nothrow_swappable_v<Compare>) {
+            using std::swap;
+            swap(alloc, that.alloc);
+            swap(comp, that.comp);
+            swap(root, that.root);
+            swap(height, that.height);
+            swap(_size, that._size);
+        }
+
+        ~PersistentBTree() {
+            clear();
+        }
+
+        /* point-in-time copy in O(1), unaffected by later writes to this tree */
+        PersistentBTree snapshot() const {
+            return *this;
+        }
+
+#ifdef DEBUG_MODE
+
+        /* checks occupancy, ordering, separator bounds and that all leaves sit at `height` */
+        void validate() {
+            if (!root) {
+                ASSERT(_size == 0 && height == 0);
+                return;
+            }
+            size_t count = 0;
+            validate(root, height, nullptr, nullptr, count);
+            ASSERT(count == _size);
+        }
+
+#endif
+
+        /* returns the replaced value on a hit; rvalue keys and values are moved into the tree */
+        template<typename Value = V>
+        std::optional<V> insert(const K &key, Value &&value) {
+            return insert_entry(key, std::forward<Value>(value));
+        }
+
+        template<typename Value = V>
+        std::optional<V> insert(K &&key, Value &&value) {
+            return insert_entry(std::move(key), std::forward<Value>(value));
+        }
+
+        bool empty() {
+            return _size == 0;
+        }
+
+        size_t size() {
+            return _size;
+        }
+
+        bool member(const K &key) {
+            for (auto [node, h] = std::pair(root, height); node; --h) {
+                auto [position, found] = node->search(key, comp);
+                if (found) return true;
+                if (!h) return false;
+                node = node->as_internal()->children[position];
+            }
+            return false;
+        }
+
+        iterator lower_bound(const K &key) {
+            iterator iter(this);
+            for (auto [node, h] = std::pair(root, height); node; --h) {
+                auto [position, found] = node->search(key, comp);
+                iter.push(node, position);
+                if (found || !h) break;
+                node = node->as_internal()->children[position];
+            }
+            iter.settle();
+            return iter;
+        }
+
+        iterator upper_bound(const K &key) {
+            auto iter = lower_bound(key);
+            if (iter != end() && !comp(key, (*iter).first)) ++iter;
+            return iter;
+        }
+
+        iterator find(const K &key) {
+            auto iter = lower_bound(key);
+            if (iter != end() && comp(key, (*iter).first)) return end();
+            return iter;
+        }
+
+        iterator begin() {
+            iterator iter(this);
+            if (root) iter.descend_first(root);
+            return iter;
+        }
+
+        iterator end() {
+            return iterator(this);
+        }
+
+        /* drops this tree's reference; nodes still shared with snapshots stay alive */
+        void clear() {
+            if (root) drop(root, height);
+            root = nullptr;
+            height = 0;
+            _size = 0;
+        }
+
+        size_t erase(const K &key) {
+            if (!member(key)) return 0; // a miss must not clone the path
+            std::optional<std::pair<K, V>> erased;
+            erase_from(root, height, key, erased);
+            shrink();
+            _size--;
+            return 1;
+        }
+
+        std::pair<K, V> pop_min() {
+            return pop_end(false);
+        }
+
+        std::pair<K, V> pop_max() {
+            return pop_end(true);
+        }
+    };
+}
+
+#undef keys
+#undef values
+#endif // PERSISTENT_BTREE_HPP
@@ -0,0 +1,308 @@
+#ifndef STRING_BTREE_HPP
+#define STRING_BTREE_HPP
+
+#include <btree.hpp>
+#include <bit>
+#include <string_view>
+
+namespace btree {
+
+    namespace __string_impl {
+
+        /*
+         * Bytes of the keys of one tree, in chunks that never move, so keys point into them directly. Erased keys
+         * leave their bytes behind as `dead` until the owner compacts.
+         */
+        class Arena {
+            static constexpr size_t CHUNK = 1u << 16u;
+
+            std::vector<std::unique_ptr<char[]>> chunks;
+            char *cursor = nullptr;
+            size_t left = 0;
+
+        public:
+            size_t live = 0;
+            size_t dead = 0;
+
+            Arena() = default;
+
+            /* the chunks change hands, so the source must not bump-allocate into them any more */
+            Arena(Arena &&that) noexcept
+                    : chunks(std::move(that.chunks)), cursor(std::exchange(that.cursor, nullptr)),
+                      left(std::exchange(that.left, 0)), live(std::exchange(that.live, 0)),
+                      dead(std::exchange(that.dead, 0)) {}
+
+            Arena &operator=(Arena &&that) noexcept {
+                if (this != &that) {
+                    chunks = std::move(that.chunks);
+                    that.chunks.clear();
+                    cursor = std::exchange(that.cursor, nullptr);
+                    left = std::exchange(that.left, 0);
+                    live = std::exchange(that.live, 0);
+                    dead = std::exchange(that.dead, 0);
+                }
+                return *this;
+            }
+
+            const char *store(std::string_view bytes) {
+                live += bytes.size();
+                if (bytes.size() > CHUNK / 4) { // a chunk of its own, so the current one is not abandoned
+                    chunks.emplace_back(new char[bytes.size()]);
+                    std::memcpy(chunks.back().get(), bytes.data(), bytes.size());
+                    return chunks.back().get();
+                }
+                if (bytes.size() > left) {
+                    chunks.emplace_back(new char[CHUNK]);
+                    cursor = chunks.back().get();
+                    left = CHUNK;
+                }
+                std::memcpy(cursor, bytes.data(), bytes.size());
+                auto at = cursor;
+                cursor += bytes.size();
+                left -= bytes.size();
+                return at;
+            }
+
+            void release(size_t bytes) {
+                live -= bytes;
+                dead += bytes;
+            }
+        };
+
+        /*
+         * What a node holds for a string: the 8 bytes after the tree's common prefix read as a big-endian
+         * integer, zero-padded, so that comparing integers compares those bytes, and where the whole string is.
+         * Trivially copyable, so moving keys around nodes never allocates.
+         */
+        struct Key {
+            uint64_t prefix;
+            size_t length; // full width: a 32-bit length would only save padding, and cut keys of 4GB or more
+            const char *bytes;
+
+            std::string_view view() const {
+                return {bytes, length};
+            }
+
+            static uint64_t prefix_of(std::string_view string, size_t skip) {
+                uint64_t prefix = 0;
+                if (skip < string.size()) {
+                    std::memcpy(&prefix, string.data() + skip, std::min<size_t>(8, string.size() - skip));
+                }
+                if constexpr (std::endian::native == std::endian::little) prefix = __builtin_bswap64(prefix);
+                return prefix;
+            }
+
+            static Key of(std::string_view string, size_t skip) {
+                return {prefix_of(string, skip), string.size(), string.data()};
+            }
+        };
+
+        /* full strings are read only when the inline prefixes tie */
+        struct Less {
+            bool operator()(const Key &a, const Key &b) const {
+                if (a.prefix != b.prefix) return a.prefix < b.prefix;
+                return a.view() < b.view();
+            }
+        };
+    }
+
+    /*
+     * Map from strings to `V` over a `BTree` whose keys are 8-byte inline prefixes plus pointers into a per-tree
+     * byte arena, so descents compare integers and only dereference a string when two prefixes tie. The
+     * leading bytes that every key shares, such as a URL scheme and host, are left out of the prefixes: they
+     * would make every prefix tie. A key that does not share them shrinks the common part and has every
+     * prefix recomputed in place, which can only happen as many times as the first key is long. Lookups take
+     * `std::string_view` and build nothing on the heap.
+     */
+    template<typename V, unsigned Search = BINARY_SEARCH, size_t B = DEFAULT_BTREE_FACTOR,
+            typename Alloc = std::allocator<std::pair<const __string_impl::Key, V>>>
+    class StringBTree {
+        using Key = __string_impl::Key;
+        using Tree = BTree<Key, V, Search, B, __string_impl::Less, Alloc>;
+        using TreeIterator = typename Tree::iterator;
+
+        Tree tree;
+        __string_impl::Arena arena;
+        std::string common; // bytes every key starts with; the first key in full while it is alone
+
+        /* nodes order keys by what they hold, so fields that keep the order may be rewritten in place */
+        static Key &writable(const Key &key) {
+            return const_cast<Key &>(key);
+        }
+
+        /* narrows `common` to what `string` shares with it and recomputes the prefixes if it changed */
+        void share(std::string_view string) {
+            if (tree.empty()) {
+                common = string;
+                return;
+            }
+            auto shared = size_t(std::mismatch(common.begin(), common.end(), string.begin(), string.end()).first -
+                                 common.begin());
+            if (shared == common.size()) return;
+            common.resize(shared);
+            for (auto i : tree) {
+                writable(i.first).prefix = Key::prefix_of(i.first.view(), shared);
+            }
+        }
+
+        /* where `string` falls against keys that all start with `common`: before all (-1), after all (1), or 0 */
+        int outside(std::string_view string) const {
+            auto n = std::min(common.size(), string.size());
+            auto order = std::memcmp(string.data(), common.data(), n);
+            if (order) return order < 0 ? -1 : 1;
+            return string.size() < common.size() ? -1 : 0;
+        }
+
+        /* moves the live keys to a fresh arena once more of the old one is dead than alive */
+        void compact() {
+            __string_impl::Arena fresh;
+            for (auto i : tree) {
+                writable(i.first).bytes = fresh.store(i.first.view());
+            }
+            arena = std::move(fresh);
+        }
+
+    public:
+        class iterator {
+            TreeIterator inner;
+
+            friend class StringBTree;
+
+            explicit iterator(TreeIterator inner) : inner(inner) {}
+
+        public:
+            inline bool operator!=(const iterator &that) noexcept {
+                return inner != that.inner;
+            }
+
+            iterator &operator++() {
+                ++inner;
+                return *this;
+            }
+
+            iterator &operator--() {
+                --inner;
+                return *this;
+            }
+
+            std::pair<std::string_view, V &> operator*() {
+                auto entry = *inner;
+                return {entry.first.view(), entry.second};
+            }
+        };
+
+        StringBTree() = default;
+
+        /* copies the nodes, then gives the copy its own arena */
+        StringBTree(const StringBTree &that) : tree(that.tree), common(that.common) {
+            for (auto i : tree) {
+                writable(i.first).bytes = arena.store(i.first.view());
+            }
+        }
+
+        StringBTree(StringBTree &&that) noexcept = default;
+
+        StringBTree &operator=(const StringBTree &that) {
+            if (this != &that) {
+                StringBTree copy(that);
+                swap(copy);
+            }
+            return *this;
+        }
+
+        StringBTree &operator=(StringBTree &&that) noexcept = default;
+
+        void swap(StringBTree &that) noexcept {
+            using std::swap;
+            tree.swap(that.tree);
+            swap(arena, that.arena);
+            swap(common, that.common);
+        }
+
+#ifdef DEBUG_MODE
+
+        /* the tree itself, every key starting with `common` under the prefix it would get now, and the arena */
+        void validate() {
+            tree.validate();
+            size_t bytes = 0;
+            for (auto i : tree) {
+                auto key = i.first.view();
+                ASSERT(key.substr(0, common.size()) == common);
+                ASSERT(i.first.prefix == Key::prefix_of(key, common.size()));
+                bytes += key.size();
+            }
+            ASSERT(bytes == arena.live);
+        }
+
+#endif
+
+        /* returns the replaced value on a hit; the key is copied into the arena only when it is new */
+        template<typename Value = V>
+        std::optional<V> insert(std::string_view key, Value &&value) {
+            share(key);
+            auto [iter, fresh] = tree.try_emplace(Key::of(key, common.size()), std::forward<Value>(value));
+            if (!fresh) {
+                return std::exchange((*iter).second, V(std::forward<Value>(value)));
+            }
+            writable((*iter).first).bytes = arena.store(key);
+            return std::nullopt;
+        }
+
+        bool member(std::string_view key) {
+            return !outside(key) && tree.member(Key::of(key, common.size()));
+        }
+
+        iterator find(std::string_view key) {
+            if (outside(key)) return end();
+            return iterator(tree.find(Key::of(key, common.size())));
+        }
+
+        iterator lower_bound(std::string_view key) {
+            if (auto side = outside(key)) return side < 0 ? begin() : end();
+            return iterator(tree.lower_bound(Key::of(key, common.size())));
+        }
+
+        size_t erase(std::string_view key) {
+            if (outside(key)) return 0;
+            auto iter = tree.find(Key::of(key, common.size()));
+            if (!(iter != tree.end())) return 0;
+            arena.release(key.size());
+            tree.erase(iter);
+            if (tree.empty()) {
+                clear();
+            } else if (arena.dead > arena.live) {
+                compact();
+            }
+            return 1;
+        }
+
+        void clear() {
+            tree.clear();
+            arena = __string_impl::Arena();
+            common.clear();
+        }
+
+        bool empty() {
+            return tree.empty();
+        }
+
+        size_t size() {
+            return tree.size();
+        }
+
+        /* bytes of key text held for the live keys and still held for erased ones */
+        std::pair<size_t, size_t> arena_bytes() const {
+            return {arena.live, arena.dead};
+        }
+
+        iterator begin() {
+            return iterator(tree.begin());
+        }
+
+        iterator end() {
+            return iterator(tree.end());
+        }
+    };
+}
+
+#endif // STRING_BTREE_HPP
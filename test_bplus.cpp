@@ -0,0 +1,151 @@
+#include <map>
+#include <random>
+#include <string>
+
+#define DEBUG_MODE
+#define DEFAULT_BTREE_FACTOR 6
+
+#include <bplustree.hpp>
+
+#define LIMIT 20
+
+using namespace btree;
+
+template<typename Tree, typename Key>
+void check_tree(Key scale, int range) {
+    std::map<Key, int> a;
+    Tree test;
+    for (int round = 0; round < 20; ++round) {
+        for (int i = 0; i < LIMIT * 50; ++i) {
+            auto k = Key(rand() % range) * scale;
+            auto v = rand();
+            auto old = test.insert(k, v);
+            auto iter = a.find(k);
+            ASSERT(bool(old) == (iter != a.end()));
+            if (old) {
+                ASSERT(*old == iter->second);
+            }
+            a[k] = v;
+        }
+        test.validate();
+        for (int i = 0; i < LIMIT * 40; ++i) {
+            auto k = Key(rand() % range) * scale;
+            ASSERT(test.erase(k) == a.erase(k));
+        }
+        test.validate();
+        ASSERT(test.size() == a.size());
+        for (int i = 0; i < LIMIT * 10; ++i) {
+            auto k = Key(rand() % (range + 10)) * scale;
+            ASSERT(test.member(k) == a.count(k));
+            auto lower = test.lower_bound(k);
+            auto upper = test.upper_bound(k);
+            if (a.lower_bound(k) == a.end()) {
+                ASSERT(!(lower != test.end()));
+            } else {
+                ASSERT((*lower).first == a.lower_bound(k)->first);
+            }
+            if (a.upper_bound(k) == a.end()) {
+                ASSERT(!(upper != test.end()));
+            } else {
+                ASSERT((*upper).first == a.upper_bound(k)->first);
+            }
+        }
+    }
+    auto iter = test.begin();
+    for (auto &i : a) {
+        ASSERT((*iter).first == i.first && (*iter).second == i.second);
+        ++iter;
+    }
+    ASSERT(!(iter != test.end()));
+    while (!test.empty()) {
+        ASSERT(test.pop_max().first == a.rbegin()->first);
+        a.erase(std::prev(a.end()));
+        if (!test.empty()) {
+            ASSERT(test.pop_min().first == a.begin()->first);
+            a.erase(a.begin());
+        }
+    }
+    test.validate();
+}
+
+int main() {
+    auto seed = time(nullptr);
+    std::cout << seed << std::endl;
+    srand(seed);
+    check_tree<BPlusTree<int, int>>(1, LIMIT * 200);
+    check_tree<BPlusTree<int, int, LINEAR_SEARCH, 3>>(1, LIMIT * 200);
+    check_tree<BPlusTree<int64_t, int, SIMD_SEARCH, 16>>(-3'000'000'000ll, LIMIT * 2000);
+    check_tree<BPlusTree<double, int, SIMD_SEARCH, 3>>(0.5, 50);
+    ASSERT(alive_node == 0);
+    {
+        std::map<int, std::string> a;
+        BPlusTree<int, std::string, BINARY_SEARCH, 3> test;
+        for (int i = 0; i < LIMIT * 500; ++i) {
+            auto k = rand() % (LIMIT * 1000);
+            auto [iter, inserted] = test.try_emplace(k, 10, char('a' + k % 26));
+            ASSERT(inserted == a.emplace(k, std::string(10, char('a' + k % 26))).second);
+            ASSERT((*iter).first == k && (*iter).second == a[k]);
+            if (i % 3 == 0) {
+                test.insert_or_assign(k, std::to_string(i));
+                a[k] = std::to_string(i);
+            }
+        }
+        test.validate();
+        auto copied = test;
+        copied.validate();
+        for (int i = 0; i < LIMIT * 500; ++i) {
+            auto k = rand() % (LIMIT * 1000);
+            ASSERT(copied.erase(k) == a.erase(k));
+        }
+        copied.validate();
+        auto iter = copied.find(a.rbegin()->first);
+        for (auto i = a.rbegin(); i != a.rend(); ++i) {
+            ASSERT((*iter).first == i->first && (*iter).second == i->second);
+            --iter;
+        }
+        ASSERT(!(iter != copied.end()));
+        auto moved = std::move(copied);
+        moved.validate();
+        ASSERT(moved.size() == a.size() && copied.empty());
+    }
+    ASSERT(alive_node == 0);
+    for (int n : {0, 1, 2, 5, 10, 11, 12, 13, 100, 1000, LIMIT * 1000 + 7}) {
+        for (auto fill : {0.0, 0.5, 0.7, 1.0}) {
+            std::vector<std::pair<int, int>> input;
+            for (int i = 0; i < n; ++i) {
+                input.emplace_back(2 * i, i);
+            }
+            auto test = BPlusTree<int, int, BINARY_SEARCH, 3>::from_sorted(input.begin(), input.end(), fill);
+            test.validate();
+            ASSERT(test.size() == input.size());
+            auto iter = input.begin();
+            for (auto i : test) {
+                ASSERT(i.first == iter->first && i.second == iter->second);
+                ++iter;
+            }
+            for (int i = 0; i < n; ++i) {
+                ASSERT(test.member(2 * i) && !test.member(2 * i + 1));
+                test.insert(2 * i + 1, i);
+            }
+            test.validate();
+            while (test.size() > input.size() / 2) {
+                test.pop_min();
+            }
+            test.validate();
+        }
+    }
+    ASSERT(alive_node == 0);
+    {
+        using Slab = BPlusTree<int, int, BINARY_SEARCH, DEFAULT_BTREE_FACTOR, std::less<int>,
+                SlabAllocator<std::pair<const int, int>>>;
+        Slab test;
+        for (int i = 0; i < LIMIT * 1000; ++i) {
+            test.insert(rand(), i);
+        }
+        test.validate();
+        test.clear();
+        ASSERT(test.empty());
+    }
+    ASSERT(alive_node == 0);
+    return 0;
+}
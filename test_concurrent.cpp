@@ -0,0 +1,130 @@
+#include <map>
+#include <random>
+#include <thread>
+
+#define DEBUG_MODE
+#define DEFAULT_BTREE_FACTOR 6
+
+#include <concurrent_btree.hpp>
+
+#define LIMIT 20
+
+using namespace btree;
+
+template<typename Tree, typename Key>
+void check_sequential(Key scale, int range) {
+    std::map<Key, int> a;
+    Tree test;
+    for (int round = 0; round < 20; ++round) {
+        for (int i = 0; i < LIMIT * 50; ++i) {
+            auto k = Key(rand() % range) * scale;
+            auto v = rand();
+            auto old = test.insert(k, v);
+            auto iter = a.find(k);
+            ASSERT(bool(old) == (iter != a.end()));
+            if (old) {
+                ASSERT(*old == iter->second);
+            }
+            a[k] = v;
+        }
+        test.validate();
+        for (int i = 0; i < LIMIT * 45; ++i) {
+            auto k = Key(rand() % range) * scale;
+            auto iter = a.find(k);
+            auto erased = test.erase(k);
+            ASSERT(bool(erased) == (iter != a.end()));
+            if (erased) {
+                ASSERT(*erased == iter->second);
+                a.erase(iter);
+            }
+        }
+        test.validate();
+        ASSERT(test.size() == a.size());
+        for (int i = 0; i < LIMIT * 10; ++i) {
+            auto k = Key(rand() % (range + 10)) * scale;
+            auto found = test.find(k);
+            ASSERT(bool(found) == a.count(k));
+            if (found) {
+                ASSERT(*found == a[k]);
+            }
+        }
+    }
+    for (auto &i : a) {
+        ASSERT(test.erase(i.first));
+    }
+    test.validate();
+    ASSERT(test.empty());
+}
+
+/*
+ * Each thread owns the keys congruent to its index and checks them against its own map, while it also reads the
+ * keys of everyone else, whose values always encode the key they are stored under.
+ */
+template<typename Tree>
+void check_threads(int threads, int range) {
+    Tree test;
+    std::vector<std::map<int, int>> owned(threads);
+    std::vector<std::thread> workers;
+    for (int t = 0; t < threads; ++t) {
+        workers.emplace_back([&, t] {
+            std::mt19937 rng(t);
+            auto &a = owned[t];
+            for (int i = 0; i < LIMIT * 2000; ++i) {
+                auto k = int(rng() % range) / threads * threads + t;
+                switch (rng() % 4) {
+                    case 0:
+                    case 1: {
+                        auto v = k + range * int(rng() % 100);
+                        auto old = test.insert(k, v);
+                        ASSERT(bool(old) == a.count(k));
+                        a[k] = v;
+                        break;
+                    }
+                    case 2: {
+                        auto erased = test.erase(k);
+                        ASSERT(bool(erased) == a.count(k));
+                        a.erase(k);
+                        break;
+                    }
+                    default: {
+                        auto other = int(rng() % range);
+                        auto found = test.find(other);
+                        ASSERT(!found || *found % range == other);
+                        if (other % threads == t) {
+                            ASSERT(bool(found) == a.count(other));
+                        }
+                    }
+                }
+            }
+        });
+    }
+    for (auto &i : workers) {
+        i.join();
+    }
+    test.validate();
+    size_t total = 0;
+    for (auto &a : owned) {
+        total += a.size();
+        for (auto &i : a) {
+            ASSERT(test.find(i.first) == i.second);
+        }
+    }
+    ASSERT(test.size() == total);
+}
+
+int main() {
+    auto seed = time(nullptr);
+    std::cout << seed << std::endl;
+    srand(seed);
+    check_sequential<ConcurrentBTree<int, int>>(1, LIMIT * 200);
+    check_sequential<ConcurrentBTree<int, int, LINEAR_SEARCH, 3>>(1, LIMIT * 200);
+    check_sequential<ConcurrentBTree<int64_t, int, SIMD_SEARCH, 16>>(-3'000'000'000ll, LIMIT * 2000);
+    check_sequential<ConcurrentBTree<double, int, SIMD_SEARCH, 3>>(0.5, 50);
+    ASSERT(alive_node == 0);
+    for (int range : {64, LIMIT * 100, LIMIT * 100000}) {
+        check_threads<ConcurrentBTree<int, int, BINARY_SEARCH, 3>>(4, range);
+        check_threads<ConcurrentBTree<int, int>>(8, range);
+    }
+    ASSERT(alive_node == 0);
+    return 0;
+}
@@ -6,14 +6,16 @@
 #define DEFAULT_BTREE_FACTOR 6
 
 #include <btree.hpp>
+#include <map>
 #include <set>
+#include <sstream>
 #define LIMIT 20000
 #define POP_LIMIT 20000
 
 using namespace btree;
 
 struct Cell {
-    static size_t ctor, dtor, alive;
+    static size_t ctor, dtor, alive, copies;
     char *tag;
 
     Cell() {
@@ -24,6 +26,7 @@ struct Cell {
 
     Cell(const Cell &) {
         ctor++;
+        copies++;
         alive++;
         tag = new char;
     }
@@ -52,6 +55,109 @@ struct Cell {
 size_t Cell::ctor = 0;
 size_t Cell::dtor = 0;
 size_t Cell::alive = 0;
+size_t Cell::copies = 0;
+
+/* a comparator with state, so a node still reaching into a moved-from tree would read freed memory */
+struct Direction {
+    bool descending = false;
+
+    bool operator()(int a, int b) const {
+        return descending ? b < a : a < b;
+    }
+};
+
+/* large enough for the parallel paths, which trees below PARALLEL_THRESHOLD entries skip */
+template<typename Tree>
+void check_parallel() {
+    std::set<int> u;
+    Tree test;
+    for (int i = 0; i < LIMIT * 10; ++i) {
+        auto k = rand();
+        test.insert(k, k);
+        u.insert(k);
+    }
+    auto copy = test.parallel_copy(4);
+    copy.validate();
+    ASSERT(copy.size() == u.size());
+    auto iter = u.begin();
+    for (auto i : copy) {
+        ASSERT(i.first == *iter && i.second == *iter);
+        ++iter;
+    }
+    for (int i = 0; i < LIMIT; ++i) {
+        auto k = *u.begin();
+        ASSERT(copy.pop_min().first == k);
+        u.erase(k);
+    }
+    test.validate();
+    ASSERT(test.size() == u.size() + LIMIT);
+    test.parallel_clear(4);
+    ASSERT(test.empty());
+    test.insert(1, 1);
+    test.validate();
+    copy.validate();
+    iter = u.begin();
+    for (auto i : copy) {
+        ASSERT(i.first == *iter);
+        ++iter;
+    }
+    Reclaimer reclaimer;
+    copy.clear(reclaimer);
+    ASSERT(copy.empty());
+    copy.insert(2, 2);
+    reclaimer.drain();
+    ASSERT(copy.size() == 1 && test.size() == 1);
+}
+
+/* length-prefixed strings, the kind of codec `dump` and `load` take for keys that are not trivially copyable */
+struct StringCodec {
+    void operator()(std::string &out, const std::string &key, const std::string &value) const {
+        out.push_back(char(key.size()));
+        out += key;
+        out += value;
+    }
+
+    std::optional<std::pair<std::string, std::string>> operator()(std::string_view entry) const {
+        if (entry.empty() || size_t(uint8_t(entry[0])) >= entry.size()) return std::nullopt;
+        auto length = uint8_t(entry[0]);
+        return std::pair(std::string(entry.substr(1, length)), std::string(entry.substr(1 + length)));
+    }
+};
+
+template<typename Tree>
+void check_dump(size_t n) {
+    Tree test;
+    std::map<std::string, std::string> a;
+    for (size_t i = 0; i < n; ++i) {
+        auto k = std::to_string(rand() % (n * 2));
+        a[k] = std::string(rand() % 100, 'v');
+        test.insert(k, a[k]);
+    }
+    std::stringstream stream;
+    ASSERT(test.dump(stream, StringCodec()));
+    auto image = stream.str();
+    Tree loaded;
+    loaded.insert("stale", "stale");
+    ASSERT(loaded.load(stream, StringCodec(), 0.7));
+    loaded.validate();
+    ASSERT(loaded.size() == a.size());
+    auto iter = a.begin();
+    for (auto i : loaded) {
+        ASSERT(i.first == iter->first && i.second == iter->second);
+        ++iter;
+    }
+    for (auto &i : a) {
+        loaded.insert(i.first + "!", i.second);
+    }
+    loaded.validate();
+    // every cut of the stream short of its end is refused
+    for (size_t cut : {size_t(0), size_t(5), image.size() / 3, image.size() - 1}) {
+        if (cut >= image.size()) continue;
+        std::stringstream truncated(image.substr(0, cut));
+        ASSERT(!loaded.load(truncated, StringCodec()) && loaded.empty());
+        loaded.validate();
+    }
+}
 
 int main(int argc, char** argv) {
     auto seed = argc > 1 ? std::atoi(argv[1]) : time(nullptr);
@@ -89,4 +195,168 @@ int main(int argc, char** argv) {
     ASSERT(Cell::ctor == Cell::dtor);
     ASSERT(alive_node == 0);
     ASSERT(Cell::alive == 0);
+    {
+        BTree<int, Cell, true, 3> test;
+        std::set<int> u;
+        auto copies = Cell::copies;
+        for (int i = 0; i < LIMIT; ++i) {
+            auto k = rand() % LIMIT;
+            auto fresh = !u.count(k);
+            std::pair<BTree<int, Cell, true, 3>::iterator, bool> res;
+            switch (i % 4) {
+                case 0:
+                    ASSERT(test.insert(k, Cell()).has_value() != fresh);
+                    res = {test.find(k), fresh};
+                    break;
+                case 1:
+                    res = test.try_emplace(k);
+                    break;
+                case 2:
+                    res = test.insert_or_assign(k, Cell());
+                    break;
+                default:
+                    res = test.emplace(k, Cell());
+            }
+            u.insert(k);
+            ASSERT(res.second == fresh);
+            ASSERT((*res.first).first == k);
+            ASSERT(Cell::alive == u.size());
+        }
+        ASSERT(Cell::copies == copies);
+        ASSERT(test.size() == u.size());
+        test.validate();
+        auto ctor = Cell::ctor;
+        for (auto k : u) {
+            ASSERT(!test.try_emplace(k).second);
+        }
+        ASSERT(Cell::ctor == ctor);
+        Cell cell;
+        test.insert(LIMIT, cell);
+        ASSERT(Cell::copies == copies + 1);
+    }
+    std::cout << "ctor: " << Cell::ctor << ", dtor: " << Cell::dtor << std::endl;
+    ASSERT(Cell::ctor == Cell::dtor);
+    ASSERT(alive_node == 0);
+    ASSERT(Cell::alive == 0);
+    {
+        BTree<int, Cell, true, DEFAULT_BTREE_FACTOR, std::less<int>, SlabAllocator<std::pair<const int, Cell>>> test;
+        for (int i = 0; i < LIMIT; ++i) {
+            test.insert(rand(), Cell());
+        }
+        for (int i = 0; i < LIMIT / 2 && !test.empty(); ++i) {
+            test.pop_min();
+        }
+        auto copied = test;
+        ASSERT(copied.size() == test.size());
+        test.clear();
+        ASSERT(test.empty());
+        for (int i = 0; i < LIMIT; ++i) {
+            test.insert(rand(), Cell());
+        }
+    }
+    std::cout << "ctor: " << Cell::ctor << ", dtor: " << Cell::dtor << std::endl;
+    ASSERT(Cell::ctor == Cell::dtor);
+    ASSERT(alive_node == 0);
+    ASSERT(Cell::alive == 0);
+    {
+        using Tree = BTree<int, Cell, true, 3, Direction>;
+        auto source = std::make_unique<Tree>(Direction{true});
+        std::set<int, std::greater<>> u;
+        for (int i = 0; i < LIMIT; ++i) {
+            auto k = rand() % LIMIT;
+            source->insert(k, Cell());
+            u.insert(k);
+        }
+        size_t alive = alive_node;
+        Tree moved(std::move(*source));
+        ASSERT(source->empty() && alive_node == alive);
+        source.reset();
+        for (int i = 0; i < LIMIT; ++i) {
+            auto k = rand() % LIMIT;
+            ASSERT(moved.erase(k) == u.erase(k));
+        }
+        moved.validate();
+        Tree other;
+        other.insert(1, Cell());
+        other.insert(2, Cell());
+        other = std::move(moved);
+        ASSERT(moved.empty() && other.size() == u.size());
+        moved.insert(1, Cell());
+        moved.swap(other);
+        ASSERT(other.size() == 1 && moved.size() == u.size());
+        moved.insert(LIMIT, Cell());
+        u.insert(LIMIT);
+        moved.validate();
+        auto iter = u.begin();
+        for (auto i : moved) {
+            ASSERT(i.first == *iter);
+            ++iter;
+        }
+    }
+    ASSERT(alive_node == 0);
+    ASSERT(Cell::alive == 0);
+    check_parallel<BTree<int, int>>();
+    check_parallel<BTree<int, int, BINARY_SEARCH, 3, std::less<int>, std::allocator<std::pair<const int, int>>,
+            LEAF_LINKS | ORDER_STATISTICS>>();
+    check_parallel<BTree<int, int, BINARY_SEARCH, DEFAULT_BTREE_FACTOR, std::less<int>,
+            SlabAllocator<std::pair<const int, int>>>>();
+    ASSERT(alive_node == 0);
+    for (size_t n : {0, 1, 10, 11, 12, 1000, LIMIT * 5}) {
+        check_dump<BTree<std::string, std::string>>(n);
+        check_dump<BTree<std::string, std::string, BINARY_SEARCH, 3, std::less<std::string>,
+                std::allocator<std::pair<const std::string, std::string>>, LEAF_LINKS | ORDER_STATISTICS>>(n);
+    }
+    {
+        BTree<int64_t, double> test;
+        for (int i = 0; i < LIMIT; ++i) {
+            test.insert(int64_t(rand()) << 20, i * 0.5);
+        }
+        std::stringstream stream;
+        ASSERT(test.dump(stream));
+        BTree<int64_t, double> loaded;
+        ASSERT(loaded.load(stream));
+        loaded.validate();
+        auto iter = test.begin();
+        for (auto i : loaded) {
+            ASSERT(i.first == (*iter).first && i.second == (*iter).second);
+            ++iter;
+        }
+        // a stream of another entry size, or one whose keys go backwards, is refused
+        std::stringstream other;
+        BTree<int, int> small;
+        small.insert(1, 1);
+        small.dump(other);
+        ASSERT(!loaded.load(other) && loaded.empty());
+        std::stringstream backwards;
+        BTree<int, int, BINARY_SEARCH, DEFAULT_BTREE_FACTOR, std::greater<int>> reversed;
+        for (int i = 0; i < LIMIT; ++i) {
+            reversed.insert(i, i);
+        }
+        reversed.dump(backwards);
+        ASSERT(!small.load(backwards) && small.empty());
+        // a block header claiming more than `dump` ever writes is refused before anything is allocated for it
+        std::string header(__btree_impl::DUMP_MAGIC, sizeof(__btree_impl::DUMP_MAGIC));
+        for (uint32_t bytes : {uint32_t(0xFFFFFFFFu), uint32_t(__btree_impl::DUMP_BLOCK_LIMIT + 1)}) {
+            std::string head = header;
+            __btree_impl::put_u32(head, 1);
+            __btree_impl::put_u32(head, bytes);
+            std::stringstream huge(head + std::string(64, '\0'));
+            ASSERT(!small.load(huge) && small.empty());
+        }
+    }
+    {
+        // an entry longer than a block fails the dump instead of writing a block `load` would refuse
+        BTree<std::string, std::string> test;
+        test.insert("key", std::string(__btree_impl::DUMP_BLOCK, 'v'));
+        std::stringstream stream;
+        ASSERT(!test.dump(stream, StringCodec()));
+        test.clear();
+        test.insert("key", std::string(__btree_impl::DUMP_BLOCK - 4, 'v'));
+        for (int i = 0; i < 100; ++i) test.insert("k" + std::to_string(i), std::string(1000, 'v'));
+        std::stringstream fits;
+        ASSERT(test.dump(fits, StringCodec()));
+        BTree<std::string, std::string> loaded;
+        ASSERT(loaded.load(fits, StringCodec()) && loaded.size() == test.size());
+    }
+    ASSERT(alive_node == 0);
 }
\ No newline at end of file
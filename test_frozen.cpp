@@ -0,0 +1,96 @@
+#include <map>
+#include <random>
+#include <string>
+
+#define DEBUG_MODE
+#define DEFAULT_BTREE_FACTOR 6
+
+#include <frozen_btree.hpp>
+
+#define LIMIT 20
+
+using namespace btree;
+
+template<typename Tree, typename Frozen, typename Key, typename Compare = std::less<Key>>
+void check_frozen(Key scale, int range, int count) {
+    std::map<Key, int, Compare> a;
+    Tree test;
+    for (int i = 0; i < count; ++i) {
+        auto k = Key(rand() % range) * scale;
+        auto v = rand();
+        test.insert(k, v);
+        a[k] = v;
+    }
+    auto frozen = Frozen::freeze(test);
+    test.clear();
+    frozen.validate();
+    ASSERT(frozen.size() == a.size());
+    auto iter = frozen.begin();
+    for (auto &i : a) {
+        ASSERT((*iter).first == i.first && (*iter).second == i.second);
+        ++iter;
+    }
+    ASSERT(!(iter != frozen.end()));
+    for (int i = 0; i < LIMIT * 100; ++i) {
+        auto k = Key(rand() % (range + 10) - 5) * scale;
+        ASSERT(frozen.member(k) == a.count(k));
+        auto found = frozen.find(k);
+        ASSERT((found != frozen.end()) == a.count(k));
+        if (found != frozen.end()) {
+            ASSERT((*found).second == a[k]);
+        }
+        auto lower = frozen.lower_bound(k);
+        auto upper = frozen.upper_bound(k);
+        if (a.lower_bound(k) == a.end()) {
+            ASSERT(!(lower != frozen.end()));
+        } else {
+            ASSERT((*lower).first == a.lower_bound(k)->first);
+        }
+        if (a.upper_bound(k) == a.end()) {
+            ASSERT(!(upper != frozen.end()));
+        } else {
+            ASSERT((*upper).first == a.upper_bound(k)->first);
+        }
+    }
+    for (auto &i : a) {
+        ASSERT(frozen.member(i.first));
+    }
+    auto moved = std::move(frozen);
+    ASSERT(frozen.empty() && !(frozen.begin() != frozen.end()) && moved.size() == a.size());
+}
+
+int main() {
+    auto seed = time(nullptr);
+    std::cout << seed << std::endl;
+    srand(seed);
+    // sizes around a full block, a full layer of blocks and the layers above
+    for (int count : {0, 1, 15, 16, 17, 272, 273, 289, 4624, 4625, LIMIT * 5000}) {
+        check_frozen<BTree<int, int>, FrozenBTree<int, int>>(1, count * 3 + 1, count);
+        check_frozen<BTree<int, int, BINARY_SEARCH, 3, std::greater<int>>, FrozenBTree<int, int, std::greater<int>>,
+                int, std::greater<int>>(1, count * 3 + 1, count);
+    }
+    check_frozen<BTree<int64_t, int, SIMD_SEARCH, 16>, FrozenBTree<int64_t, int>>(-3'000'000'000ll, LIMIT * 2000,
+                                                                                  LIMIT * 1000);
+    check_frozen<BTree<double, int>, FrozenBTree<double, int>>(0.5, 50, LIMIT * 10);
+    {
+        std::map<std::string, std::string> a;
+        BTree<std::string, std::string> test;
+        for (int i = 0; i < LIMIT * 100; ++i) {
+            auto k = std::to_string(rand() % (LIMIT * 200));
+            a[k] = k + k;
+            test.insert(k, k + k);
+        }
+        auto frozen = FrozenBTree<std::string, std::string>::freeze(test);
+        frozen.validate();
+        for (int i = 0; i < LIMIT * 100; ++i) {
+            auto k = std::to_string(rand() % (LIMIT * 250));
+            auto found = frozen.find(k);
+            ASSERT((found != frozen.end()) == a.count(k));
+            if (found != frozen.end()) {
+                ASSERT((*found).second == k + k);
+            }
+        }
+    }
+    ASSERT(alive_node == 0);
+    return 0;
+}
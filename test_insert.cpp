@@ -5,11 +5,122 @@
 #define DEFAULT_BTREE_FACTOR 6
 
 #include <btree.hpp>
+#include <map>
+#include <string>
 
 #define LIMIT 20
 
 using namespace btree;
 
+template<typename Tree, typename Key>
+void check_search(Key scale) {
+    std::vector<Key> a;
+    Tree test;
+    for (int i = 0; i < LIMIT * 100; ++i) {
+        auto k = Key(rand() % 5000) * scale;
+        a.push_back(k);
+        test.insert(k, 0);
+    }
+    std::sort(a.begin(), a.end());
+    a.erase(unique(a.begin(), a.end()), a.end());
+    ASSERT(test.size() == a.size());
+    for (int i = 0; i < LIMIT * 100; ++i) {
+        auto target = Key(rand() % 6000) * scale;
+        ASSERT(std::binary_search(a.begin(), a.end(), target) == test.member(target));
+    }
+    using Stored = std::remove_cvref_t<decltype((*test.begin()).first)>; // `Key` is only the type of `scale`
+    for (size_t n : {0, 1, 15, 16, 17, LIMIT * 100}) {
+        std::vector<Stored> batch;
+        for (size_t i = 0; i < n; ++i) {
+            batch.push_back(Stored(rand() % 6000) * scale);
+        }
+        std::unique_ptr<bool[]> hits(new bool[n]);
+        std::vector<typename Tree::iterator> found(n);
+        test.member_batch(batch, std::span(hits.get(), n));
+        test.find_batch(batch, found);
+        for (size_t i = 0; i < n; ++i) {
+            ASSERT(hits[i] == std::binary_search(a.begin(), a.end(), batch[i]));
+            ASSERT(!(found[i] != test.find(batch[i])));
+        }
+    }
+    Tree empty;
+    std::vector<Stored> batch(LIMIT, scale);
+    std::vector<typename Tree::iterator> found(LIMIT, test.begin());
+    empty.find_batch(batch, found);
+    for (auto &i : found) {
+        ASSERT(!(i != empty.end()));
+    }
+}
+
+/* only explicitly constructible, so a lookup by `std::string_view` compiles only if it needs no `Name` */
+struct Name {
+    std::string text;
+
+    explicit Name(std::string_view text) : text(text) {}
+};
+
+struct NameLess {
+    using is_transparent = void;
+
+    bool operator()(const Name &a, const Name &b) const {
+        return a.text < b.text;
+    }
+
+    bool operator()(const Name &a, std::string_view b) const {
+        return a.text < b;
+    }
+
+    bool operator()(std::string_view a, const Name &b) const {
+        return a < b.text;
+    }
+};
+
+template<typename Tree>
+void check_set_algebra(int range) {
+    std::map<int, int> a, b;
+    Tree x, y;
+    for (int i = 0; i < LIMIT * 500; ++i) {
+        auto k = rand() % range;
+        a[k] = k;
+        x.insert(k, k);
+        k = rand() % range;
+        b[k] = -k;
+        y.insert(k, -k);
+    }
+    auto sum = [](const int &, int l, int r) { return l + r; };
+    auto check = [](Tree &tree, const std::map<int, int> &expected) {
+        tree.validate();
+        ASSERT(tree.size() == expected.size());
+        auto iter = tree.begin();
+        for (auto &i : expected) {
+            ASSERT((*iter).first == i.first && (*iter).second == i.second);
+            ++iter;
+        }
+    };
+    std::map<int, int> u = b, n, d;
+    for (auto &i : a) {
+        auto hit = b.find(i.first);
+        u[i.first] = hit == b.end() ? i.second : i.second + hit->second;
+        if (hit != b.end()) n[i.first] = i.second;
+        else d[i.first] = i.second;
+    }
+    auto joined = Tree::set_union(x, y, sum);
+    check(joined, u);
+    auto common = Tree::set_intersection(x, y);
+    check(common, n);
+    auto rest = Tree::set_difference(x, y);
+    check(rest, d);
+    check(x, a);
+    check(y, b);
+    x.merge_from(std::move(y), sum);
+    check(x, u);
+    ASSERT(y.empty());
+    x.insert(range, range);
+    u[range] = range;
+    y.merge_from(std::move(x));
+    check(y, u);
+}
+
 int main() {
     {
         auto seed = time(nullptr);
@@ -49,5 +160,207 @@ int main() {
         }
     }
     ASSERT(alive_node == 0);
+    {
+        std::map<int, int> a;
+        BTree<int, int> test;
+        for (int i = 0; i < LIMIT * 100; ++i) {
+            auto k = rand() % (LIMIT * 200);
+            a[k] = k;
+            test.insert(k, k);
+        }
+        for (int i = 0; i < LIMIT * 100; ++i) {
+            auto k = rand() % (LIMIT * 200);
+            auto iter = test.find(k);
+            ASSERT((iter != test.end()) == a.count(k));
+            if (iter != test.end()) {
+                (*iter).second += 1;
+                a[k] += 1;
+            }
+            auto lower = test.lower_bound(k);
+            auto upper = test.upper_bound(k);
+            auto range = test.equal_range(k);
+            ASSERT(!(lower != range.first) && !(upper != range.second));
+            if (a.lower_bound(k) == a.end()) {
+                ASSERT(!(lower != test.end()));
+            } else {
+                ASSERT((*lower).first == a.lower_bound(k)->first);
+            }
+            if (a.upper_bound(k) == a.end()) {
+                ASSERT(!(upper != test.end()));
+            } else {
+                ASSERT((*upper).first == a.upper_bound(k)->first);
+            }
+            auto expected = a.lower_bound(k);
+            for (int j = 0; j < 8 && lower != test.end(); ++j, ++lower, ++expected) {
+                ASSERT((*lower).first == expected->first && (*lower).second == expected->second);
+            }
+        }
+    }
+    for (int n : {0, 1, 2, 5, 10, 11, 12, 13, 100, 1000, LIMIT * 1000 + 7}) {
+        for (auto fill : {0.0, 0.5, 0.7, 1.0}) {
+            std::vector<std::pair<int, int>> input;
+            for (int i = 0; i < n; ++i) {
+                input.emplace_back(2 * i, i);
+            }
+            auto test = BTree<int, int>::from_sorted(input.begin(), input.end(), fill);
+            test.validate();
+            ASSERT(test.size() == input.size());
+            auto iter = input.begin();
+            for (auto i : test) {
+                ASSERT(i.first == iter->first && i.second == iter->second);
+                ++iter;
+            }
+            for (int i = 0; i < n; ++i) {
+                ASSERT(test.member(2 * i) && !test.member(2 * i + 1));
+                test.insert(2 * i + 1, i);
+            }
+            test.validate();
+            while (test.size() > input.size() / 2) {
+                test.pop_min();
+            }
+            test.validate();
+            test.assign_sorted(input.begin(), input.begin() + n / 3, fill);
+            test.validate();
+            ASSERT(test.size() == size_t(n / 3));
+        }
+    }
+    ASSERT(alive_node == 0);
+    for (int range : {50, 5000, LIMIT * 100000}) {
+        std::map<int, int> a;
+        BTree<int, int> test;
+        for (int round = 0; round < 50; ++round) {
+            std::vector<std::pair<int, int>> batch(rand() % (LIMIT * 50));
+            for (auto &i : batch) {
+                i = {rand() % range, rand()};
+            }
+            auto results = test.insert_batch(batch);
+            ASSERT(results.size() == batch.size());
+            for (size_t i = 0; i < batch.size(); ++i) {
+                auto iter = a.find(batch[i].first);
+                ASSERT(bool(results[i]) == (iter != a.end()));
+                if (results[i]) {
+                    ASSERT(*results[i] == iter->second);
+                }
+                a[batch[i].first] = batch[i].second;
+            }
+            test.validate();
+            ASSERT(test.size() == a.size());
+        }
+        auto iter = a.begin();
+        for (auto i : test) {
+            ASSERT(i.first == iter->first && i.second == iter->second);
+            ++iter;
+        }
+    }
+    ASSERT(alive_node == 0);
+    check_search<BTree<int, int, SIMD_SEARCH>>(1);
+    check_search<BTree<int64_t, int, SIMD_SEARCH, 16>>(-3'000'000'000ll);
+    check_search<BTree<uint64_t, int, SIMD_SEARCH, 3>>(3'000'000'000ull);
+    check_search<BTree<double, int, SIMD_SEARCH>>(-0.5);
+    check_search<BTree<float, int, SIMD_SEARCH, 32>>(0.25f);
+    check_search<BTree<int, int, SIMD_SEARCH, 6, std::greater<int>>>(1); // falls back to binary search
+    check_search<BTree<int, int, LINEAR_SEARCH>>(1);
+    ASSERT(alive_node == 0);
+    for (auto erasing : {false, true}) {
+        std::map<std::string, int, std::less<>> a;
+        BTree<Name, int, BINARY_SEARCH, 3, NameLess> test;
+        BTree<std::string, int, LINEAR_SEARCH, 3, std::less<>> plain;
+        for (int i = 0; i < LIMIT * 100; ++i) {
+            auto k = std::to_string(rand() % (LIMIT * 200));
+            a[k] = i;
+            test.insert_or_assign(Name(k), i);
+            plain.insert_or_assign(k, i);
+        }
+        for (int i = 0; i < LIMIT * 200; ++i) {
+            auto text = std::to_string(rand() % (LIMIT * 220));
+            std::string_view k = text;
+            auto expected = a.find(k);
+            ASSERT(test.member(k) == (expected != a.end()) && test.count(k) == a.count(k));
+            ASSERT(plain.member(text.c_str()) == (expected != a.end()) && plain.count(k) == a.count(k));
+            auto found = test.find(k);
+            ASSERT((found != test.end()) == (expected != a.end()));
+            if (expected != a.end()) {
+                ASSERT((*found).second == expected->second && (*plain.find(k)).second == expected->second);
+            }
+            auto lower = test.lower_bound(k), upper = test.upper_bound(k);
+            ASSERT(a.lower_bound(k) == a.end() ? !(lower != test.end())
+                                             : (*lower).first.text == a.lower_bound(k)->first);
+            ASSERT(a.upper_bound(k) == a.end() ? !(upper != test.end())
+                                             : (*upper).first.text == a.upper_bound(k)->first);
+            if (erasing && i % 2) {
+                ASSERT(test.erase(k) == plain.erase(k) && plain.erase(k) == 0);
+                if (expected != a.end()) a.erase(expected);
+            }
+        }
+        test.validate();
+        plain.validate();
+        ASSERT(test.size() == a.size() && plain.size() == a.size());
+    }
+    {
+        BTree<int64_t, int, SIMD_SEARCH, 6, std::less<>> test; // keys themselves still take the vector path
+        for (int i = 0; i < LIMIT * 100; ++i) {
+            test.insert(int64_t(rand() % 5000) * 3, i);
+        }
+        for (int i = 0; i < LIMIT * 100; ++i) {
+            auto k = rand() % 15000;
+            ASSERT(test.member(k) == test.member(int64_t(k)) && test.count(k) == test.count(int64_t(k)));
+            ASSERT(!(test.lower_bound(k) != test.lower_bound(int64_t(k))));
+            ASSERT(!(test.upper_bound(k - 0.5) != test.lower_bound(int64_t(k))));
+        }
+    }
+    ASSERT(alive_node == 0);
+    {
+        using Linked = BTree<int, int, BINARY_SEARCH, 3, std::less<int>, std::allocator<std::pair<const int, int>>,
+                LEAF_LINKS>;
+        std::map<int, int> a;
+        std::vector<std::pair<int, int>> batch;
+        for (int i = 0; i < LIMIT * 1000; ++i) {
+            auto k = rand() % (LIMIT * 2000);
+            a[k] = k;
+            batch.emplace_back(k, k);
+        }
+        auto test = Linked::from_sorted(a.begin(), a.end(), 0.7);
+        test.validate();
+        for (int round = 0; round < 20; ++round) {
+            auto lo = rand() % (LIMIT * 2000), hi = lo + rand() % (LIMIT * 100);
+            test.erase_range(lo, hi);
+            a.erase(a.lower_bound(lo), a.lower_bound(hi));
+            for (int i = 0; i < LIMIT * 10; ++i) {
+                auto k = rand() % (LIMIT * 2000);
+                a[k] = k;
+                test.insert(k, k);
+            }
+            test.insert_batch(std::span(batch).subspan(round * LIMIT * 50, LIMIT * 50));
+            for (auto &i : std::span(batch).subspan(round * LIMIT * 50, LIMIT * 50)) {
+                a[i.first] = i.second;
+            }
+            for (int i = 0; i < LIMIT * 10; ++i) {
+                auto k = rand() % (LIMIT * 2000);
+                ASSERT(test.erase(k) == a.erase(k));
+            }
+            test.validate();
+        }
+        auto copied = test;
+        copied.validate();
+        auto iter = copied.begin();
+        for (auto &i : a) {
+            ASSERT((*iter).first == i.first);
+            ++iter;
+        }
+        ASSERT(!(iter != copied.end()));
+        iter = copied.find(a.rbegin()->first);
+        for (auto i = a.rbegin(); i != a.rend(); ++i) {
+            ASSERT((*iter).first == i->first);
+            --iter;
+        }
+        ASSERT(!(iter != copied.end()));
+    }
+    ASSERT(alive_node == 0);
+    for (int range : {50, LIMIT * 1000, LIMIT * 100000}) {
+        check_set_algebra<BTree<int, int, BINARY_SEARCH, 3>>(range);
+        check_set_algebra<BTree<int, int, BINARY_SEARCH, 3, std::less<int>, std::allocator<std::pair<const int, int>>,
+                LEAF_LINKS | ORDER_STATISTICS>>(range);
+    }
+    ASSERT(alive_node == 0);
     return 0;
 }
\ No newline at end of file
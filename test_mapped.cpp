@@ -0,0 +1,178 @@
+#include <fstream>
+#include <map>
+#include <random>
+#include <string>
+
+#define DEBUG_MODE
+#define DEFAULT_BTREE_FACTOR 6
+
+#include <mapped_btree.hpp>
+
+#define LIMIT 20
+
+using namespace btree;
+
+const char *IMAGE = "test_mapped.image";
+
+template<typename Mapped, typename Map>
+void check_equal(Mapped &mapped, const Map &expected) {
+    mapped.validate();
+    ASSERT(mapped.size() == expected.size());
+    auto iter = mapped.begin();
+    for (auto &i : expected) {
+        ASSERT((*iter).first == i.first && (*iter).second == i.second);
+        ++iter;
+    }
+    ASSERT(!(iter != mapped.end()));
+    // and back from the end, which has to step over empty last nodes
+    for (auto i = expected.rbegin(); i != expected.rend(); ++i) {
+        --iter;
+        ASSERT((*iter).first == i->first && (*iter).second == i->second);
+    }
+    ASSERT(!(--iter != mapped.end()));
+}
+
+template<typename Tree, typename Mapped, typename Key>
+void check_image(Key scale, int range, int count) {
+    std::map<Key, int> a;
+    Tree test;
+    for (int i = 0; i < count; ++i) {
+        auto k = Key(rand() % range) * scale;
+        auto v = rand();
+        test.insert(k, v);
+        a[k] = v;
+    }
+    ASSERT(Mapped::save_image(test, IMAGE));
+    test.clear();
+    auto mapped = Mapped::map_image(IMAGE);
+    ASSERT(mapped.has_value());
+    check_equal(*mapped, a);
+    for (int i = 0; i < LIMIT * 100; ++i) {
+        auto k = Key(rand() % (range + 10)) * scale;
+        ASSERT(mapped->member(k) == a.count(k));
+        auto found = mapped->find(k);
+        ASSERT((found != mapped->end()) == a.count(k));
+        if (found != mapped->end()) {
+            ASSERT((*found).second == a[k]);
+        }
+        auto lower = mapped->lower_bound(k);
+        auto upper = mapped->upper_bound(k);
+        if (a.lower_bound(k) == a.end()) {
+            ASSERT(!(lower != mapped->end()));
+        } else {
+            ASSERT((*lower).first == a.lower_bound(k)->first);
+        }
+        if (a.upper_bound(k) == a.end()) {
+            ASSERT(!(upper != mapped->end()));
+        } else {
+            ASSERT((*upper).first == a.upper_bound(k)->first);
+        }
+    }
+    auto thawed = mapped->thaw();
+    thawed.validate();
+    auto saved = a;
+    for (int i = 0; i < LIMIT * 100; ++i) {
+        auto k = Key(rand() % range) * scale;
+        ASSERT(thawed.erase(k) == a.erase(k));
+    }
+    check_equal(*mapped, saved); // writing to the thawed copy leaves the image alone
+    ASSERT(thawed.size() == a.size());
+    auto moved = std::move(*mapped);
+    ASSERT(mapped->empty() && !(mapped->begin() != mapped->end()));
+    ASSERT(moved.size() >= a.size());
+}
+
+int main() {
+    auto seed = time(nullptr);
+    std::cout << seed << std::endl;
+    srand(seed);
+    for (int count : {0, 1, 10, 11, 12, 132, 133, LIMIT * 1000}) {
+        check_image<BTree<int, int>, MappedBTree<int, int>>(1, LIMIT * 2000, count);
+        check_image<BTree<int, int>, MappedBTree<int, int, LINEAR_SEARCH, 3>>(1, LIMIT * 2000, count);
+    }
+    // entries in order leave every level exactly full at some sizes; the last leaf is then empty
+    using Mapped = MappedBTree<int, int>;
+    for (int count : {11, 12, 143, 144, 1727, 1728}) {
+        std::map<int, int> a;
+        BTree<int, int> test;
+        for (int i = 0; i < count; ++i) {
+            test.insert(i, -i);
+            a[i] = -i;
+        }
+        ASSERT(Mapped::save_image(test, IMAGE));
+        auto mapped = Mapped::map_image(IMAGE);
+        check_equal(*mapped, a);
+        ASSERT(!(mapped->lower_bound(count) != mapped->end()));
+        ASSERT(!mapped->member(count) && mapped->member(count - 1));
+    }
+    check_image<BTree<int64_t, int, SIMD_SEARCH, 16>, MappedBTree<int64_t, int, SIMD_SEARCH, 16>>(
+            -3'000'000'000ll, LIMIT * 2000, LIMIT * 1000);
+    check_image<BTree<double, int, SIMD_SEARCH, 3>, MappedBTree<double, int, SIMD_SEARCH, 3>>(0.5, 50, LIMIT * 10);
+    {
+        // an image is rejected by a tree of another layout, and a missing file is no image at all
+        BTree<int, int> test;
+        test.insert(1, 1);
+        using Narrow = MappedBTree<int, int, BINARY_SEARCH, 3>;
+        using Wide = MappedBTree<int64_t, int>;
+        ASSERT(Mapped::save_image(test, IMAGE));
+        ASSERT(!Narrow::map_image(IMAGE));
+        ASSERT(!Wide::map_image(IMAGE));
+        std::remove(IMAGE);
+        ASSERT(!Mapped::map_image(IMAGE));
+        ASSERT(!Mapped::save_image(test, "/nonexistent/test_mapped.image"));
+    }
+    {
+        // truncated or corrupted images are rejected before anything reads past the mapping
+        BTree<int, int> test;
+        for (int i = 0; i < LIMIT * 100; ++i) test.insert(i, i);
+        ASSERT(Mapped::save_image(test, IMAGE));
+        std::string image;
+        {
+            std::ifstream in(IMAGE, std::ios::binary);
+            image.assign(std::istreambuf_iterator<char>(in), {});
+        }
+        auto remap = [](const std::string &bytes) {
+            std::ofstream(IMAGE, std::ios::binary | std::ios::trunc).write(bytes.data(), std::streamsize(bytes.size()));
+            return Mapped::map_image(IMAGE);
+        };
+        ASSERT(remap(image));
+        __mapped_impl::Header header;
+        std::memcpy(&header, image.data(), sizeof(header));
+        using Node = __mapped_impl::Node<int, int, BINARY_SEARCH, DEFAULT_BTREE_FACTOR, std::less<int>>;
+        ASSERT(header.height > 0);
+        ASSERT(!remap(image.substr(0, image.size() / 2)));
+        ASSERT(!remap(image.substr(0, header.root)));
+        auto broken = image;
+        uint64_t far = uint64_t(1) << 40u;
+        std::memcpy(&broken[header.root + sizeof(Node)], &far, sizeof(far));
+        ASSERT(!remap(broken));
+        broken = image;
+        uint16_t usage = 2 * DEFAULT_BTREE_FACTOR;
+        std::memcpy(&broken[header.root + offsetof(Node, usage)], &usage, sizeof(usage));
+        ASSERT(!remap(broken));
+        broken = image;
+        std::memcpy(&broken[header.root + sizeof(Node) + sizeof(uint64_t)],
+                    &image[header.root + sizeof(Node)], sizeof(uint64_t));
+        ASSERT(!remap(broken));
+        broken = image;
+        header.size++;
+        std::memcpy(broken.data(), &header, sizeof(header));
+        ASSERT(!remap(broken));
+        // whatever random damage is accepted can still be walked inside the mapping
+        for (int round = 0; round < 200; ++round) {
+            broken = image;
+            for (int i = 0; i < 8; ++i) {
+                broken[sizeof(header) + rand() % (image.size() - sizeof(header))] = char(rand());
+            }
+            if (auto mapped = remap(broken)) {
+                size_t n = 0;
+                for (auto iter = mapped->begin(); iter != mapped->end(); ++iter) n++;
+                ASSERT(n == mapped->size());
+                for (int i = 0; i < 100; ++i) mapped->member(rand() % (LIMIT * 100));
+            }
+        }
+        std::remove(IMAGE);
+    }
+    ASSERT(alive_node == 0);
+    return 0;
+}
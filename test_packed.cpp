@@ -0,0 +1,170 @@
+#include <map>
+#include <random>
+#include <string>
+
+#define DEBUG_MODE
+#define DEFAULT_BTREE_FACTOR 6
+
+#include <packed_btree.hpp>
+
+#define LIMIT 20
+
+using namespace btree;
+
+template<typename Tree, typename Map>
+void check_same(Tree &test, Map &a) {
+    test.validate();
+    ASSERT(test.size() == a.size());
+    auto iter = test.begin();
+    for (auto &i : a) {
+        ASSERT((*iter).first == i.first && (*iter).second == i.second);
+        ++iter;
+    }
+    ASSERT(!(iter != test.end()));
+    auto expected = a.begin();
+    test.for_each([&](auto key, auto &value) {
+        ASSERT(key == expected->first && value == expected->second);
+        ++expected;
+    });
+    if (a.empty()) return;
+    iter = test.find(a.rbegin()->first);
+    for (auto i = a.rbegin(); i != a.rend(); ++i) {
+        ASSERT((*iter).first == i->first);
+        --iter;
+    }
+    ASSERT(!(iter != test.end()));
+}
+
+/* keys are `origin + step * r` with r in [0, range), so `step` sets how wide the leaves must pack */
+template<typename Tree, typename Key>
+void check_packed(Key origin, Key step, int range, int count) {
+    std::map<Key, int> a;
+    Tree test;
+    auto key = [&](int r) { return Key(origin + step * Key(r)); };
+    for (int i = 0; i < count; ++i) {
+        auto k = key(rand() % range);
+        auto v = rand();
+        auto hit = a.find(k);
+        auto replaced = test.insert(k, v);
+        ASSERT(bool(replaced) == (hit != a.end()));
+        if (replaced) ASSERT(*replaced == hit->second);
+        a[k] = v;
+    }
+    check_same(test, a);
+    for (int i = 0; i < LIMIT * 100; ++i) {
+        auto k = key(rand() % (range + 10) - 5);
+        ASSERT(test.member(k) == a.count(k));
+        auto found = test.find(k);
+        ASSERT((found != test.end()) == a.count(k));
+        if (found != test.end()) {
+            ASSERT((*found).second == a[k]);
+        }
+        auto lower = test.lower_bound(k);
+        auto upper = test.upper_bound(k);
+        if (a.lower_bound(k) == a.end()) {
+            ASSERT(!(lower != test.end()));
+        } else {
+            ASSERT((*lower).first == a.lower_bound(k)->first);
+        }
+        if (a.upper_bound(k) == a.end()) {
+            ASSERT(!(upper != test.end()));
+        } else {
+            ASSERT((*upper).first == a.upper_bound(k)->first);
+        }
+    }
+    auto copied = test;
+    check_same(copied, a);
+    for (int i = 0; i < count; ++i) {
+        auto k = key(rand() % range);
+        ASSERT(test.erase(k) == a.erase(k));
+        if (i % 100 == 0) {
+            test.validate();
+        }
+    }
+    check_same(test, a);
+    while (!a.empty()) {
+        auto k = rand() % 2 ? a.begin()->first : a.rbegin()->first;
+        ASSERT(test.erase(k) == 1);
+        a.erase(k);
+    }
+    check_same(test, a);
+    ASSERT(test.empty() && !(test.begin() != test.end()) && test.packed_bytes() == 0);
+}
+
+int main() {
+    auto seed = time(nullptr);
+    std::cout << seed << std::endl;
+    srand(seed);
+    for (int count : {0, 1, 63, 64, 65, 200, LIMIT * 1000}) {
+        check_packed<PackedBTree<int, int>, int>(0, 1, count * 2 + 1, count);
+        check_packed<PackedBTree<int, int, BINARY_SEARCH, 3>, int>(-1'000'000'000, 50'000, count * 2 + 1, count);
+    }
+    // lanes of every width, including keys that span the whole key type
+    check_packed<PackedBTree<int64_t, int, SIMD_SEARCH>, int64_t>(1'700'000'000'000ll, 1, LIMIT * 2000, LIMIT * 1000);
+    check_packed<PackedBTree<int64_t, int>, int64_t>(-4'000'000'000'000'000'000ll, 1ll << 40, LIMIT * 2000, LIMIT * 1000);
+    check_packed<PackedBTree<uint64_t, int>, uint64_t>(0, 0xFFFF'FFFF'FFFF'FFFFull / 4000, 4001, LIMIT * 500);
+    check_packed<PackedBTree<uint32_t, int>, uint32_t>(100, 300, LIMIT * 2000, LIMIT * 1000);
+    check_packed<PackedBTree<int16_t, int>, int16_t>(-32768, 1, 65536, LIMIT * 1000);
+    check_packed<PackedBTree<uint8_t, int>, uint8_t>(0, 1, 256, LIMIT * 100);
+    ASSERT(alive_node == 0);
+    {
+        // values that own memory move through splits, merges and repacking
+        std::map<int, std::string> a;
+        PackedBTree<int, std::string> test;
+        for (int i = 0; i < LIMIT * 500; ++i) {
+            auto k = rand() % (LIMIT * 1000);
+            auto v = std::string(rand() % 40, char('a' + k % 26));
+            test.insert(k, v);
+            a[k] = v;
+        }
+        for (int i = 0; i < LIMIT * 500; ++i) {
+            auto k = rand() % (LIMIT * 1000);
+            ASSERT(test.erase(k) == a.erase(k));
+        }
+        check_same(test, a);
+        auto moved = std::move(test);
+        ASSERT(test.empty() && moved.size() == a.size());
+        test = moved;
+        check_same(test, a);
+    }
+    ASSERT(alive_node == 0);
+    for (int n : {0, 1, 64, 65, 1000, LIMIT * 1000 + 7}) {
+        for (auto fill : {0.0, 0.5, 1.0}) {
+            std::map<int64_t, int> a;
+            for (int i = 0; i < n; ++i) {
+                a[1'600'000'000'000ll + 3 * i] = i;
+            }
+            auto test = PackedBTree<int64_t, int>::from_sorted(a.begin(), a.end(), fill);
+            check_same(test, a);
+            if (n >= 1000 && fill == 1.0) {
+                // dense IDs take a byte-wide lane each: a full leaf packs 64 keys into one cache line
+                ASSERT(test.packed_bytes() * 4 <= n * sizeof(int64_t));
+            }
+            for (int i = 0; i < n; ++i) {
+                auto k = 1'600'000'000'000ll + 3 * i + 1;
+                test.insert(k, -i);
+                a[k] = -i;
+            }
+            check_same(test, a);
+        }
+    }
+    {
+        // keys arriving in order fill each leaf before starting the next, in blocks only as wide as their lanes
+        std::map<int64_t, int> a;
+        PackedBTree<int64_t, int> test;
+        int n = LIMIT * 64 * 50;
+        for (int i = 0; i < n; ++i) {
+            test.insert(1'600'000'000'000ll + 3 * i, i);
+            a[1'600'000'000'000ll + 3 * i] = i;
+        }
+        check_same(test, a);
+        ASSERT(test.packed_bytes() == size_t(n / 64) * (sizeof(int64_t) + 64));
+        // a key far off widens the lanes of its leaf, which moves to a larger block
+        test.insert(0, -1);
+        a[0] = -1;
+        check_same(test, a);
+        ASSERT(test.packed_bytes() > size_t(n / 64) * (sizeof(int64_t) + 64));
+    }
+    ASSERT(alive_node == 0);
+    return 0;
+}
@@ -0,0 +1,141 @@
+#include <map>
+#include <random>
+#include <string>
+#include <thread>
+
+#define DEBUG_MODE
+#define DEFAULT_BTREE_FACTOR 6
+
+#include <persistent_btree.hpp>
+
+#define LIMIT 20
+
+using namespace btree;
+
+template<typename Tree, typename Map>
+void check_equal(Tree &tree, const Map &expected) {
+    tree.validate();
+    ASSERT(tree.size() == expected.size());
+    auto iter = tree.begin();
+    for (auto &i : expected) {
+        ASSERT((*iter).first == i.first && (*iter).second == i.second);
+        ++iter;
+    }
+    ASSERT(!(iter != tree.end()));
+}
+
+template<typename Tree, typename Key>
+void check_tree(Key scale, int range) {
+    std::map<Key, int> a;
+    Tree test;
+    std::vector<std::pair<Tree, std::map<Key, int>>> snapshots;
+    for (int round = 0; round < 20; ++round) {
+        for (int i = 0; i < LIMIT * 50; ++i) {
+            auto k = Key(rand() % range) * scale;
+            auto v = rand();
+            auto old = test.insert(k, v);
+            auto iter = a.find(k);
+            ASSERT(bool(old) == (iter != a.end()));
+            if (old) {
+                ASSERT(*old == iter->second);
+            }
+            a[k] = v;
+        }
+        snapshots.emplace_back(test.snapshot(), a);
+        for (int i = 0; i < LIMIT * 45; ++i) {
+            auto k = Key(rand() % range) * scale;
+            ASSERT(test.erase(k) == a.erase(k));
+        }
+        if (round % 4 == 3) {
+            snapshots.erase(snapshots.begin() + rand() % snapshots.size());
+        }
+        check_equal(test, a);
+        for (int i = 0; i < LIMIT * 10; ++i) {
+            auto k = Key(rand() % (range + 10)) * scale;
+            ASSERT(test.member(k) == a.count(k));
+            auto lower = test.lower_bound(k);
+            auto upper = test.upper_bound(k);
+            if (a.lower_bound(k) == a.end()) {
+                ASSERT(!(lower != test.end()));
+            } else {
+                ASSERT((*lower).first == a.lower_bound(k)->first);
+            }
+            if (a.upper_bound(k) == a.end()) {
+                ASSERT(!(upper != test.end()));
+            } else {
+                ASSERT((*upper).first == a.upper_bound(k)->first);
+            }
+        }
+    }
+    for (auto &[tree, expected] : snapshots) {
+        check_equal(tree, expected);
+    }
+    {
+        auto iter = test.end();
+        for (auto i = a.rbegin(); i != a.rend(); ++i) {
+            --iter;
+            ASSERT((*iter).first == i->first && (*iter).second == i->second);
+        }
+        ASSERT(!(--iter != test.end()));
+    }
+    while (!test.empty()) {
+        ASSERT(test.pop_max().first == a.rbegin()->first);
+        a.erase(std::prev(a.end()));
+        if (!test.empty()) {
+            ASSERT(test.pop_min().first == a.begin()->first);
+            a.erase(a.begin());
+        }
+    }
+    test.validate();
+    for (auto &[tree, expected] : snapshots) {
+        check_equal(tree, expected);
+    }
+}
+
+int main() {
+    auto seed = time(nullptr);
+    std::cout << seed << std::endl;
+    srand(seed);
+    check_tree<PersistentBTree<int, int>>(1, LIMIT * 200);
+    check_tree<PersistentBTree<int, int, LINEAR_SEARCH, 3>>(1, LIMIT * 200);
+    check_tree<PersistentBTree<int64_t, int, SIMD_SEARCH, 16>>(-3'000'000'000ll, LIMIT * 2000);
+    check_tree<PersistentBTree<double, int, SIMD_SEARCH, 3>>(0.5, 50);
+    ASSERT(alive_node == 0);
+    {
+        // an iterator over a snapshot survives any amount of writing to the original
+        std::map<int, std::string> a;
+        PersistentBTree<int, std::string, BINARY_SEARCH, 3> test;
+        for (int i = 0; i < LIMIT * 500; ++i) {
+            auto k = rand() % (LIMIT * 1000);
+            test.insert(k, std::to_string(k));
+            a[k] = std::to_string(k);
+        }
+        auto frozen = test.snapshot();
+        auto iter = frozen.begin();
+        auto expected = a.begin();
+        for (int round = 0; expected != a.end(); ++round) {
+            for (int i = 0; i < LIMIT && expected != a.end(); ++i, ++iter, ++expected) {
+                ASSERT((*iter).first == expected->first && (*iter).second == expected->second);
+            }
+            for (int i = 0; i < LIMIT * 5; ++i) {
+                auto k = rand() % (LIMIT * 1000);
+                if (i % 2) {
+                    test.erase(k);
+                } else {
+                    test.insert(k, std::to_string(-round));
+                }
+            }
+            test.validate();
+        }
+        ASSERT(!(iter != frozen.end()));
+        check_equal(frozen, a);
+        auto copied = frozen;
+        frozen.clear();
+        copied.validate();
+        std::thread([released = std::move(copied)]() mutable { released.clear(); }).join();
+        test = frozen;
+        ASSERT(test.empty());
+    }
+    ASSERT(alive_node == 0);
+    return 0;
+}
@@ -1,4 +1,6 @@
 #include <deque>
+#include <map>
+#include <set>
 
 #define DEBUG_MODE
 #define DEFAULT_BTREE_FACTOR 6
@@ -9,6 +11,79 @@
 #define POP_LIMIT 20000
 using namespace btree;
 
+template<typename Tree>
+void check_split() {
+    std::set<int> a;
+    Tree test;
+    for (int i = 0; i < LIMIT; ++i) {
+        auto k = rand() % (LIMIT * 4);
+        a.insert(k);
+        test.insert(k, k);
+    }
+    for (int round = 0; round < 200; ++round) {
+        auto key = rand() % (LIMIT * 5) - LIMIT / 2;
+        auto right = test.split_off(key);
+        test.validate();
+        right.validate();
+        ASSERT(right.size() == size_t(std::distance(a.lower_bound(key), a.end())));
+        ASSERT(test.size() + right.size() == a.size());
+        if (!right.empty()) ASSERT(right.min_key() == *a.lower_bound(key));
+        if (!test.empty()) ASSERT(test.max_key() == *std::prev(a.lower_bound(key)));
+        if (round % 3 == 0) {
+            // the right part may keep growing on its own before it comes back
+            for (int i = 0; i < LIMIT / 100; ++i) {
+                auto k = key + rand() % (LIMIT / 10);
+                a.insert(k);
+                right.insert(k, k);
+            }
+        }
+        if (round % 2) {
+            ASSERT(test.append(std::move(right)));
+        } else {
+            auto left = std::move(test);
+            ASSERT(left.append(std::move(right)));
+            test = std::move(left);
+        }
+        ASSERT(right.empty());
+        test.validate();
+        ASSERT(test.size() == a.size());
+    }
+    auto iter = test.begin();
+    for (auto i : a) {
+        ASSERT((*iter).first == i);
+        ++iter;
+    }
+    {
+        // independently built trees need not share an allocator
+        Tree low, high;
+        for (int i = 0; i < LIMIT; ++i) {
+            low.insert(i, i);
+            high.insert(LIMIT + i, i);
+        }
+        // keys that do not all come after ours are refused, whichever way the nodes would move
+        Tree overlap, same;
+        overlap.insert(LIMIT - 1, 0);
+        overlap.insert(3 * LIMIT, 0);
+        same.insert(0, 0);
+        ASSERT(!low.append(std::move(overlap)) && overlap.size() == 2 && low.size() == LIMIT);
+        ASSERT(!low.append(std::move(same)) && same.size() == 1 && low.size() == LIMIT);
+        ASSERT(low.append(std::move(high)));
+        ASSERT(high.empty());
+        { auto dropped = std::move(high); }
+        high.insert(-1, -1);
+        low.validate();
+        ASSERT(low.size() == 2 * LIMIT);
+        int expected = 0;
+        for (auto i = low.begin(); i != low.end(); ++i) {
+            ASSERT((*i).first == expected++);
+        }
+        Tree empty;
+        ASSERT(empty.append(std::move(low)));
+        empty.validate();
+        ASSERT(empty.size() == 2 * LIMIT && low.empty());
+    }
+}
+
 int main() {
     auto seed = time(nullptr);
     std::cout << seed << std::endl;
@@ -24,7 +99,7 @@ int main() {
         std::sort(a.begin(), a.end());
         a.erase(unique(a.begin(), a.end()), a.end());
         ASSERT(test.size() == a.size());
-        for (auto i = 0; i < POP_LIMIT; ++i) {
+        for (auto i = 0; i < POP_LIMIT && !a.empty(); ++i) {
             auto step = rand() % a.size();
             auto iter0 = a.begin();
             auto iter1 = test.begin();
@@ -82,5 +157,180 @@ int main() {
         ASSERT(a == b);
     }
     ASSERT(alive_node == 0);
+    {
+        std::vector<int> a, b;
+        BTree<int, int, true, DEFAULT_BTREE_FACTOR, std::less<int>, SlabAllocator<std::pair<const int, int>>> test;
+        for (int i = 0; i < LIMIT; ++i) {
+            test.insert(rand(), 0);
+        }
+        test.clear();
+        ASSERT(alive_node == 0);
+        for (int i = 0; i < LIMIT; ++i) {
+            auto k = rand();
+            a.push_back(k);
+            test.insert(k, k);
+        }
+        std::sort(a.begin(), a.end());
+        a.erase(unique(a.begin(), a.end()), a.end());
+        for (auto i = 0; i < POP_LIMIT / 2; ++i) {
+            auto step = rand() % a.size();
+            auto iter0 = a.begin();
+            auto iter1 = test.begin();
+            std::advance(iter0, step);
+            for (unsigned i = 0; i < step; ++i, ++iter1);
+            a.erase(iter0);
+            test.erase(iter1);
+            ASSERT(a.size() == test.size());
+        }
+        for (auto i : test) {
+            b.push_back(i.first);
+        }
+        ASSERT(a == b);
+    }
+    ASSERT(alive_node == 0);
+    {
+        std::set<int> a;
+        BTree<int, int, true, 3> test;
+        for (int round = 0; round < 400; ++round) {
+            for (int i = 0, n = rand() % (LIMIT / 10); i < n; ++i) {
+                auto k = rand() % (LIMIT * 4);
+                a.insert(k);
+                test.insert(k, k);
+            }
+            auto lo = rand() % (LIMIT * 4);
+            auto hi = lo + rand() % (LIMIT / (1 + rand() % 64));
+            switch (round % 4) {
+                case 0: {
+                    auto expected = std::distance(a.lower_bound(lo), a.lower_bound(hi));
+                    ASSERT(test.erase_range(lo, hi) == size_t(expected));
+                    a.erase(a.lower_bound(lo), a.lower_bound(hi));
+                    break;
+                }
+                case 1: {
+                    auto next = test.erase(test.lower_bound(lo), rand() % 8 ? test.lower_bound(hi) : test.end());
+                    auto last = next != test.end() ? a.find((*next).first) : a.end();
+                    ASSERT(next != test.end() || last == a.end());
+                    a.erase(a.lower_bound(lo), last);
+                    break;
+                }
+                case 2: {
+                    std::vector<int> batch;
+                    for (int i = 0, n = rand() % LIMIT; i < n; ++i) {
+                        batch.push_back(lo + rand() % (LIMIT / 4));
+                    }
+                    std::sort(batch.begin(), batch.end());
+                    size_t expected = 0;
+                    for (auto k : batch) expected += a.erase(k);
+                    ASSERT(test.erase_batch(batch) == expected);
+                    break;
+                }
+                default:
+                    for (auto k = lo; k < hi; ++k) {
+                        ASSERT(test.erase(k) == a.erase(k));
+                    }
+            }
+            test.validate();
+            ASSERT(test.size() == a.size());
+        }
+        std::vector<int> b;
+        for (auto i : test) {
+            b.push_back(i.first);
+        }
+        ASSERT(std::equal(a.begin(), a.end(), b.begin(), b.end()));
+        ASSERT(test.erase_range(INT32_MIN, INT32_MAX) == a.size());
+        ASSERT(test.empty());
+        test.validate();
+        test.insert(1, 1);
+        ASSERT(test.size() == 1 && test.member(1));
+    }
+    ASSERT(alive_node == 0);
+    {
+        using Counted = BTree<int, int, BINARY_SEARCH, 3, std::less<int>, std::allocator<std::pair<const int, int>>,
+                ORDER_STATISTICS>;
+        std::map<int, int> a;
+        for (int i = 0; i < LIMIT; ++i) {
+            a[rand() % (LIMIT * 4)] = i;
+        }
+        auto test = Counted::from_sorted(a.begin(), a.end(), 0.6);
+        for (int round = 0; round < 100; ++round) {
+            std::vector<std::pair<int, int>> batch(rand() % (LIMIT / 20));
+            for (auto &i : batch) {
+                i = {rand() % (LIMIT * 4), round};
+                a[i.first] = round;
+            }
+            test.insert_batch(batch);
+            for (int i = 0, n = rand() % (LIMIT / 20); i < n; ++i) {
+                auto k = rand() % (LIMIT * 4);
+                a[k] = k;
+                test.insert(k, k);
+            }
+            auto lo = rand() % (LIMIT * 4);
+            auto hi = lo + rand() % (LIMIT / (1 + rand() % 64));
+            if (round % 2) {
+                test.erase_range(lo, hi);
+            } else {
+                std::vector<int> keys;
+                for (auto k = lo; k < hi; k += 1 + rand() % 3) keys.push_back(k);
+                test.erase_batch(keys);
+                for (auto k : keys) a.erase(k);
+                lo = hi;
+            }
+            a.erase(a.lower_bound(lo), a.lower_bound(hi));
+            for (int i = 0; i < LIMIT / 100; ++i) {
+                auto k = rand() % (LIMIT * 4);
+                ASSERT(test.erase(k) == a.erase(k));
+            }
+            test.validate();
+        }
+        auto copied = test;
+        copied.validate();
+        std::vector<int> b;
+        for (auto &i : a) {
+            b.push_back(i.first);
+        }
+        ASSERT(copied.size() == b.size());
+        ASSERT(!(copied.nth(b.size()) != copied.end()));
+        for (int i = 0; i < LIMIT; ++i) {
+            auto k = rand() % b.size();
+            auto iter = copied.nth(k);
+            ASSERT((*iter).first == b[k]);
+            auto target = rand() % (LIMIT * 4);
+            auto rank = std::lower_bound(b.begin(), b.end(), target) - b.begin();
+            ASSERT(copied.rank(target) == size_t(rank));
+            ASSERT(copied.count_range(target, target + 100) ==
+                   size_t(std::lower_bound(b.begin(), b.end(), target + 100) - b.begin() - rank));
+            auto step = ptrdiff_t(rand() % b.size()) - ptrdiff_t(k);
+            iter = copied.advance(iter, step);
+            ASSERT((*iter).first == b[k + step]);
+            ASSERT(copied.index_of(iter) == size_t(ptrdiff_t(k) + step));
+            // backwards from the end, over as many leaves as it takes
+            auto back = ptrdiff_t(1 + rand() % b.size());
+            ASSERT((*copied.advance(copied.end(), -back)).first == b[b.size() - back]);
+        }
+        auto last = copied.nth(b.size() - 1);
+        ASSERT(!(copied.advance(last, 1) != copied.end()));
+        ASSERT((*copied.advance(copied.end(), -1)).first == b.back());
+        ASSERT((*copied.advance(copied.advance(copied.end(), -ptrdiff_t(b.size())), 0)).first == b.front());
+        ASSERT(copied.index_of(copied.end()) == b.size());
+        // targets outside [0, size()] give end()
+        ASSERT(!(copied.advance(copied.end(), 1) != copied.end()));
+        ASSERT(!(copied.advance(copied.begin(), -1) != copied.end()));
+        ASSERT(!(copied.advance(copied.end(), -ptrdiff_t(b.size()) - 1) != copied.end()));
+        while (!copied.empty()) {
+            copied.pop_min();
+            if (!copied.empty()) {
+                ASSERT(copied.advance(copied.nth(copied.size() - 1), -ptrdiff_t(copied.size() - 1)) != copied.end());
+            }
+        }
+        ASSERT(!(copied.advance(copied.end(), -1) != copied.end()));
+        copied.validate();
+    }
+    ASSERT(alive_node == 0);
+    check_split<BTree<int, int, BINARY_SEARCH, 3>>();
+    check_split<BTree<int, int, BINARY_SEARCH, 3, std::less<int>, std::allocator<std::pair<const int, int>>,
+            LEAF_LINKS | ORDER_STATISTICS>>();
+    check_split<BTree<int, int, BINARY_SEARCH, DEFAULT_BTREE_FACTOR, std::less<int>,
+            SlabAllocator<std::pair<const int, int>>>>();
+    ASSERT(alive_node == 0);
     return 0;
 }
\ No newline at end of file
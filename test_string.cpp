@@ -0,0 +1,144 @@
+#include <map>
+#include <random>
+#include <string>
+
+#define DEBUG_MODE
+#define DEFAULT_BTREE_FACTOR 6
+
+#include <string_btree.hpp>
+
+#define LIMIT 20
+
+using namespace btree;
+
+template<typename Tree>
+void check_equal(Tree &tree, const std::map<std::string, int> &expected) {
+    tree.validate();
+    ASSERT(tree.size() == expected.size());
+    auto iter = tree.begin();
+    for (auto &i : expected) {
+        ASSERT((*iter).first == i.first && (*iter).second == i.second);
+        ++iter;
+    }
+    ASSERT(!(iter != tree.end()));
+}
+
+/* keys from `make`, which decides how much of them is shared and where they first differ */
+template<typename Tree, typename Make>
+void check_strings(Make make, int range) {
+    std::map<std::string, int> a;
+    Tree test;
+    for (int round = 0; round < 10; ++round) {
+        for (int i = 0; i < LIMIT * 50; ++i) {
+            auto k = make(rand() % range);
+            auto v = rand();
+            auto old = test.insert(k, v);
+            auto iter = a.find(k);
+            ASSERT(bool(old) == (iter != a.end()));
+            if (old) {
+                ASSERT(*old == iter->second);
+            }
+            a[k] = v;
+        }
+        check_equal(test, a);
+        for (int i = 0; i < LIMIT * 45; ++i) {
+            auto k = make(rand() % range);
+            ASSERT(test.erase(k) == a.erase(k));
+        }
+        check_equal(test, a);
+        for (int i = 0; i < LIMIT * 10; ++i) {
+            auto k = make(rand() % (range + 10));
+            if (i % 3 == 0) k.resize(rand() % (k.size() + 1));
+            if (i % 5 == 0) k += char(rand() % 256);
+            ASSERT(test.member(k) == a.count(k));
+            auto found = test.find(k);
+            ASSERT((found != test.end()) == a.count(k));
+            auto lower = test.lower_bound(k);
+            if (a.lower_bound(k) == a.end()) {
+                ASSERT(!(lower != test.end()));
+            } else {
+                ASSERT((*lower).first == a.lower_bound(k)->first);
+            }
+        }
+    }
+    auto [live, dead] = test.arena_bytes();
+    ASSERT(dead <= live);
+    auto copied = test;
+    test.clear();
+    ASSERT(test.empty());
+    check_equal(copied, a);
+    test = copied;
+    copied.clear();
+    check_equal(test, a);
+}
+
+int main() {
+    auto seed = time(nullptr);
+    std::cout << seed << std::endl;
+    srand(seed);
+    // differing right at the start, so the prefixes decide nearly everything
+    check_strings<StringBTree<int>>([](int i) { return std::to_string(i * 7919 % 100003); }, LIMIT * 200);
+    // URLs sharing a long scheme and host, then paths of different lengths
+    check_strings<StringBTree<int, BINARY_SEARCH, 3>>([](int i) {
+        return "https://example.com/users/" + std::to_string(i) + (i % 3 ? "/profile" : "");
+    }, LIMIT * 200);
+    // keys that tie on their 8 bytes after the shared part, with embedded zero bytes and high bytes
+    check_strings<StringBTree<int, LINEAR_SEARCH>>([](int i) {
+        std::string k = "/var/lib/";
+        k += std::string(i % 4, '\0') + "samesame";
+        k += char(i % 256);
+        return k + std::to_string(i / 256);
+    }, LIMIT * 200);
+    {
+        // the common part shrinks as keys arrive that do not share it
+        std::map<std::string, int> a;
+        StringBTree<int> test;
+        for (auto k : {"https://example.com/a", "https://example.com/b", "https://example.org/", "http://x", "h",
+                       "", "zzz", "https://example.com/a"}) {
+            test.insert(k, int(a.size()));
+            a.emplace(k, int(a.size()));
+            test.validate();
+        }
+        for (auto &i : a) {
+            test.insert(i.first, i.second);
+        }
+        check_equal(test, a);
+        ASSERT(test.member("") && !test.member("https://example.com/"));
+        ASSERT((*test.lower_bound("https://example.com/")).first == "https://example.com/a");
+        while (!a.empty()) {
+            ASSERT(test.erase(a.begin()->first) == 1);
+            a.erase(a.begin());
+            check_equal(test, a);
+        }
+        auto [live, dead] = test.arena_bytes();
+        ASSERT(live == 0 && dead == 0);
+        test.insert("again", 1);
+        test.validate();
+    }
+    {
+        // a moved-from tree starts over with an arena of its own
+        std::map<std::string, int> a, b;
+        StringBTree<int> test;
+        for (auto k : {"aaaa", "bbbb", "cccc"}) {
+            test.insert(k, int(a.size()));
+            a.emplace(k, int(a.size()));
+        }
+        auto moved = std::move(test);
+        ASSERT(test.empty());
+        for (auto k : {"zzzz", "yyyy"}) {
+            test.insert(k, int(b.size()));
+            b.emplace(k, int(b.size()));
+        }
+        check_equal(test, b);
+        check_equal(moved, a);
+        StringBTree<int> assigned;
+        assigned.insert("dddd", 0);
+        assigned = std::move(moved);
+        moved.insert("xxxx", 0);
+        check_equal(assigned, a);
+        ASSERT(moved.size() == 1 && moved.member("xxxx"));
+        moved.validate();
+    }
+    ASSERT(alive_node == 0);
+    return 0;
+}